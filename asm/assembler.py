@@ -61,6 +61,9 @@ class TokenType(IntEnum):
     # Used after tokenization later
     IMEMORY = auto()
     RMEMORY = auto()
+    # [register + displacement] and [register + register], with a pair as value.
+    DMEMORY = auto()
+    XMEMORY = auto()
 
     def __str__(self):
         return self.name.upper()
@@ -117,9 +120,12 @@ REGISTERS = {
     "r5": 8,
     "r6": 9,
     "r7": 10,
-    "r8": 11
+    "r8": 11,
+    "id": 12
 }
 
+VECTORS = {f"v{i}": i for i in range(8)}
+
 
 # Has to align with the VM's instruction set!
 @unique
@@ -195,6 +201,66 @@ class OperationType(IntEnum):
     HALT = auto()
     PRINT_I = auto()
     PRINT_R = auto()
+    CAS = auto()
+    FADD = auto()
+    FENCE = auto()
+    VERSION = auto()
+    MOV_P = auto()
+    CMP_P = auto()
+    CMP_B = auto()
+    ADD_P = auto()
+    SUB_P = auto()
+    MUL_P = auto()
+    AND_P = auto()
+    OR_P = auto()
+    XOR_P = auto()
+    SHL_P = auto()
+    SHR_P = auto()
+    ADD_B = auto()
+    SUB_B = auto()
+    SHL_B = auto()
+    JMP_S = auto()
+    JEQ_S = auto()
+    JNE_S = auto()
+    JLT_S = auto()
+    JGT_S = auto()
+    JLE_S = auto()
+    JGE_S = auto()
+    CALL_S = auto()
+    MOV_R_RD = auto()
+    MOV_R_RX = auto()
+    MOV_RD_R = auto()
+    MOV_RX_R = auto()
+    MOVB_R_RD = auto()
+    MOVB_R_RX = auto()
+    MOVB_RD_R = auto()
+    MOVB_RX_R = auto()
+    FMUL_I = auto()
+    FMUL_R = auto()
+    FDIV_I = auto()
+    FDIV_R = auto()
+    MULW_I = auto()
+    MULW_R = auto()
+    PADD = auto()
+    PSUB = auto()
+    PCMPEQ = auto()
+    PCMPGT = auto()
+    PMIN = auto()
+    PMAX = auto()
+    PSHUF = auto()
+    VLD = auto()
+    VST = auto()
+    VSPLAT = auto()
+    VADD = auto()
+    VSUB = auto()
+    VCMPEQ = auto()
+    VCMPGT = auto()
+    VMIN = auto()
+    VMAX = auto()
+    VSHUF = auto()
+    VAND = auto()
+    VOR = auto()
+    VXOR = auto()
 
     DIRECTIVE = auto()
 
@@ -211,6 +277,8 @@ class Operation:
         self.typ = typ
         self.val = val
         self.full = full
+        # Byte range [start, end) the operation occupies, set by `build`.
+        self.span = None
 
     def __str__(self):
         return f"{self.typ} {repr(self.val)}"
@@ -238,6 +306,11 @@ OPERATIONS = {
         ([TokenType.RMEMORY, TokenType.SYMBOL], OperationType.MOV_RM_R),
         ([TokenType.RMEMORY, TokenType.IMEMORY], OperationType.MOV_RM_IM),
         ([TokenType.RMEMORY, TokenType.RMEMORY], OperationType.MOV_RM_RM),
+
+        ([TokenType.SYMBOL, TokenType.DMEMORY], OperationType.MOV_R_RD),
+        ([TokenType.SYMBOL, TokenType.XMEMORY], OperationType.MOV_R_RX),
+        ([TokenType.DMEMORY, TokenType.SYMBOL], OperationType.MOV_RD_R),
+        ([TokenType.XMEMORY, TokenType.SYMBOL], OperationType.MOV_RX_R),
     ],
 
     "movb": [
@@ -255,6 +328,11 @@ OPERATIONS = {
         ([TokenType.RMEMORY, TokenType.SYMBOL], OperationType.MOVB_RM_R),
         ([TokenType.RMEMORY, TokenType.IMEMORY], OperationType.MOVB_RM_IM),
         ([TokenType.RMEMORY, TokenType.RMEMORY], OperationType.MOVB_RM_RM),
+
+        ([TokenType.SYMBOL, TokenType.DMEMORY], OperationType.MOVB_R_RD),
+        ([TokenType.SYMBOL, TokenType.XMEMORY], OperationType.MOVB_R_RX),
+        ([TokenType.DMEMORY, TokenType.SYMBOL], OperationType.MOVB_RD_R),
+        ([TokenType.XMEMORY, TokenType.SYMBOL], OperationType.MOVB_RX_R),
     ],
 
     "push": [
@@ -297,6 +375,27 @@ OPERATIONS = {
          OperationType.DIV_R),
     ],
 
+    "fmul": [
+        ([TokenType.SYMBOL, TokenType.SYMBOL, TokenType.NUMBER],
+         OperationType.FMUL_I),
+        ([TokenType.SYMBOL, TokenType.SYMBOL, TokenType.SYMBOL],
+         OperationType.FMUL_R),
+    ],
+
+    "fdiv": [
+        ([TokenType.SYMBOL, TokenType.SYMBOL, TokenType.NUMBER],
+         OperationType.FDIV_I),
+        ([TokenType.SYMBOL, TokenType.SYMBOL, TokenType.SYMBOL],
+         OperationType.FDIV_R),
+    ],
+
+    "mulw": [
+        ([TokenType.SYMBOL, TokenType.SYMBOL, TokenType.NUMBER],
+         OperationType.MULW_I),
+        ([TokenType.SYMBOL, TokenType.SYMBOL, TokenType.SYMBOL],
+         OperationType.MULW_R),
+    ],
+
     "and": [
         ([TokenType.SYMBOL, TokenType.SYMBOL, TokenType.NUMBER],
          OperationType.AND_I),
@@ -389,6 +488,18 @@ OPERATIONS = {
         ([TokenType.SYMBOL], OperationType.PRINT_R),
     ],
 
+    "cas": [
+        ([TokenType.SYMBOL, TokenType.RMEMORY, TokenType.SYMBOL],
+         OperationType.CAS),
+    ],
+
+    "fadd": [
+        ([TokenType.SYMBOL, TokenType.RMEMORY, TokenType.SYMBOL],
+         OperationType.FADD),
+    ],
+
+    "fence": OperationType.FENCE,
+
     "mov_r_i": [([TokenType.SYMBOL, TokenType.NUMBER], OperationType.MOV_R_I)],
     "mov_r_r": [([TokenType.SYMBOL, TokenType.SYMBOL], OperationType.MOV_R_R)],
     "mov_r_im": [([TokenType.SYMBOL, TokenType.IMEMORY], OperationType.MOV_R_IM)],
@@ -419,6 +530,16 @@ OPERATIONS = {
     "movb_rm_im": [([TokenType.RMEMORY, TokenType.IMEMORY], OperationType.MOVB_RM_IM)],
     "movb_rm_rm": [([TokenType.RMEMORY, TokenType.RMEMORY], OperationType.MOVB_RM_RM)],
 
+    "mov_r_rd": [([TokenType.SYMBOL, TokenType.DMEMORY], OperationType.MOV_R_RD)],
+    "mov_r_rx": [([TokenType.SYMBOL, TokenType.XMEMORY], OperationType.MOV_R_RX)],
+    "mov_rd_r": [([TokenType.DMEMORY, TokenType.SYMBOL], OperationType.MOV_RD_R)],
+    "mov_rx_r": [([TokenType.XMEMORY, TokenType.SYMBOL], OperationType.MOV_RX_R)],
+
+    "movb_r_rd": [([TokenType.SYMBOL, TokenType.DMEMORY], OperationType.MOVB_R_RD)],
+    "movb_r_rx": [([TokenType.SYMBOL, TokenType.XMEMORY], OperationType.MOVB_R_RX)],
+    "movb_rd_r": [([TokenType.DMEMORY, TokenType.SYMBOL], OperationType.MOVB_RD_R)],
+    "movb_rx_r": [([TokenType.XMEMORY, TokenType.SYMBOL], OperationType.MOVB_RX_R)],
+
     "push_i": [([TokenType.NUMBER], OperationType.PUSH_I)],
     "push_r": [([TokenType.SYMBOL], OperationType.PUSH_R)],
 
@@ -434,6 +555,38 @@ OPERATIONS = {
     "div_i": [([TokenType.SYMBOL, TokenType.SYMBOL, TokenType.NUMBER], OperationType.DIV_I)],
     "div_r": [([TokenType.SYMBOL, TokenType.SYMBOL, TokenType.SYMBOL], OperationType.DIV_R)],
 
+    "fmul_i": [([TokenType.SYMBOL, TokenType.SYMBOL, TokenType.NUMBER], OperationType.FMUL_I)],
+    "fmul_r": [([TokenType.SYMBOL, TokenType.SYMBOL, TokenType.SYMBOL], OperationType.FMUL_R)],
+
+    "fdiv_i": [([TokenType.SYMBOL, TokenType.SYMBOL, TokenType.NUMBER], OperationType.FDIV_I)],
+    "fdiv_r": [([TokenType.SYMBOL, TokenType.SYMBOL, TokenType.SYMBOL], OperationType.FDIV_R)],
+
+    "mulw_i": [([TokenType.SYMBOL, TokenType.SYMBOL, TokenType.NUMBER], OperationType.MULW_I)],
+    "mulw_r": [([TokenType.SYMBOL, TokenType.SYMBOL, TokenType.SYMBOL], OperationType.MULW_R)],
+
+    "padd": [([TokenType.SYMBOL, TokenType.SYMBOL, TokenType.SYMBOL], OperationType.PADD)],
+    "psub": [([TokenType.SYMBOL, TokenType.SYMBOL, TokenType.SYMBOL], OperationType.PSUB)],
+    "pcmpeq": [([TokenType.SYMBOL, TokenType.SYMBOL, TokenType.SYMBOL], OperationType.PCMPEQ)],
+    "pcmpgt": [([TokenType.SYMBOL, TokenType.SYMBOL, TokenType.SYMBOL], OperationType.PCMPGT)],
+    "pmin": [([TokenType.SYMBOL, TokenType.SYMBOL, TokenType.SYMBOL], OperationType.PMIN)],
+    "pmax": [([TokenType.SYMBOL, TokenType.SYMBOL, TokenType.SYMBOL], OperationType.PMAX)],
+    "pshuf": [([TokenType.SYMBOL, TokenType.SYMBOL, TokenType.SYMBOL], OperationType.PSHUF)],
+
+    "vld": [([TokenType.SYMBOL, TokenType.RMEMORY], OperationType.VLD)],
+    "vst": [([TokenType.RMEMORY, TokenType.SYMBOL], OperationType.VST)],
+    "vsplat": [([TokenType.SYMBOL, TokenType.SYMBOL], OperationType.VSPLAT)],
+
+    "vadd": [([TokenType.SYMBOL, TokenType.SYMBOL, TokenType.SYMBOL], OperationType.VADD)],
+    "vsub": [([TokenType.SYMBOL, TokenType.SYMBOL, TokenType.SYMBOL], OperationType.VSUB)],
+    "vcmpeq": [([TokenType.SYMBOL, TokenType.SYMBOL, TokenType.SYMBOL], OperationType.VCMPEQ)],
+    "vcmpgt": [([TokenType.SYMBOL, TokenType.SYMBOL, TokenType.SYMBOL], OperationType.VCMPGT)],
+    "vmin": [([TokenType.SYMBOL, TokenType.SYMBOL, TokenType.SYMBOL], OperationType.VMIN)],
+    "vmax": [([TokenType.SYMBOL, TokenType.SYMBOL, TokenType.SYMBOL], OperationType.VMAX)],
+    "vshuf": [([TokenType.SYMBOL, TokenType.SYMBOL, TokenType.SYMBOL], OperationType.VSHUF)],
+    "vand": [([TokenType.SYMBOL, TokenType.SYMBOL, TokenType.SYMBOL], OperationType.VAND)],
+    "vor": [([TokenType.SYMBOL, TokenType.SYMBOL, TokenType.SYMBOL], OperationType.VOR)],
+    "vxor": [([TokenType.SYMBOL, TokenType.SYMBOL, TokenType.SYMBOL], OperationType.VXOR)],
+
     "and_i": [([TokenType.SYMBOL, TokenType.SYMBOL, TokenType.NUMBER], OperationType.AND_I)],
     "and_r": [([TokenType.SYMBOL, TokenType.SYMBOL, TokenType.SYMBOL], OperationType.AND_R)],
 
@@ -480,8 +633,100 @@ OPERATIONS = {
 
     "print_i": [([TokenType.NUMBER], OperationType.PRINT_I)],
     "print_r": [([TokenType.SYMBOL], OperationType.PRINT_R)],
+
+    "version": [([TokenType.NUMBER], OperationType.VERSION)],
+
+    "mov_p": [([TokenType.SYMBOL, TokenType.SYMBOL], OperationType.MOV_P)],
+    "cmp_p": [([TokenType.SYMBOL, TokenType.SYMBOL], OperationType.CMP_P)],
+    "cmp_b": [([TokenType.SYMBOL, TokenType.NUMBER], OperationType.CMP_B)],
+
+    "add_p": [([TokenType.SYMBOL, TokenType.SYMBOL, TokenType.SYMBOL], OperationType.ADD_P)],
+    "sub_p": [([TokenType.SYMBOL, TokenType.SYMBOL, TokenType.SYMBOL], OperationType.SUB_P)],
+    "mul_p": [([TokenType.SYMBOL, TokenType.SYMBOL, TokenType.SYMBOL], OperationType.MUL_P)],
+    "and_p": [([TokenType.SYMBOL, TokenType.SYMBOL, TokenType.SYMBOL], OperationType.AND_P)],
+    "or_p": [([TokenType.SYMBOL, TokenType.SYMBOL, TokenType.SYMBOL], OperationType.OR_P)],
+    "xor_p": [([TokenType.SYMBOL, TokenType.SYMBOL, TokenType.SYMBOL], OperationType.XOR_P)],
+    "shl_p": [([TokenType.SYMBOL, TokenType.SYMBOL, TokenType.SYMBOL], OperationType.SHL_P)],
+    "shr_p": [([TokenType.SYMBOL, TokenType.SYMBOL, TokenType.SYMBOL], OperationType.SHR_P)],
+
+    "add_b": [([TokenType.SYMBOL, TokenType.SYMBOL, TokenType.NUMBER], OperationType.ADD_B)],
+    "sub_b": [([TokenType.SYMBOL, TokenType.SYMBOL, TokenType.NUMBER], OperationType.SUB_B)],
+    "shl_b": [([TokenType.SYMBOL, TokenType.SYMBOL, TokenType.NUMBER], OperationType.SHL_B)],
+
+    "jmp_s": [([TokenType.NUMBER], OperationType.JMP_S)],
+    "jeq_s": [([TokenType.NUMBER], OperationType.JEQ_S)],
+    "jne_s": [([TokenType.NUMBER], OperationType.JNE_S)],
+    "jlt_s": [([TokenType.NUMBER], OperationType.JLT_S)],
+    "jgt_s": [([TokenType.NUMBER], OperationType.JGT_S)],
+    "jle_s": [([TokenType.NUMBER], OperationType.JLE_S)],
+    "jge_s": [([TokenType.NUMBER], OperationType.JGE_S)],
+    "call_s": [([TokenType.NUMBER], OperationType.CALL_S)],
+}
+
+
+# Encoding version of the ROMs built with `--v2`, which start with a `version` operation.
+VERSION = 2
+
+# v2 operations whose first two operands are registers packed in one byte, high nibble first.
+PACKED = [
+    OperationType.MOV_P,
+    OperationType.CMP_P,
+    OperationType.ADD_P,
+    OperationType.SUB_P,
+    OperationType.MUL_P,
+    OperationType.AND_P,
+    OperationType.OR_P,
+    OperationType.XOR_P,
+    OperationType.SHL_P,
+    OperationType.SHR_P,
+    OperationType.ADD_B,
+    OperationType.SUB_B,
+    OperationType.SHL_B,
+]
+
+# v2 operations whose immediate is a single byte.
+SHORT = [
+    OperationType.VERSION,
+    OperationType.CMP_B,
+    OperationType.ADD_B,
+    OperationType.SUB_B,
+    OperationType.SHL_B,
+]
+
+# v2 branches, whose target is encoded as a signed byte relative to the end of the operation.
+# The target is still written as an address.
+RELATIVE = [
+    OperationType.JMP_S,
+    OperationType.JEQ_S,
+    OperationType.JNE_S,
+    OperationType.JLT_S,
+    OperationType.JGT_S,
+    OperationType.JLE_S,
+    OperationType.JGE_S,
+    OperationType.CALL_S,
+]
+
+# Operands of the operations on vector registers, `v` for a vector register and `r` for
+# anything else.
+VECTOR = {
+    OperationType.VLD: "vr",
+    OperationType.VST: "rv",
+    OperationType.VSPLAT: "vr",
+    **{operation: "vvv" for operation in [
+        OperationType.VADD, OperationType.VSUB, OperationType.VCMPEQ, OperationType.VCMPGT,
+        OperationType.VMIN, OperationType.VMAX, OperationType.VSHUF, OperationType.VAND,
+        OperationType.VOR, OperationType.VXOR,
+    ]},
 }
 
+# The v2 operations, by mnemonic.
+COMPACT = {name: overloads[0][1] for name, overloads in OPERATIONS.items()
+           if isinstance(overloads, list) and overloads[0][1] in PACKED + SHORT + RELATIVE}
+
+# Branches that `--v2` shortens when their label is close enough.
+BRANCHES = {name: f"{name}_s" for name in
+            ["jmp", "jeq", "jne", "jlt", "jgt", "jle", "jge", "call"]}
+
 
 # These operations will always be implicitly full to avoid problems.
 # ALWAYS_FULL = [
@@ -837,7 +1082,7 @@ def pass2_expand_token(token, full):
         case TokenType.DIRECTIVE:
             return 0
         case TokenType.SYMBOL:
-            if token.val in REGISTERS | OPERATIONS:
+            if token.val in REGISTERS | VECTORS | OPERATIONS:
                 return 1
             return 2
         case TokenType.NUMBER:
@@ -850,6 +1095,10 @@ def pass2_expand_token(token, full):
             if token.val in REGISTERS | OPERATIONS:
                 return 1
             return 2
+        case TokenType.DMEMORY:
+            return 3
+        case TokenType.XMEMORY:
+            return 1
         case TokenType.COLON:
             return 0
         case TokenType.EOL:
@@ -862,12 +1111,67 @@ def pass2_expand_token(token, full):
 
 
 def pass2_expand_line(line, full):
+    # Every operand of a v2 operation is a byte, but for the registers sharing one.
+    if line[0].typ == TokenType.SYMBOL and line[0].val in COMPACT:
+        return len(line) - (COMPACT[line[0].val] in PACKED)
     return sum(pass2_expand_token(token, full) for token in line)
 
 
+# `[a + b]` and `[a - b]` operands, `a` and `b` being two registers, or a register and a
+# number or label displacement in either order. Only numbers can be subtracted.
+def pass2_indexed(first, sign, second):
+    registers = [x.typ == TokenType.SYMBOL and x.val in REGISTERS for x in [first, second]]
+
+    if all(registers) and sign.typ == TokenType.PLUS:
+        return first.to(TokenType.XMEMORY, (first.val, second.val))
+
+    if registers[0] and not registers[1]:
+        base, displacement = first, second
+    elif registers[1] and not registers[0] and sign.typ == TokenType.PLUS:
+        base, displacement = second, first
+    else:
+        report_error("expected a register plus a register or displacement", first.loc)
+        exit(1)
+
+    if sign.typ == TokenType.MINUS:
+        if displacement.typ != TokenType.NUMBER:
+            report_error(f"can't subtract `{displacement}`", displacement.loc)
+            exit(1)
+        displacement = displacement.to(TokenType.NUMBER, -displacement.val & 0xffff)
+
+    return first.to(TokenType.DMEMORY, (base.val, displacement))
+
+
+# Picks the v2 form of an operation when there's one for its operands. Only numbers
+# known by now get a short immediate, labels keep the full one.
+def pass2_compact(line):
+    operation, *operands = line
+
+    if operation.typ != TokenType.SYMBOL:
+        return line
+
+    registers = [x.typ == TokenType.SYMBOL and x.val in REGISTERS for x in operands]
+    short = (len(operands) > 0 and operands[-1].typ == TokenType.NUMBER
+             and 0 <= operands[-1].val <= 0xff)
+
+    match operation.val, len(operands):
+        case ("mov" | "cmp"), 2 if all(registers):
+            name = f"{operation.val}_p"
+        case "cmp", 2 if registers[0] and short:
+            name = "cmp_b"
+        case ("add" | "sub" | "mul" | "and" | "or" | "xor" | "shl" | "shr"), 3 if all(registers):
+            name = f"{operation.val}_p"
+        case ("add" | "sub" | "shl"), 3 if all(registers[:2]) and short:
+            name = f"{operation.val}_b"
+        case _:
+            return line
+
+    return [operation.to(TokenType.SYMBOL, name)] + operands
+
+
 # Turn the tokens into intermediate lines.
 # Handle more directives.
-def pass2(trans):
+def pass2(trans, v2=False):
     result = []
 
     iterator = iter(trans)
@@ -932,19 +1236,29 @@ def pass2(trans):
             if current[1].typ == TokenType.LBRACKET:
                 current = next(iterator, None)
                 assert_token(current[1], TokenType.SYMBOL, TokenType.NUMBER)
+                first = current[1]
+                current = next(iterator, None)
 
-                if current[1].typ == TokenType.SYMBOL:
-                    body.append(current[1].to(TokenType.RMEMORY))
-                elif current[1].typ == TokenType.NUMBER:
-                    body.append(current[1].to(TokenType.IMEMORY))
+                if current[1].typ in [TokenType.PLUS, TokenType.MINUS]:
+                    sign = current[1]
+                    current = next(iterator, None)
+                    assert_token(current[1], TokenType.SYMBOL, TokenType.NUMBER)
+                    body.append(pass2_indexed(first, sign, current[1]))
+                    current = next(iterator, None)
+                elif first.typ == TokenType.SYMBOL:
+                    body.append(first.to(TokenType.RMEMORY))
+                elif first.typ == TokenType.NUMBER:
+                    body.append(first.to(TokenType.IMEMORY))
 
-                current = next(iterator, None)
                 assert_token(current[1], TokenType.RBRACKET)
             else:
                 body.append(current[1])
 
             current = next(iterator, None)
 
+        if v2 and body != []:
+            body = pass2_compact(body)
+
         # Now is the time to remove empty lines!
         if body != []:
             result.append((full, pass2_expand_line(body, full), body))
@@ -956,11 +1270,54 @@ def pass2(trans):
     return result
 
 
-# Calculate labels.
-def pass3(ir):
+def ir_label(tokens):
+    if len(tokens) == 2 and tokens[0].typ == TokenType.SYMBOL:
+        if tokens[1].typ == TokenType.COLON:
+            return tokens[0].val
+    return None
+
+
+# Branch relaxation: every branch to a label starts out short, then those whose label
+# ends up out of reach get their full form back, until the layout settles. Lengthening a
+# branch only moves labels further apart, so this terminates. Dead code elimination only
+# brings them closer.
+def pass3_relax(ir, origin=0):
+    result = list(ir)
+    short = {}
+
+    for i, (full, size, tokens) in enumerate(ir):
+        if (len(tokens) == 2 and tokens[0].typ == TokenType.SYMBOL
+                and tokens[0].val in BRANCHES and tokens[1].typ == TokenType.SYMBOL
+                and tokens[1].val not in REGISTERS):
+            line = [tokens[0].to(TokenType.SYMBOL, BRANCHES[tokens[0].val]), tokens[1]]
+            result[i] = (full, pass2_expand_line(line, full), line)
+            short[i] = ir[i]
+
+    while True:
+        labels, ends, address = {}, {}, origin
+
+        for i, (full, size, tokens) in enumerate(result):
+            if (name := ir_label(tokens)) is not None:
+                labels[name] = address
+                continue
+            address += size
+            ends[i] = address
+
+        far = [i for i in short
+               if not -0x80 <= labels.get(result[i][2][1].val, 0x10000) - ends[i] <= 0x7f]
+
+        if not far:
+            return result
+
+        for i in far:
+            result[i] = short.pop(i)
+
+
+# Calculate labels, for code placed at `origin`.
+def pass3(ir, origin=0):
     result = []
     labels = {}
-    address = 0
+    address = origin
 
     for full, size, tokens in ir:
         if len(tokens) == 2:
@@ -974,7 +1331,7 @@ def pass3(ir):
     return result, labels
 
 
-def pass3_dce(ir):
+def pass3_dce(ir, origin=0):
     inside_label = None
     label_body = []
     labels = {}
@@ -1008,6 +1365,8 @@ def pass3_dce(ir):
                     labels[token.val][3].add(name)
                 elif token.typ == TokenType.RMEMORY and token.val not in REGISTERS:
                     labels[token.val][3].add(name)
+                elif token.typ == TokenType.DMEMORY and token.val[1].val in labels:
+                    labels[token.val[1].val][3].add(name)
 
     for _ in range(len(labels)):
         for name, (body, after, used, used_by) in labels.items():
@@ -1021,7 +1380,7 @@ def pass3_dce(ir):
 
     result = {}
 
-    address = 0
+    address = origin
     for name, (body, _, used, used_by) in labels.items():
         if used:
             result[name] = (body, address)
@@ -1032,15 +1391,31 @@ def pass3_dce(ir):
 
     return result
 
+# Substitutes the address of a label used as a displacement.
+def pass4_displacement(token, labels):
+    base, displacement = token.val
+
+    if displacement.typ != TokenType.SYMBOL:
+        return token
+
+    if displacement.val not in labels:
+        report_error(f"undefined `{displacement.val}`", displacement.loc)
+        exit(1)
+
+    return token.to(TokenType.DMEMORY,
+                    (base, displacement.to(TokenType.NUMBER, labels[displacement.val])))
+
+
 def pass4_dce(labels):
     result = []
+    addresses = {name: address for name, (_, address) in labels.items()}
     for _, (body, _) in labels.items():
         for (full, _, tokens) in body:
             copy = tokens.copy()
 
             for i, token in enumerate(tokens):
                 if token.typ == TokenType.SYMBOL:
-                    if token.val not in REGISTERS | OPERATIONS | labels:
+                    if token.val not in REGISTERS | VECTORS | OPERATIONS | labels:
                         report_error(f"undefined `{token.val}`", token.loc)
                         exit(1)
 
@@ -1054,6 +1429,8 @@ def pass4_dce(labels):
                         report_error(f"undefined `{token.val}`", token.loc)
                         exit(1)
                     copy[i] = token.to(TokenType.IMEMORY, labels[token.val][1])
+                elif token.typ == TokenType.DMEMORY:
+                    copy[i] = pass4_displacement(token, addresses)
 
             result.append((full, copy))
 
@@ -1071,7 +1448,7 @@ def pass4(ir, labels):
             # other way of having a defined symbol, then it either being a
             # register, operations or part of the labels dict.
             if token.typ == TokenType.SYMBOL:
-                if token.val not in REGISTERS | OPERATIONS | labels:
+                if token.val not in REGISTERS | VECTORS | OPERATIONS | labels:
                     report_error(f"undefined `{token.val}`", token.loc)
                     exit(1)
 
@@ -1087,6 +1464,8 @@ def pass4(ir, labels):
                     report_error(f"undefined `{token.val}`", token.loc)
                     exit(1)
                 copy[i] = token.to(TokenType.IMEMORY, labels[token.val])
+            elif token.typ == TokenType.DMEMORY:
+                copy[i] = pass4_displacement(token, labels)
 
         # Don't append `size` back, we don't need it no more!
         result.append((full, copy))
@@ -1189,6 +1568,13 @@ def build_operand(operand, full, loc):
         result.extend(build_get_width(operand.val, True, loc))
     elif operand.typ == TokenType.RMEMORY:
         result.append(REGISTERS[operand.val])
+    elif operand.typ == TokenType.DMEMORY:
+        base, displacement = operand.val
+        result.append(REGISTERS[base])
+        result.extend(build_get_width(displacement.val, True, loc))
+    elif operand.typ == TokenType.XMEMORY:
+        base, index = operand.val
+        result.append(REGISTERS[base] << 4 | REGISTERS[index])
 
     return result
 
@@ -1196,41 +1582,97 @@ def build_operand(operand, full, loc):
 def build(operations):
     result = bytearray()
 
-    for operation in operations:
-        loc = operation.loc
-        full = operation.full
-        operation, operands = operation.typ, operation.val
+    for op in operations:
+        start = len(result)
+        build_operation(result, op)
+        op.span = (start, len(result))
+
+    return result
 
-        # Build the directives first.
-        if operation == OperationType.DIRECTIVE:
-            operation, *operands = operands
 
-            if operation == DirectiveType.DEF:
-                for operand in operands:
-                    result.extend(build_operand(operand, full, loc))
+def build_operation(result, operation):
+    loc = operation.loc
+    full = operation.full
+    operation, operands = operation.typ, operation.val
 
-            elif operation == DirectiveType.RES:
-                for _ in range(operands[0].val):
-                    result.extend(build_get_width(0, full, loc))
+    # Build the directives first.
+    if operation == OperationType.DIRECTIVE:
+        operation, *operands = operands
 
-            elif operation == DirectiveType.DEFB:
-                for operand in operands:
-                    result.extend(build_operand(operand, 0, loc))
+        if operation == DirectiveType.DEF:
+            for operand in operands:
+                result.extend(build_operand(operand, full, loc))
 
-            elif operation == DirectiveType.RESB:
-                for _ in range(operands[0].val):
-                    result.extend(build_get_width(0, 0, loc))
+        elif operation == DirectiveType.RES:
+            for _ in range(operands[0].val):
+                result.extend(build_get_width(0, full, loc))
 
+        elif operation == DirectiveType.DEFB:
+            for operand in operands:
+                result.extend(build_operand(operand, 0, loc))
 
-            continue
+        elif operation == DirectiveType.RESB:
+            for _ in range(operands[0].val):
+                result.extend(build_get_width(0, 0, loc))
 
-        # In the VM, each operations highest bit denotes the full flag.
-        result.append(operation)
+        return
 
-        for operand in operands:
-            result.extend(build_operand(operand, full, loc))
+    # In the VM, each operations highest bit denotes the full flag.
+    result.append(operation)
 
-    return result
+    if operation in PACKED:
+        high, low, *operands = operands
+
+        for operand in [high, low]:
+            if operand.typ != TokenType.SYMBOL or operand.val not in REGISTERS:
+                report_error(f"invalid operand `{operand}`", operand.loc)
+                exit(1)
+
+        result.append(REGISTERS[high.val] << 4 | REGISTERS[low.val])
+
+    if operation in VECTOR:
+        for kind, operand in zip(VECTOR[operation], operands):
+            if kind == "r":
+                result.extend(build_operand(operand, full, loc))
+            elif operand.typ == TokenType.SYMBOL and operand.val in VECTORS:
+                result.append(VECTORS[operand.val])
+            else:
+                report_error(f"expected a vector register, got `{operand}`", operand.loc)
+                exit(1)
+        return
+
+    if operation in RELATIVE:
+        offset = operands[0].val - (len(result) + 1)
+
+        if not -0x80 <= offset <= 0x7f:
+            report_error(f"branch target `{operands[0].val}` out of reach", loc)
+            exit(1)
+
+        result.append(offset & 0xff)
+        return
+
+    for operand in operands:
+        result.extend(build_operand(operand, full and operation not in SHORT, loc))
+
+
+# Write the sidecar source map read by `vm/symbols.c`. One record per line:
+#   label <address> <name>
+#   range <start> <end> <code|data> <line> <file>
+# Addresses are hexadecimal, ranges are half-open and sorted by address.
+def write_source_map(path, ops, labels):
+    with open(path, "w") as f:
+        f.write("; 16-bit VM source map\n")
+
+        for name, address in sorted(labels.items(), key=lambda x: x[1]):
+            f.write(f"label {address:04x} {name}\n")
+
+        for op in ops:
+            start, end = op.span
+            if start == end:
+                continue
+
+            kind = "data" if op.typ == OperationType.DIRECTIVE else "code"
+            f.write(f"range {start:04x} {end:04x} {kind} {op.loc[1]} {op.loc[0]}\n")
 
 
 def usage():
@@ -1240,7 +1682,9 @@ def usage():
     print(f"        -d              Display debug information")
     print(f"        -x              Display compiled bytecode")
     print(f"        -v              Enable -d -x")
+    print(f"        -m              Write source map to FILE.map")
     print(f"        --dce           Perform dead code elimination")
+    print(f"        --v2            Use the denser v2 encoding")
 
 
 DEBUG_SEPARATOR = [
@@ -1266,7 +1710,7 @@ DEBUG_SEPARATOR = [
 ]
 
 
-def compile_file(file, d, x, dce):
+def compile_file(file, d, x, dce, m, v2):
     input_file = file
     output_file = os.path.splitext(input_file)[0]
 
@@ -1275,21 +1719,33 @@ def compile_file(file, d, x, dce):
     tokens = list(lexer_tokenize_file(input_file))
 
     p1 = pass1(tokens)
-    p2 = pass2(p1)
+    p2 = pass2(p1, v2)
+
+    # v2 ROMs start with their version, the opcode and a byte ahead of the code.
+    marker, origin = [], 0
+    if v2:
+        number = Token(tokens[0].loc, TokenType.NUMBER, VERSION)
+        marker = [Operation(tokens[0].loc, OperationType.VERSION, [number])]
+        origin = 2
+        p2 = pass3_relax(p2, origin)
 
     if dce:
-        p3 = pass3_dce(p2)
+        p3 = pass3_dce(p2, origin)
         p4 = pass4_dce(p3)
     else:
-        p3 = pass3(p2)
+        p3 = pass3(p2, origin)
         p4 = pass4(*p3)
 
-    ops = parse_operations(p4)
+    ops = marker + parse_operations(p4)
     bytecode = build(ops)
 
     with open(output_file, "wb") as f:
         f.write(bytecode)
 
+    if m:
+        labels = {k: v for k, (_, v) in p3.items()} if dce else p3[1]
+        write_source_map(output_file + ".map", ops, labels)
+
     if d:
         previous = None
         for op in ops:
@@ -1371,6 +1827,12 @@ def main():
     if (dce := "-dce" in sys.argv):
         sys.argv.remove("-dce")
 
+    if (m := "-m" in sys.argv):
+        sys.argv.remove("-m")
+
+    if (v2 := "--v2" in sys.argv):
+        sys.argv.remove("--v2")
+
     if len(sys.argv) <= 1:
         usage()
         exit(1)
@@ -1378,7 +1840,7 @@ def main():
     start = time.time()
 
     for file in sys.argv[1:]:
-        compile_file(file, d, x, dce)
+        compile_file(file, d, x, dce, m, v2)
 
     end = time.time()
 
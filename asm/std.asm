@@ -89,13 +89,11 @@ std_itoa_loop:
   cmp r5 0
   jeq std_itoa_end
 
-  add r2 r1 __std_itoa_buffer
-  add r1 r1 1
-
   div r5 r5 10
 
   add ac ac '0
-  movb [r2] ac
+  movb [r1 + __std_itoa_buffer] ac
+  add r1 r1 1
 
   jmp std_itoa_loop
 
@@ -106,13 +104,11 @@ std_itoa_reverse_loop:
   cmp r1 0
   jeq std_itoa_reverse_end
 
-  add r3 r2 r6
-  add r2 r2 1
-
   sub r1 r1 1
-  add r4 r1 __std_itoa_buffer
+  movb ac [r1 + __std_itoa_buffer]
 
-  movb [r3] [r4]
+  movb [r6 + r2] ac
+  add r2 r2 1
 
   jmp std_itoa_reverse_loop
 
@@ -137,6 +133,22 @@ std_itoa_zero:
 __std_itoa_buffer: resb 5
 
 
+;; COUNTERS ;;
+COUNTER_ADDRESS = 0x9100
+
+COUNTER_INSTRUCTIONS       = 0x9100
+COUNTER_BRANCHES_TAKEN     = 0x9108
+COUNTER_BRANCHES_NOT_TAKEN = 0x9110
+COUNTER_CALLS              = 0x9118
+COUNTER_STACK_HIGH_WATER   = 0x9120
+
+; Counters are 64-bit little endian, reads return the values at the time of the latest latch.
+counter_latch =
+{
+  movb [COUNTER_ADDRESS] 0
+}
+
+
 ;; TTY ;;
 TTY_WRITER_ADDRESS = 0x3000
 TTY_READER_ADDRESS = 0x3100
@@ -220,11 +232,16 @@ sdl_end =
   movb [SDL_FLAG_END] 1
 }
 
-sdl_xy_to_address = x y
+; Offset of the pixel at (x, y) from SDL_RENDERER_ADDRESS.
+sdl_xy_to_offset = x y
 {
-  mov ac 0
   mul ac y  SDL_SCREEN_SIZE
   add ac ac x
+}
+
+sdl_xy_to_address = x y
+{
+  sdl_xy_to_offset x y
   add ac ac SDL_RENDERER_ADDRESS
 }
 
@@ -237,8 +254,8 @@ sdl_render_point: ; (r5 x, r6 y, r7 color)
 
   push ac
 
-  sdl_xy_to_address r5 r6
-  mov [ac] r7
+  sdl_xy_to_offset r5 r6
+  mov [ac + SDL_RENDERER_ADDRESS] r7
 
   pop ac
 
@@ -14,3 +14,21 @@ stdx_ftoi = dst src
   shr dst src STDX_FBITS
 }
 
+
+; Signed, with a 32-bit intermediate: dst = a * b >> STDX_FBITS
+stdx_fmul = dst a b
+{
+  fmul dst a b
+}
+
+; Signed, rounded toward zero: dst = (a << STDX_FBITS) / b
+stdx_fdiv = dst a b
+{
+  fdiv dst a b
+}
+
+; Unsigned 16x16 -> 32 bits: low word to dst, high word to ac
+stdx_mulw = dst a b
+{
+  mulw dst a b
+}
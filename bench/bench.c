@@ -0,0 +1,367 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include "../vm/vm.h"
+#include "../vm/replay.h"
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#define MAX_REPETITIONS 64
+
+// Tiny ROMs are restarted until a repetition has retired at least this many instructions.
+#define DEFAULT_MINIMUM 1000000
+#define DEFAULT_REPETITIONS 5
+
+struct input
+{
+  byte *data;
+  size_t size;
+  size_t cursor;
+};
+
+struct sample
+{
+  uint64_t instructions;
+  double seconds;
+};
+
+struct options
+{
+  const VM_Engine *engine;
+  struct input input;
+  VM_Replay *replay;
+  size_t repetitions;
+  uint64_t minimum;
+  uint64_t budget;
+  bool csv;
+};
+
+
+void
+writer_store_byte (VM *vm, VM_Device *device, word address, byte value)
+{
+  (void)vm, (void)device, (void)address, (void)value;
+}
+
+byte
+reader_read_byte (VM *vm, VM_Device *device, word address)
+{
+  (void)vm, (void)address;
+  struct input *input = device->state;
+
+  // Behave like `getc` at end of input.
+  if (input->cursor >= input->size)
+    return EOF;
+
+  return input->data[input->cursor++];
+}
+
+
+double
+now (void)
+{
+  struct timespec ts;
+  clock_gettime (CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+
+// Runs the ROM image once from a fresh VM, timing only the execution itself.
+struct sample
+run (const VM_Engine *engine, VM *image, struct input *input, VM_Replay *replay,
+     uint64_t budget)
+{
+  VM vm = {0};
+
+  vm_create (&vm);
+
+  VM_Device writer = {0};
+
+  writer.read_byte = vm_default_read_byte;
+  writer.read_word = vm_default_read_word;
+  writer.store_byte = writer_store_byte;
+  writer.store_word = vm_default_store_word;
+  writer.state = NULL;
+
+  vm_map_device (&vm, &writer, 0x3000, 0x3100);
+
+  VM_Device reader = {0};
+
+  reader.read_byte = reader_read_byte;
+  reader.read_word = vm_default_read_word;
+  reader.store_byte = vm_default_store_byte;
+  reader.store_word = vm_default_store_word;
+  reader.state = input;
+
+  vm_map_device (&vm, &reader, 0x3100, 0x3200);
+  vm_map_device (&vm, &vm_device_counter, 0x9100, 0x9100);
+
+  if (replay)
+    vm_replay_attach (replay, &vm);
+
+  vm_load (&vm, image->memory, image->nmemory);
+  input->cursor = 0;
+
+  struct sample sample = {0};
+
+  double start = now ();
+
+  while (!vm.halt && sample.instructions < budget)
+    sample.instructions += engine->run_block (&vm);
+
+  sample.seconds = now () - start;
+
+  vm_destroy (&vm);
+
+  return sample;
+}
+
+
+int
+compare_double (const void *a, const void *b)
+{
+  double x = *(const double *)a, y = *(const double *)b;
+  return (x > y) - (x < y);
+}
+
+void
+statistics (double *xs, size_t n, double *median, double *stddev)
+{
+  double mean = 0, variance = 0;
+
+  for (size_t i = 0; i < n; ++i)
+    mean += xs[i] / n;
+
+  for (size_t i = 0; i < n; ++i)
+    variance += (xs[i] - mean) * (xs[i] - mean) / (n > 1 ? n - 1 : 1);
+
+  qsort (xs, n, sizeof (double), compare_double);
+
+  *median = n % 2 ? xs[n / 2] : (xs[n / 2 - 1] + xs[n / 2]) / 2;
+  *stddev = sqrt (variance);
+}
+
+
+bool
+read_input (struct input *input, const char *path)
+{
+  FILE *file = fopen (path, "rb");
+
+  if (!file)
+    {
+      perror ("Failed to open file");
+      return false;
+    }
+
+  size_t capacity = 4096;
+  input->data = malloc (capacity);
+
+  size_t n;
+  while ((n = fread (input->data + input->size, 1, capacity - input->size,
+                     file)) > 0)
+    {
+      input->size += n;
+      if (input->size == capacity)
+        input->data = realloc (input->data, capacity *= 2);
+    }
+
+  fclose (file);
+
+  return true;
+}
+
+
+void
+usage (const char *name)
+{
+  fprintf (stderr, "USAGE: %s [OPTIONS] <ROM> [ROM ...]\n", name);
+  fprintf (stderr, "    OPTIONS\n");
+  fprintf (stderr, "        -n COUNT   Repetitions per ROM (default %d)\n",
+           DEFAULT_REPETITIONS);
+  fprintf (stderr, "        -m COUNT   Minimum instructions per repetition "
+                   "(default %d)\n", DEFAULT_MINIMUM);
+  fprintf (stderr, "        -b COUNT   Instruction budget per run\n");
+  fprintf (stderr, "        -i FILE    Bytes fed to the reader device\n");
+  fprintf (stderr, "        -p FILE    Replay recorded device reads, see `vm-tty -r`\n");
+  fprintf (stderr, "        -f FORMAT  Output format, `json` or `csv`\n");
+  fprintf (stderr, "        -e ENGINE  Execution engine (default `reference`)\n");
+}
+
+
+// Measures one ROM and prints its line to `out`. Fails when it can't be loaded, or when a
+// repetition retires nothing to divide by.
+bool
+bench (FILE *out, const char *path, struct options *options)
+{
+  VM image = {0};
+
+  vm_create (&image);
+
+  if (!vm_load_file (&image, path))
+    {
+      vm_destroy (&image);
+      return false;
+    }
+
+  double ips[MAX_REPETITIONS];
+  double ns[MAX_REPETITIONS];
+  uint64_t instructions = 0;
+
+  for (size_t r = 0; r < options->repetitions; ++r)
+    {
+      struct sample total = {0};
+
+      while (total.instructions < options->minimum)
+        {
+          struct sample sample = run (options->engine, &image, &options->input,
+                                      options->replay, options->budget);
+          total.instructions += sample.instructions;
+          total.seconds += sample.seconds;
+
+          if (sample.instructions == 0)
+            break;
+        }
+
+      if (total.instructions == 0 || total.seconds <= 0)
+        {
+          fprintf (stderr, "`%s` retires no instructions to measure\n", path);
+          vm_destroy (&image);
+          return false;
+        }
+
+      instructions = total.instructions;
+      ips[r] = total.instructions / total.seconds;
+      ns[r] = total.seconds * 1e9 / total.instructions;
+    }
+
+  vm_destroy (&image);
+
+  double ips_median, ips_stddev, ns_median, ns_stddev;
+  statistics (ips, options->repetitions, &ips_median, &ips_stddev);
+  statistics (ns, options->repetitions, &ns_median, &ns_stddev);
+
+  struct rusage usage;
+  getrusage (RUSAGE_SELF, &usage);
+
+  if (options->csv)
+    fprintf (out, "%s,%s,%zu,%llu,%.0f,%.0f,%.3f,%.3f,%ld\n", path, options->engine->name,
+             options->repetitions, (unsigned long long)instructions, ips_median, ips_stddev,
+             ns_median, ns_stddev, usage.ru_maxrss);
+  else
+    fprintf (out,
+             "{\"rom\": \"%s\", \"engine\": \"%s\", \"repetitions\": %zu, "
+             "\"instructions\": %llu, \"ips_median\": %.0f, "
+             "\"ips_stddev\": %.0f, \"ns_median\": %.3f, "
+             "\"ns_stddev\": %.3f, \"peak_rss_kib\": %ld}\n",
+             path, options->engine->name, options->repetitions,
+             (unsigned long long)instructions, ips_median, ips_stddev, ns_median, ns_stddev,
+             usage.ru_maxrss);
+
+  return fflush (out) == 0;
+}
+
+
+int
+main (int argc, char **argv)
+{
+  struct options options = {
+    .engine = vm_find_engine ("reference"),
+    .repetitions = DEFAULT_REPETITIONS,
+    .minimum = DEFAULT_MINIMUM,
+    .budget = UINT64_MAX,
+  };
+
+  VM_Replay replay = {0};
+
+  int option;
+  while ((option = getopt (argc, argv, "n:m:b:i:p:f:e:")) != -1)
+    switch (option)
+      {
+      case 'n':
+        options.repetitions = strtoul (optarg, NULL, 0);
+        break;
+      case 'm':
+        options.minimum = strtoull (optarg, NULL, 0);
+        break;
+      case 'b':
+        options.budget = strtoull (optarg, NULL, 0);
+        break;
+      case 'i':
+        if (!read_input (&options.input, optarg))
+          return 1;
+        break;
+      case 'p':
+        if (!vm_replay_load (&replay, optarg))
+          return 1;
+        options.replay = &replay;
+        break;
+      case 'f':
+        options.csv = strcmp (optarg, "csv") == 0;
+        break;
+      case 'e':
+        if (!(options.engine = vm_find_engine (optarg)))
+          {
+            fprintf (stderr, "Unknown engine `%s`\n", optarg);
+            return 1;
+          }
+        break;
+      default:
+        usage (argv[0]);
+        return 1;
+      }
+
+  if (optind >= argc || options.repetitions == 0 || options.repetitions > MAX_REPETITIONS)
+    {
+      usage (argv[0]);
+      return 1;
+    }
+
+  // ROMs may `PRINT` to stdout, keep it clear for the results.
+  FILE *out = fdopen (dup (STDOUT_FILENO), "w");
+  if (!out || !freopen ("/dev/null", "w", stdout))
+    {
+      perror ("Failed to redirect stdout");
+      return 1;
+    }
+
+  if (options.csv)
+    fprintf (out, "rom,engine,repetitions,instructions,ips_median,ips_stddev,"
+                  "ns_median,ns_stddev,peak_rss_kib\n");
+
+  fflush (out);
+
+  int status = 0;
+
+  // Each ROM runs in a child process, so its peak RSS is its own and not the high-water mark of
+  // every ROM before it.
+  for (int i = optind; i < argc; ++i)
+    {
+      pid_t pid = fork ();
+
+      if (pid < 0)
+        {
+          perror ("Failed to fork");
+          return 1;
+        }
+
+      if (pid == 0)
+        exit (bench (out, argv[i], &options) ? 0 : 1);
+
+      int child;
+
+      if (waitpid (pid, &child, 0) < 0 || !WIFEXITED (child) || WEXITSTATUS (child) != 0)
+        status = 1;
+    }
+
+  free (options.input.data);
+  vm_replay_destroy (&replay);
+  fclose (out);
+
+  return status;
+}
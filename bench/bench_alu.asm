@@ -0,0 +1,49 @@
+; Arithmetic, bitwise and shift operations in both immediate and register forms.
+
+ROUNDS = 50
+ITERATIONS = 10000
+
+entry:
+  mov r8 0
+
+outer:
+  cmp r8 ROUNDS
+  jge end
+
+  mov r7 0
+
+inner:
+  cmp r7 ITERATIONS
+  jge inner_end
+
+  add r1 r7 3
+  add r2 r1 r7
+  sub r3 r2 1
+  sub r4 r3 r1
+  mul r5 r4 7
+  mul r6 r5 r2
+  div r1 r6 3
+  or r1 r1 1
+  div r2 r6 r1
+  and r3 r2 0xFF
+  and r4 r3 r2
+  or r5 r4 0x100
+  or r6 r5 r4
+  xor r1 r6 0xAAAA
+  xor r2 r1 r6
+  not r3 r2
+  shl r4 r3 2
+  and r1 r8 15
+  shl r5 r4 r1
+  shr r6 r5 3
+  shr r2 r6 r1
+
+  add r7 r7 1
+  jmp inner
+
+inner_end:
+  add r8 r8 1
+  jmp outer
+
+end:
+  halt
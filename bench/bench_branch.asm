@@ -0,0 +1,48 @@
+; Compares and conditional jumps, half taken and half not taken.
+
+ROUNDS = 50
+ITERATIONS = 10000
+
+entry:
+  mov r8 0
+
+outer:
+  cmp r8 ROUNDS
+  jge end
+
+  mov r7 0
+
+inner:
+  cmp r7 ITERATIONS
+  jge inner_end
+
+  and r1 r7 1
+  cmp r1 0
+  jeq even
+
+  cmp r1 1
+  jne inner_next
+  jlt inner_next
+  jgt inner_next
+  jmp inner_next
+
+even:
+  mov r2 even_target
+  cmp r1 r7
+  jle r2
+  jmp inner_next
+
+even_target:
+  cmp r7 r1
+  jge inner_next
+
+inner_next:
+  add r7 r7 1
+  jmp inner
+
+inner_end:
+  add r8 r8 1
+  jmp outer
+
+end:
+  halt
@@ -0,0 +1,40 @@
+; CALL / RET through immediate and register targets.
+
+ROUNDS = 50
+ITERATIONS = 10000
+
+entry:
+  mov r8 0
+  mov r6 leaf
+
+outer:
+  cmp r8 ROUNDS
+  jge end
+
+  mov r7 0
+
+inner:
+  cmp r7 ITERATIONS
+  jge inner_end
+
+  call leaf
+  call r6
+  call nested
+
+  add r7 r7 1
+  jmp inner
+
+inner_end:
+  add r8 r8 1
+  jmp outer
+
+end:
+  halt
+
+
+leaf:
+  ret
+
+nested:
+  call leaf
+  ret
@@ -0,0 +1,48 @@
+; MOV / MOVB across every addressing mode.
+
+ROUNDS = 50
+ITERATIONS = 10000
+
+entry:
+  mov r8 0
+
+outer:
+  cmp r8 ROUNDS
+  jge end
+
+  mov r7 0
+
+inner:
+  cmp r7 ITERATIONS
+  jge inner_end
+
+  mov r1 0x1234
+  mov r2 r1
+  mov [scratch] r2
+  mov r3 [scratch]
+  mov r4 scratch
+  mov [r4] r3
+  mov r5 [r4]
+  mov [scratch] [scratch_other]
+  mov [r4] 0x5678
+
+  movb r1 0x12
+  movb r2 r1
+  movb [scratch] r2
+  movb r3 [scratch]
+  movb [r4] r3
+  movb r5 [r4]
+
+  add r7 r7 1
+  jmp inner
+
+inner_end:
+  add r8 r8 1
+  jmp outer
+
+end:
+  halt
+
+
+scratch: def 0
+scratch_other: def 0
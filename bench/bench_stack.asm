@@ -0,0 +1,37 @@
+; PUSH / POP / PUSHA / POPA.
+
+ROUNDS = 50
+ITERATIONS = 10000
+
+entry:
+  mov r8 0
+
+outer:
+  cmp r8 ROUNDS
+  jge end
+
+  mov r7 0
+
+inner:
+  cmp r7 ITERATIONS
+  jge inner_end
+
+  push 0x1234
+  push r7
+  push r8
+  pop r3
+  pop r2
+  pop r1
+
+  pusha
+  popa
+
+  add r7 r7 1
+  jmp inner
+
+inner_end:
+  add r8 r8 1
+  jmp outer
+
+end:
+  halt
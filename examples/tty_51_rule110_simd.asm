@@ -0,0 +1,98 @@
+attach "asm/std.asm"
+
+; tty_50_rule110, updating eight cells per iteration with the vector operations.
+
+N = 80
+
+entry:
+  mov r3 cells
+  add r3 r3 1
+  add r4 r3 (N + 1)
+
+  add r1 r3 (N - 1)
+  movb [r1] 1
+
+  mov ac 1
+  vsplat v7 ac
+
+  mov r1 0
+
+loop_step:
+  cmp r1 N
+  jge end_step
+
+  call print_cells
+
+  mov r2 0
+
+loop_update:
+  cmp r2 N
+  jge end_update
+
+  ; The neighbours are the row loaded one cell to either side, the dead cells padding it
+  ; standing in at the edges.
+  add r5 r3 r2
+  sub r6 r5 1
+  vld v0 [r6]
+  vld v1 [r5]
+  add r6 r5 1
+  vld v2 [r6]
+
+  ; (m ^ r) | (m & ~l), which is m > l for cells of 0 and 1.
+  vxor v3 v1 v2
+  vcmpgt v4 v1 v0
+  vand v4 v4 v7
+  vor v3 v3 v4
+
+  add r5 r4 r2
+  vst [r5] v3
+
+  add r2 r2 8
+  jmp loop_update
+
+end_update:
+  mov r5 r3
+  mov r3 r4
+  mov r4 r5
+
+  add r1 r1 1
+  jmp loop_step
+
+end_step:
+  halt
+
+
+print_cells: ; (cells: r3)
+  pusha
+  mov r1 0
+
+print_cells_loop:
+  cmp r1 N
+  jge print_cells_end
+
+  movb r2 [r3 + r1]
+
+  cmp r2 1
+  jne print_cells_space
+
+  tty_write '.
+
+  jmp print_cells_dot
+
+print_cells_space:
+  tty_write ' 
+
+print_cells_dot:
+  add r1 r1 1
+  jmp print_cells_loop
+
+print_cells_end:
+  tty_write 10
+
+  popa
+  ret
+
+
+; Two rows of N cells, N being a multiple of 8, with a dead cell on both sides of each. The
+; one between them is shared.
+cells: resb (2 * N + 3)
@@ -0,0 +1,22 @@
+attach "asm/std.asm"
+
+; A register byte past the last register, which the assembler never emits. The operation traps
+; with an illegal operation before it writes anything, and `vm-server` ends the job with
+; `END <INSTRUCTIONS> illegal operation` instead of the worker's VM being overwritten.
+
+entry:
+  mov r5 before
+
+  call tty_writes
+
+  ; add <register 0xFF> r1 r1
+  defb 0x1F 0xFF 0x01 0x01
+
+  mov r5 after
+
+  call tty_writes
+
+  halt
+
+before: defb "Before the illegal register.\n\0"
+after: defb "After the illegal register.\n\0"
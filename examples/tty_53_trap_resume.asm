@@ -0,0 +1,46 @@
+attach "asm/std.asm"
+
+; Operations naming a register past the last one, in every form that packs two registers in a
+; byte or names a vector register, each trapping with an illegal operation. `vm-check -k` resumes
+; past every trap. The last byte of each operation is a `HALT` opcode, so resuming inside an
+; operation instead of past it halts before the end, and fewer than 19 traps are counted.
+
+entry:
+  ; add_p <register 0xF> r1 r1, and so on to shr_p
+  defb 0x4E 0xF1 0x44
+  defb 0x4F 0xF1 0x44
+  defb 0x50 0xF1 0x44
+  defb 0x51 0xF1 0x44
+  defb 0x52 0xF1 0x44
+  defb 0x53 0xF1 0x44
+  defb 0x54 0xF1 0x44
+  defb 0x55 0xF1 0x44
+
+  ; add_p r1 r1 <register 0x44>
+  defb 0x4E 0x11 0x44
+
+  ; add_b <register 0xF> r1 0x44, and so on to shl_b
+  defb 0x56 0xF1 0x44
+  defb 0x57 0xF1 0x44
+  defb 0x58 0xF1 0x44
+
+  ; mov [<register 0xF> + r1] <register 0x44>, and the same with movb
+  defb 0x64 0xF1 0x44
+  defb 0x68 0xF1 0x44
+
+  ; vld <vector 8> r<0x44>, vst r1 <vector 0x44>, vsplat <vector 8> r<0x44>
+  defb 0x76 0x08 0x44
+  defb 0x77 0x01 0x44
+  defb 0x78 0x08 0x44
+
+  ; vadd <vector 8> v<0x44> v<0x44>, vxor v0 <vector 8> v<0x44>
+  defb 0x79 0x08 0x44 0x44
+  defb 0x82 0x00 0x08 0x44
+
+  mov r5 resumed
+
+  call tty_writes
+
+  halt
+
+resumed: defb "Resumed past every trap.\n\0"
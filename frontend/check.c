@@ -0,0 +1,401 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include "../vm/vm.h"
+#include "../vm/replay.h"
+#include "../vm/symbols.h"
+
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define MAX_CONTEXT 16
+
+// Both VMs get their own cursor into the same input, and their own copy of the output.
+struct io
+{
+  const byte *input;
+  size_t ninput;
+  size_t cursor;
+
+  byte *output;
+  size_t noutput;
+  size_t capacity;
+};
+
+struct machine
+{
+  VM vm;
+  VM_Device writer;
+  VM_Device reader;
+  struct io io;
+  VM_Replay replay;
+  const VM_Engine *engine;
+  size_t ntrap;
+};
+
+
+void
+writer_store_byte (VM *vm, VM_Device *device, word address, byte value)
+{
+  (void)vm, (void)address;
+  struct io *io = device->state;
+
+  if (io->noutput == io->capacity)
+    io->output = realloc (io->output, io->capacity = io->capacity * 2 + 256);
+
+  io->output[io->noutput++] = value;
+}
+
+byte
+reader_read_byte (VM *vm, VM_Device *device, word address)
+{
+  (void)vm, (void)address;
+  struct io *io = device->state;
+
+  if (io->cursor >= io->ninput)
+    return EOF;
+
+  return io->input[io->cursor++];
+}
+
+
+bool
+machine_create (struct machine *m, const char *rom, const VM_Engine *engine,
+                const byte *input, size_t ninput, const char *replay)
+{
+  vm_create (&m->vm);
+
+  m->engine = engine;
+  m->io.input = input;
+  m->io.ninput = ninput;
+
+  m->writer.read_byte = vm_default_read_byte;
+  m->writer.read_word = vm_default_read_word;
+  m->writer.store_byte = writer_store_byte;
+  m->writer.store_word = vm_default_store_word;
+  m->writer.state = &m->io;
+
+  vm_map_device (&m->vm, &m->writer, 0x3000, 0x3100);
+
+  m->reader.read_byte = reader_read_byte;
+  m->reader.read_word = vm_default_read_word;
+  m->reader.store_byte = vm_default_store_byte;
+  m->reader.store_word = vm_default_store_word;
+  m->reader.state = &m->io;
+
+  vm_map_device (&m->vm, &m->reader, 0x3100, 0x3200);
+  vm_map_device (&m->vm, &vm_device_counter, 0x9100, 0x9100);
+
+  // Each machine consumes the recording at its own pace.
+  if (replay)
+    {
+      if (!vm_replay_load (&m->replay, replay))
+        return false;
+      vm_replay_attach (&m->replay, &m->vm);
+    }
+
+  return vm_load_file (&m->vm, rom);
+}
+
+
+// Resumes past every trap, so a ROM can fault on purpose and check where execution goes on.
+bool
+machine_resume (VM *vm, const VM_Trap *trap)
+{
+  (void)trap;
+  struct machine *m = vm->trap_state;
+
+  m->ntrap++;
+  return true;
+}
+
+
+void
+machine_destroy (struct machine *m)
+{
+  free (m->io.output);
+  vm_replay_destroy (&m->replay);
+  vm_destroy (&m->vm);
+}
+
+
+// Returns a description of the first difference between the two machines, or NULL.
+const char *
+machine_compare (struct machine *a, struct machine *b, size_t *address)
+{
+  if (memcmp (a->vm.registers, b->vm.registers, sizeof a->vm.registers) != 0)
+    return "registers differ";
+
+  if (memcmp (a->vm.vectors, b->vm.vectors, sizeof a->vm.vectors) != 0)
+    return "vectors differ";
+
+  if (a->vm.flags.z != b->vm.flags.z || a->vm.flags.c != b->vm.flags.c)
+    return "flags differ";
+
+  if (a->vm.halt != b->vm.halt)
+    return "halt state differs";
+
+  if (memcmp (&a->vm.trap, &b->vm.trap, sizeof (VM_Trap)) != 0)
+    return "trap differs";
+
+  if (a->ntrap != b->ntrap)
+    return "resumed traps differ";
+
+  if (a->io.noutput != b->io.noutput
+      || memcmp (a->io.output, b->io.output, a->io.noutput) != 0)
+    return "output differs";
+
+  if (a->io.cursor != b->io.cursor)
+    return "input consumption differs";
+
+  if (memcmp (&a->vm.stats, &b->vm.stats, sizeof (VM_Stats)) != 0)
+    return "stats differ";
+
+  if (memcmp (a->vm.memory, b->vm.memory, a->vm.nmemory) != 0)
+    {
+      for (*address = 0; a->vm.memory[*address] == b->vm.memory[*address];)
+        ++*address;
+      return "memory differs";
+    }
+
+  return NULL;
+}
+
+
+void
+report (struct machine *a, struct machine *b, VM_Symbols *symbols,
+        const char *reason, word start, size_t nblock, size_t ninstruction,
+        size_t count, size_t other, size_t address)
+{
+  char buffer[256];
+
+  printf ("divergence: %s\n", reason);
+  printf ("  block %zu at " VM_FMT_WORD ", after %zu instructions "
+          "(%s retired %zu, %s retired %zu)\n\n", nblock, start, ninstruction,
+          a->engine->name, count, b->engine->name, other);
+
+  // Re-decode the block from the reference machine's memory.
+  word ip = start;
+  for (size_t i = 0; i < count && i < MAX_CONTEXT; ++i)
+    {
+      word size = vm_disassemble (&a->vm, ip, buffer, sizeof buffer);
+      printf ("  " VM_FMT_WORD "  %-28s", ip, buffer);
+
+      if (symbols)
+        {
+          vm_symbols_format (symbols, ip, buffer, sizeof buffer);
+          printf (" %s", buffer);
+        }
+
+      printf ("\n");
+      ip += size;
+    }
+
+  printf ("\n  %-4s %-10s %-10s\n", "", a->engine->name, b->engine->name);
+
+  for (int i = 0; i < VM_REGISTER_COUNT; ++i)
+    {
+      word x = a->vm.registers[i], y = b->vm.registers[i];
+      printf ("  %-4s " VM_FMT_WORD "       " VM_FMT_WORD "%s\n",
+              vm_register_name (i), x, y, x != y ? "  <--" : "");
+    }
+
+  for (int i = 0; i < VM_VECTOR_COUNT; ++i)
+    if (a->vm.vectors[i] != b->vm.vectors[i])
+      printf ("  v%d   %016" PRIx64 " %016" PRIx64 "  <--\n", i, a->vm.vectors[i],
+              b->vm.vectors[i]);
+
+  printf ("  z    %d          %d%s\n", a->vm.flags.z, b->vm.flags.z,
+          a->vm.flags.z != b->vm.flags.z ? "  <--" : "");
+  printf ("  c    %d          %d%s\n", a->vm.flags.c, b->vm.flags.c,
+          a->vm.flags.c != b->vm.flags.c ? "  <--" : "");
+
+  if (address < a->vm.nmemory)
+    printf ("\n  [" VM_FMT_WORD "] " VM_FMT_BYTE "         " VM_FMT_BYTE "\n",
+            (word)address, a->vm.memory[address], b->vm.memory[address]);
+}
+
+
+bool
+read_file (const char *path, byte **data, size_t *size)
+{
+  FILE *file = fopen (path, "rb");
+
+  if (!file)
+    {
+      perror ("Failed to open file");
+      return false;
+    }
+
+  size_t capacity = 4096, n;
+  *data = malloc (capacity);
+  *size = 0;
+
+  while ((n = fread (*data + *size, 1, capacity - *size, file)) > 0)
+    if ((*size += n) == capacity)
+      *data = realloc (*data, capacity *= 2);
+
+  fclose (file);
+
+  return true;
+}
+
+
+void
+usage (const char *name)
+{
+  fprintf (stderr, "USAGE: %s [OPTIONS] <ROM>\n", name);
+  fprintf (stderr, "    OPTIONS\n");
+  fprintf (stderr, "        -e ENGINE  Engine checked against `reference` "
+                   "(default `fast`)\n");
+  fprintf (stderr, "        -i FILE    Bytes fed to the reader device\n");
+  fprintf (stderr, "        -p FILE    Replay recorded device reads, see `vm-tty -r`\n");
+  fprintf (stderr, "        -b COUNT   Stop after COUNT instructions\n");
+  fprintf (stderr, "        -m MAP     Source map used to symbolize the report\n");
+  fprintf (stderr, "        -P         Protect blocks as laid out in the source map\n");
+  fprintf (stderr, "        -k         Resume past every trap, counting them\n");
+}
+
+
+int
+main (int argc, char **argv)
+{
+  const VM_Engine *reference = vm_find_engine ("reference");
+  const VM_Engine *engine = vm_find_engine ("fast");
+  const char *map = NULL;
+  const char *replay = NULL;
+  size_t budget = SIZE_MAX;
+  bool protect = false;
+  bool resume = false;
+
+  byte *input = NULL;
+  size_t ninput = 0;
+
+  int option;
+  while ((option = getopt (argc, argv, "e:i:p:b:m:Pk")) != -1)
+    switch (option)
+      {
+      case 'e':
+        if (!(engine = vm_find_engine (optarg)))
+          {
+            fprintf (stderr, "Unknown engine `%s`\n", optarg);
+            return 1;
+          }
+        break;
+      case 'i':
+        if (!read_file (optarg, &input, &ninput))
+          return 1;
+        break;
+      case 'p':
+        replay = optarg;
+        break;
+      case 'b':
+        budget = strtoull (optarg, NULL, 0);
+        break;
+      case 'm':
+        map = optarg;
+        break;
+      case 'P':
+        protect = true;
+        break;
+      case 'k':
+        resume = true;
+        break;
+      default:
+        usage (argv[0]);
+        return 1;
+      }
+
+  if (optind >= argc)
+    {
+      usage (argv[0]);
+      return 1;
+    }
+
+  const char *rom = argv[optind];
+
+  VM_Symbols symbols = {0};
+  bool has_symbols = false;
+
+  char path[512];
+  snprintf (path, sizeof path, "%s.map", rom);
+
+  if (map)
+    has_symbols = vm_symbols_load (&symbols, map);
+  else if (access (path, R_OK) == 0)
+    has_symbols = vm_symbols_load (&symbols, path);
+
+  struct machine a = {0}, b = {0};
+
+  if (!machine_create (&a, rom, reference, input, ninput, replay)
+      || !machine_create (&b, rom, engine, input, ninput, replay))
+    return 1;
+
+  if (protect && has_symbols)
+    {
+      vm_symbols_protect (&symbols, &a.vm);
+      vm_symbols_protect (&symbols, &b.vm);
+    }
+
+  if (resume)
+    {
+      a.vm.on_trap = b.vm.on_trap = machine_resume;
+      a.vm.trap_state = &a;
+      b.vm.trap_state = &b;
+    }
+
+  int status = 0;
+  size_t nblock = 0, ninstruction = 0;
+
+  // Run both machines one basic block at a time and compare them at every boundary.
+  while (!a.vm.halt && ninstruction < budget)
+    {
+      word start = *a.vm.ip;
+
+      size_t x = a.engine->run_block (&a.vm);
+      size_t y = b.engine->run_block (&b.vm);
+
+      size_t address = SIZE_MAX;
+      const char *reason = x != y ? "block length differs"
+                                  : machine_compare (&a, &b, &address);
+
+      if (reason)
+        {
+          report (&a, &b, has_symbols ? &symbols : NULL, reason, start, nblock,
+                  ninstruction, x, y, address);
+          status = 1;
+          break;
+        }
+
+      nblock++;
+      ninstruction += x;
+    }
+
+  if (status == 0 && a.replay.diverged)
+    {
+      fprintf (stderr, "Replay diverged at instruction %llu\n",
+               (unsigned long long)a.vm.stats.instructions);
+      status = 1;
+    }
+
+  if (status == 0)
+    printf ("ok: %s matches %s over %zu blocks, %zu instructions%s\n",
+            b.engine->name, a.engine->name, nblock, ninstruction,
+            a.vm.halt ? "" : " (budget reached)");
+
+  if (status == 0 && a.vm.trap.error != VM_ERROR_NONE)
+    printf ("both trapped on %s at " VM_FMT_WORD ", address " VM_FMT_WORD "\n",
+            vm_error_name (a.vm.trap.error), a.vm.trap.ip, a.vm.trap.address);
+
+  if (status == 0 && resume)
+    printf ("both resumed past %zu traps\n", a.ntrap);
+
+  machine_destroy (&a);
+  machine_destroy (&b);
+  vm_symbols_destroy (&symbols);
+  free (input);
+
+  return status;
+}
@@ -1,11 +1,18 @@
 #include "../vm/vm.h"
+#include "../vm/debugger.h"
+#include "../vm/history.h"
+#include "../vm/symbols.h"
 
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <unistd.h>
 
 #define MAX_REGIONS_SIZE 16
 
+// Stepping back re-executes at most this many instructions from the nearest checkpoint.
+#define HISTORY_INTERVAL 1000
+
 struct memory_region
 {
   word address;
@@ -15,12 +22,60 @@ struct memory_region
 };
 
 
+bool
+stop_at_address (VM *vm, void *state)
+{
+  return *vm->ip == *(word *)state;
+}
+
+
+bool
+stop_at_breakpoint (VM *vm, void *state)
+{
+  return vm_debugger_is_breakpoint (state, *vm->ip);
+}
+
+
+// A number, or a label when the source map is loaded.
+bool
+parse_address (const char *s, VM_Symbols *symbols, word *address)
+{
+  char *end;
+  long value = strtol (s, &end, 0);
+
+  if (end != s && !*end)
+    {
+      *address = value;
+      return true;
+    }
+
+  VM_Label *label = symbols ? vm_symbols_lookup (symbols, s) : NULL;
+
+  if (label)
+    *address = label->address;
+
+  return label != NULL;
+}
+
+
+void
+describe_stop (VM_Debugger *debugger, VM_DebuggerStop stop, char *buffer, size_t n)
+{
+  if (stop == VM_DEBUGGER_STOP_BREAKPOINT)
+    snprintf (buffer, n, "breakpoint");
+  else if (stop == VM_DEBUGGER_STOP_WATCHPOINT)
+    snprintf (buffer, n, "watchpoint, %s [" VM_FMT_WORD "] = " VM_FMT_WORD,
+              debugger->hit_store ? "store" : "read", debugger->hit_address,
+              debugger->hit_value);
+}
+
+
 int
 main (int argc, char **argv)
 {
   if (argc <= 1)
     {
-      fprintf (stderr, "USAGE: %s <ROM>\n", argv[0]);
+      fprintf (stderr, "USAGE: %s <ROM> [MAP]\n", argv[0]);
       return 1;
     }
 
@@ -38,12 +93,37 @@ main (int argc, char **argv)
 
   vm_create (&vm);
 
+  vm_map_device (&vm, &vm_device_counter, 0x9100, 0x9100);
+
   if (!vm_load_file (&vm, argv[1]))
     return 1;
 
+  // Symbolize addresses with the assembler's source map, defaulting to <ROM>.map when present.
+  VM_Symbols symbols = {0};
+  bool view_symbols = false;
+
+  char map[512];
+  snprintf (map, sizeof map, "%s.map", argv[1]);
+
+  if (argc > 2)
+    view_symbols = vm_symbols_load (&symbols, argv[2]);
+  else if (access (map, R_OK) == 0)
+    view_symbols = vm_symbols_load (&symbols, map);
+
+  VM_History history;
+  vm_history_create (&history, &vm, HISTORY_INTERVAL);
+
+  VM_Debugger debugger;
+  vm_debugger_create (&debugger, &history);
+
+  const VM_Engine *engine = vm_find_engine ("fast");
+  VM_DebuggerStop stop = VM_DEBUGGER_STOP_NONE;
+
   char line[512];
+  char message[256] = "";
 
-  while (!vm.halt)
+  // The loop outlives a halt, so a trap can be stepped back from.
+  for (;;)
     {
       printf ("\033[2J\033[H");
       printf ("\n");
@@ -58,6 +138,12 @@ main (int argc, char **argv)
       if (view_region_ip)
         {
           vm_view_memory (&vm, *vm.ip, 4, 12, 1);
+          if (view_symbols)
+            {
+              char location[256];
+              vm_symbols_format (&symbols, *vm.ip, location, sizeof location);
+              printf ("%*s%s\n", 5 + 4 * 3, "", location);
+            }
           printf ("\n");
         }
 
@@ -88,13 +174,41 @@ main (int argc, char **argv)
           printf ("\n");
         }
 
+      if (debugger.nbreakpoint > 0)
+        {
+          printf ("breakpoints");
+          for (size_t address = 0; address <= 0xFFFF; ++address)
+            if (vm_debugger_is_breakpoint (&debugger, address))
+              printf (" " VM_FMT_WORD, (word)address);
+          printf ("\n");
+        }
+
+      for (size_t i = 0; i < debugger.nwatchpoint; ++i)
+        {
+          VM_Watchpoint *watchpoint = &debugger.watchpoints[i];
+          printf ("watchpoint " VM_FMT_WORD ":" VM_FMT_WORD " %s\n", watchpoint->start,
+                  watchpoint->end, watchpoint->read ? "access" : "store");
+        }
+
+      if (vm.halt && vm.trap.error != VM_ERROR_NONE)
+        printf ("%s at " VM_FMT_WORD ", address " VM_FMT_WORD "\n\n",
+                vm_error_name (vm.trap.error), vm.trap.ip, vm.trap.address);
+      else if (vm.halt)
+        printf ("halted\n\n");
+
+      describe_stop (&debugger, stop, message, sizeof message);
+      stop = VM_DEBUGGER_STOP_NONE;
+
+      if (*message)
+        {
+          printf ("%s\n\n", message);
+          *message = 0;
+        }
+
 read_line:
       printf ("'");
       if (!fgets (line, sizeof line, stdin))
-        {
-          vm.halt = true;
-          break;
-        }
+        break;
 
       line[strcspn (line, "\n")] = 0;
 
@@ -107,6 +221,17 @@ read_line:
       char *arg3 = strtok (NULL, " ");
       char *arg4 = strtok (NULL, " ");
 
+      if (strcmp (command, "q") == 0)
+        break;
+
+      if (vm.halt
+          && (strcmp (command, "s") == 0 || strcmp (command, "n") == 0
+              || strcmp (command, "f") == 0 || strcmp (command, "c") == 0))
+        {
+          printf ("Halted, only bs and bc move\n");
+          goto read_line;
+        }
+
       if (strcmp (command, "r") == 0)
         view_registers = !view_registers;
 
@@ -170,40 +295,112 @@ read_line:
         {
           if (arg1)
             {
-              const char *s = (char *)&vm.memory[(word)strtol (arg1, NULL, 0)];
-              printf ("%s\n", s);
+              size_t address = (word)strtol (arg1, NULL, 0);
+              for (byte c; address < vm.nmemory && (c = vm_peek_byte (&vm, address)); ++address)
+                putchar (c);
+              printf ("\n");
               goto read_line;
             }
         }
 
+      if (strcmp (command, "st") == 0)
+        {
+          printf ("instructions       %llu\n", (unsigned long long)vm.stats.instructions);
+          printf ("branches taken     %llu\n", (unsigned long long)vm.stats.branches_taken);
+          printf ("branches not taken %llu\n", (unsigned long long)vm.stats.branches_not_taken);
+          printf ("calls              %llu\n", (unsigned long long)vm.stats.calls);
+          printf ("stack high water   %u\n", vm.stats.stack_high_water);
+          goto read_line;
+        }
+
+      // Stepping stops early at breakpoints and watchpoints.
       if (strcmp (command, "s") == 0)
         {
-          if (arg1)
-            {
-              int n = strtol (arg1, NULL, 0);
-              for (int i = 0; i < n && !vm.halt; ++i)
-                vm_step (&vm);
-            }
-          else
-            vm_step (&vm);
+          int n = arg1 ? strtol (arg1, NULL, 0) : 1;
+          for (int i = 0; i < n && stop == VM_DEBUGGER_STOP_NONE; ++i)
+            stop = vm_debugger_step (&debugger, &vm);
         }
 
       if (strcmp (command, "n") == 0)
         {
           word base = *vm.sp;
-          vm_step (&vm);
-          while (*vm.sp < base && !vm.halt)
-            vm_step (&vm);
+          stop = vm_debugger_step (&debugger, &vm);
+          while (*vm.sp < base && stop == VM_DEBUGGER_STOP_NONE)
+            stop = vm_debugger_step (&debugger, &vm);
         }
 
       if (strcmp (command, "f") == 0)
         {
           word base = *vm.sp;
-          while (*vm.sp <= base && !vm.halt)
-            vm_step (&vm);
+          while (*vm.sp <= base && stop == VM_DEBUGGER_STOP_NONE)
+            stop = vm_debugger_step (&debugger, &vm);
+        }
+
+      if (strcmp (command, "c") == 0)
+        stop = vm_debugger_continue (&debugger, &vm, engine, UINT64_MAX);
+
+      // Toggle a breakpoint at an address or label.
+      if (strcmp (command, "b") == 0)
+        {
+          word address;
+          if (!arg1 || !parse_address (arg1, view_symbols ? &symbols : NULL, &address))
+            {
+              printf ("Unknown address\n");
+              goto read_line;
+            }
+          vm_debugger_toggle_breakpoint (&debugger, address);
+        }
+
+      // Toggle a watchpoint on stores (w) or any access (wa) to START, or START to END.
+      if (strcmp (command, "w") == 0 || strcmp (command, "wa") == 0)
+        {
+          word start, end;
+          if (!arg1 || !parse_address (arg1, view_symbols ? &symbols : NULL, &start))
+            {
+              printf ("Unknown address\n");
+              goto read_line;
+            }
+          end = arg2 ? strtol (arg2, NULL, 0) : start;
+          if (!vm_debugger_toggle_watchpoint (&debugger, &vm, start, end,
+                                              command[1] == 'a'))
+            {
+              printf ("Too many watchpoints\n");
+              goto read_line;
+            }
+        }
+
+      // Reverse step, back N instructions.
+      if (strcmp (command, "bs") == 0)
+        {
+          uint64_t n = arg1 ? strtoull (arg1, NULL, 0) : 1;
+          uint64_t now = vm.stats.instructions;
+
+          if (!vm_history_rewind (&history, &vm, n < now ? now - n : 0))
+            vm_history_rewind (&history, &vm,
+                               history.checkpoints[0].stats.instructions);
+        }
+
+      // Reverse continue, back to the last time IP was at the address, or at any breakpoint,
+      // or as far as possible.
+      if (strcmp (command, "bc") == 0)
+        {
+          word address;
+          if (arg1 && parse_address (arg1, view_symbols ? &symbols : NULL, &address))
+            vm_history_reverse (&history, &vm, stop_at_address, &address);
+          else if (debugger.nbreakpoint > 0)
+            vm_history_reverse (&history, &vm, stop_at_breakpoint, &debugger);
+          else
+            vm_history_reverse (&history, &vm, NULL, NULL);
         }
     }
 
+  if (vm.trap.error != VM_ERROR_NONE)
+    printf ("%s at " VM_FMT_WORD ", address " VM_FMT_WORD "\n",
+            vm_error_name (vm.trap.error), vm.trap.ip, vm.trap.address);
+
+  vm_debugger_destroy (&debugger, &vm);
+  vm_history_destroy (&history, &vm);
+  vm_symbols_destroy (&symbols);
   vm_destroy (&vm);
 
   return 0;
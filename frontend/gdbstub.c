@@ -0,0 +1,625 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include "../vm/vm.h"
+#include "../vm/debugger.h"
+
+#include <netinet/in.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#define PACKET_SIZE 4096
+
+// Operations run between checks for an interrupt from the client.
+#define CONTINUE_BUDGET 100000
+
+// The registers in `VM_Register` order, then the flags as bit 0 (z) and bit 1 (c).
+#define GDB_REGISTER_FLAGS VM_REGISTER_COUNT
+#define GDB_REGISTER_COUNT (VM_REGISTER_COUNT + 1)
+
+#define GDB_SIGINT 2
+#define GDB_SIGILL 4
+#define GDB_SIGTRAP 5
+#define GDB_SIGFPE 8
+#define GDB_SIGSEGV 11
+
+#define GDB_INTERRUPT 0x03
+
+struct connection
+{
+  int fd;
+  byte buffer[PACKET_SIZE];
+  size_t start;
+  size_t end;
+};
+
+
+// Returns -1 once the client hung up.
+int
+read_char (struct connection *connection)
+{
+  if (connection->start == connection->end)
+    {
+      ssize_t n = read (connection->fd, connection->buffer, sizeof connection->buffer);
+
+      if (n <= 0)
+        return -1;
+
+      connection->start = 0;
+      connection->end = n;
+    }
+
+  return connection->buffer[connection->start++];
+}
+
+
+// Checks for a pending interrupt without blocking, anything else waiting is left for later.
+bool
+interrupted (struct connection *connection)
+{
+  struct pollfd fd = { .fd = connection->fd, .events = POLLIN };
+
+  if (connection->start == connection->end && poll (&fd, 1, 0) <= 0)
+    return false;
+
+  if (connection->start == connection->end && read_char (connection) >= 0)
+    connection->start--;
+
+  if (connection->start < connection->end
+      && connection->buffer[connection->start] == GDB_INTERRUPT)
+    {
+      connection->start++;
+      return true;
+    }
+
+  return false;
+}
+
+
+int
+hex_value (int c)
+{
+  if (c >= '0' && c <= '9')
+    return c - '0';
+  if (c >= 'a' && c <= 'f')
+    return c - 'a' + 10;
+  if (c >= 'A' && c <= 'F')
+    return c - 'A' + 10;
+  return -1;
+}
+
+
+// Receives the next packet, acknowledging it. Returns false once the client hung up, an
+// interrupt outside of a packet is returned as a packet of its own.
+bool
+receive_packet (struct connection *connection, char *packet, size_t n)
+{
+  for (;;)
+    {
+      int c;
+
+      while ((c = read_char (connection)) != '$')
+        if (c < 0)
+          return false;
+        else if (c == GDB_INTERRUPT)
+          {
+            packet[0] = GDB_INTERRUPT;
+            packet[1] = 0;
+            return true;
+          }
+
+      size_t size = 0;
+      byte sum = 0;
+
+      while ((c = read_char (connection)) != '#')
+        {
+          if (c < 0)
+            return false;
+
+          sum += c;
+
+          if (size < n - 1)
+            packet[size++] = c;
+        }
+
+      packet[size] = 0;
+
+      int h = hex_value (read_char (connection));
+      int l = hex_value (read_char (connection));
+
+      if (h >= 0 && l >= 0 && (h << 4 | l) == sum)
+        {
+          write (connection->fd, "+", 1);
+          return true;
+        }
+
+      write (connection->fd, "-", 1);
+    }
+}
+
+
+void
+send_packet (struct connection *connection, const char *data)
+{
+  static char packet[2 * PACKET_SIZE + 8];
+  byte sum = 0;
+
+  for (const char *s = data; *s; ++s)
+    sum += *s;
+
+  int n = snprintf (packet, sizeof packet, "$%s#%02x", data, sum);
+  write (connection->fd, packet, n);
+}
+
+
+// Sends a `qXfer` reply for `length` bytes of `document` from `offset`.
+void
+send_document (struct connection *connection, const char *document, size_t offset,
+               size_t length)
+{
+  static char reply[PACKET_SIZE];
+  size_t size = strlen (document);
+
+  if (offset > size)
+    offset = size;
+  if (length > size - offset)
+    length = size - offset;
+  if (length > sizeof reply - 2)
+    length = sizeof reply - 2;
+
+  reply[0] = offset + length < size ? 'm' : 'l';
+  memcpy (reply + 1, document + offset, length);
+  reply[length + 1] = 0;
+
+  send_packet (connection, reply);
+}
+
+
+// The target description, so a client can name the registers sent by `g`.
+void
+describe_target (char *buffer, size_t n)
+{
+  int size = snprintf (buffer, n,
+                       "<?xml version=\"1.0\"?>"
+                       "<!DOCTYPE target SYSTEM \"gdb-target.dtd\">"
+                       "<target version=\"1.0\"><feature name=\"org.vm.core\">");
+
+  for (int i = 0; i < VM_REGISTER_COUNT; ++i)
+    size += snprintf (buffer + size, n - size,
+                      "<reg name=\"%s\" bitsize=\"16\" type=\"%s\"/>",
+                      vm_register_name (i),
+                      i == VM_REGISTER_IP ? "code_ptr"
+                      : i == VM_REGISTER_SP || i == VM_REGISTER_BP ? "data_ptr"
+                                                                   : "uint16");
+
+  snprintf (buffer + size, n - size,
+            "<reg name=\"flags\" bitsize=\"16\" type=\"uint16\"/></feature></target>");
+}
+
+
+word
+get_register (VM *vm, int index)
+{
+  if (index == GDB_REGISTER_FLAGS)
+    return (vm->flags.z ? 1 : 0) | (vm->flags.c ? 2 : 0);
+
+  return vm->registers[index];
+}
+
+
+void
+set_register (VM *vm, int index, word value)
+{
+  if (index == GDB_REGISTER_FLAGS)
+    {
+      vm->flags.z = value & 1;
+      vm->flags.c = value >> 1 & 1;
+    }
+  else
+    vm->registers[index] = value;
+}
+
+
+// Registers go over the wire as little-endian hex.
+char *
+format_register (char *s, word value)
+{
+  return s + sprintf (s, "%02x%02x", VM_WORD_L (value), VM_WORD_H (value));
+}
+
+
+bool
+parse_register (const char *s, word *value)
+{
+  int digits[4];
+
+  for (int i = 0; i < 4; ++i)
+    if ((digits[i] = hex_value (s[i])) < 0)
+      return false;
+
+  *value = VM_WORD_PACK (digits[2] << 4 | digits[3], digits[0] << 4 | digits[1]);
+  return true;
+}
+
+
+// Whether the first `n` characters are hex digits, checked before any of them is stored.
+bool
+parse_hex (const char *s, size_t n)
+{
+  for (size_t i = 0; i < n; ++i)
+    if (hex_value (s[i]) < 0)
+      return false;
+
+  return true;
+}
+
+
+// Traps are reported as the matching signal, the VM stays halted on them.
+void
+stop_reply (VM *vm, VM_Debugger *debugger, VM_DebuggerStop stop, char *reply, size_t n)
+{
+  static const int signals[VM_ERROR_COUNT] = {
+    [VM_ERROR_ILLEGAL_OPERATION] = GDB_SIGILL,
+    [VM_ERROR_PROTECTION] = GDB_SIGSEGV,
+    [VM_ERROR_DIVISION_BY_ZERO] = GDB_SIGFPE,
+  };
+
+  if (stop == VM_DEBUGGER_STOP_HALT && vm->trap.error != VM_ERROR_NONE)
+    snprintf (reply, n, "S%02x", signals[vm->trap.error]);
+  else if (stop == VM_DEBUGGER_STOP_HALT)
+    snprintf (reply, n, "W00");
+  else if (stop == VM_DEBUGGER_STOP_WATCHPOINT)
+    snprintf (reply, n, "T%02x%s:%x;", GDB_SIGTRAP,
+              debugger->hit_store ? "watch" : "awatch", debugger->hit_address);
+  else
+    snprintf (reply, n, "S%02x", GDB_SIGTRAP);
+}
+
+
+// Serves one client until it detaches, kills the VM or hangs up.
+void
+serve (struct connection *connection, VM *vm, VM_Debugger *debugger)
+{
+  const VM_Engine *engine = vm_find_engine ("fast");
+
+  static char packet[PACKET_SIZE];
+  static char reply[2 * PACKET_SIZE];
+  static char target[4096];
+
+  describe_target (target, sizeof target);
+
+  while (receive_packet (connection, packet, sizeof packet))
+    {
+      char *args = packet + 1;
+      unsigned long address, length, kind;
+      int index;
+
+      reply[0] = 0;
+
+      switch (packet[0])
+        {
+        case GDB_INTERRUPT:
+        case '?':
+          snprintf (reply, sizeof reply, "S%02x",
+                    packet[0] == '?' ? GDB_SIGTRAP : GDB_SIGINT);
+          break;
+
+        case 'q':
+          if (strncmp (args, "Supported", 9) == 0)
+            snprintf (reply, sizeof reply, "PacketSize=%x;qXfer:features:read+",
+                      PACKET_SIZE);
+          else if (strcmp (args, "Attached") == 0)
+            strcpy (reply, "1");
+          else if (strcmp (args, "C") == 0)
+            strcpy (reply, "QC1");
+          else if (strcmp (args, "fThreadInfo") == 0)
+            strcpy (reply, "m1");
+          else if (strcmp (args, "sThreadInfo") == 0)
+            strcpy (reply, "l");
+          else if (sscanf (args, "Xfer:features:read:target.xml:%lx,%lx", &address,
+                           &length)
+                   == 2)
+            {
+              send_document (connection, target, address, length);
+              continue;
+            }
+          break;
+
+        case 'H':
+        case 'T':
+          strcpy (reply, "OK");
+          break;
+
+        case 'g':
+          {
+            char *s = reply;
+            for (int i = 0; i < GDB_REGISTER_COUNT; ++i)
+              s = format_register (s, get_register (vm, i));
+          }
+          break;
+
+        // Nothing is written unless every register parses.
+        case 'G':
+          {
+            word values[GDB_REGISTER_COUNT];
+            int i = 0;
+
+            while (i < GDB_REGISTER_COUNT && parse_register (args + i * 4, &values[i]))
+              ++i;
+
+            if (i == GDB_REGISTER_COUNT)
+              {
+                for (i = 0; i < GDB_REGISTER_COUNT; ++i)
+                  set_register (vm, i, values[i]);
+                strcpy (reply, "OK");
+              }
+            else
+              strcpy (reply, "E01");
+          }
+          break;
+
+        case 'p':
+          index = strtol (args, NULL, 16);
+          if (index >= 0 && index < GDB_REGISTER_COUNT)
+            format_register (reply, get_register (vm, index));
+          else
+            strcpy (reply, "E01");
+          break;
+
+        case 'P':
+          {
+            char *value = strchr (args, '=');
+            word v;
+            index = strtol (args, NULL, 16);
+            if (value && index >= 0 && index < GDB_REGISTER_COUNT
+                && parse_register (value + 1, &v))
+              {
+                set_register (vm, index, v);
+                strcpy (reply, "OK");
+              }
+            else
+              strcpy (reply, "E01");
+          }
+          break;
+
+        // Memory goes through the devices, so bank windows show the selected bank. Taps such
+        // as watchpoints don't see it.
+        case 'm':
+          if (sscanf (args, "%lx,%lx", &address, &length) == 2
+              && length <= sizeof reply / 2 - 1)
+            {
+              for (unsigned long i = 0; i < length; ++i)
+                sprintf (reply + i * 2, "%02x", vm_peek_byte (vm, address + i));
+              reply[length * 2] = 0;
+            }
+          else
+            strcpy (reply, "E01");
+          break;
+
+        case 'M':
+          {
+            char *data = strchr (args, ':');
+            if (data && sscanf (args, "%lx,%lx", &address, &length) == 2
+                && strlen (data + 1) >= length * 2 && parse_hex (data + 1, length * 2))
+              {
+                for (unsigned long i = 0; i < length; ++i)
+                  vm_poke_byte (vm, address + i,
+                                hex_value (data[1 + i * 2]) << 4 | hex_value (data[2 + i * 2]));
+
+                // Code may have changed under the decoded blocks.
+                debugger->generation++;
+                strcpy (reply, "OK");
+              }
+            else
+              strcpy (reply, "E01");
+          }
+          break;
+
+        case 'Z':
+        case 'z':
+          {
+            bool insert = packet[0] == 'Z';
+            int type = args[0] - '0';
+
+            if (sscanf (args + 1, ",%lx,%lx", &address, &kind) != 2)
+              {
+                strcpy (reply, "E01");
+                break;
+              }
+
+            word start = address, end = address + (kind ? kind - 1 : 0);
+
+            // Software and hardware breakpoints are the same thing here.
+            if (type == 0 || type == 1)
+              {
+                if (insert != vm_debugger_is_breakpoint (debugger, start))
+                  vm_debugger_toggle_breakpoint (debugger, start);
+                strcpy (reply, "OK");
+              }
+            // Write and access watchpoints, read-only ones aren't supported.
+            else if (type == 2 || type == 4)
+              {
+                bool found = false;
+                for (size_t i = 0; i < debugger->nwatchpoint; ++i)
+                  found |= debugger->watchpoints[i].start == start
+                           && debugger->watchpoints[i].end == end;
+
+                if (insert == found
+                    || vm_debugger_toggle_watchpoint (debugger, vm, start, end, type == 4))
+                  strcpy (reply, "OK");
+                else
+                  strcpy (reply, "E01");
+              }
+          }
+          break;
+
+        case 's':
+        case 'c':
+          {
+            unsigned long resume;
+            if (sscanf (args, "%lx", &resume) == 1)
+              *vm->ip = resume;
+
+            VM_DebuggerStop stop;
+
+            // A halted VM doesn't move, it reports the same stop again.
+            if (vm->halt)
+              stop = VM_DEBUGGER_STOP_HALT;
+            else if (packet[0] == 's')
+              stop = vm_debugger_step (debugger, vm);
+            else
+              do
+                stop = vm_debugger_continue (debugger, vm, engine, CONTINUE_BUDGET);
+              while (stop == VM_DEBUGGER_STOP_NONE && !interrupted (connection));
+
+            stop_reply (vm, debugger, stop, reply, sizeof reply);
+
+            if (stop == VM_DEBUGGER_STOP_NONE && packet[0] == 'c')
+              snprintf (reply, sizeof reply, "S%02x", GDB_SIGINT);
+          }
+          break;
+
+        case 'D':
+          send_packet (connection, "OK");
+          return;
+
+        case 'k':
+          return;
+        }
+
+      send_packet (connection, reply);
+    }
+}
+
+
+// Listens on `127.0.0.1:port`, or on a Unix socket at `path`, and accepts one client.
+int
+accept_client (int port, const char *path)
+{
+  int server;
+
+  if (path)
+    {
+      struct sockaddr_un address = { .sun_family = AF_UNIX };
+      strncpy (address.sun_path, path, sizeof address.sun_path - 1);
+      unlink (path);
+
+      server = socket (AF_UNIX, SOCK_STREAM, 0);
+      if (server < 0 || bind (server, (struct sockaddr *)&address, sizeof address) < 0)
+        {
+          perror ("Failed to bind socket");
+          return -1;
+        }
+    }
+  else
+    {
+      struct sockaddr_in address = {
+        .sin_family = AF_INET,
+        .sin_port = htons (port),
+        .sin_addr.s_addr = htonl (INADDR_LOOPBACK),
+      };
+
+      server = socket (AF_INET, SOCK_STREAM, 0);
+      int yes = 1;
+      if (server < 0
+          || setsockopt (server, SOL_SOCKET, SO_REUSEADDR, &yes, sizeof yes) < 0
+          || bind (server, (struct sockaddr *)&address, sizeof address) < 0)
+        {
+          perror ("Failed to bind socket");
+          return -1;
+        }
+    }
+
+  if (listen (server, 1) < 0)
+    {
+      perror ("Failed to listen");
+      close (server);
+      return -1;
+    }
+
+  if (path)
+    fprintf (stderr, "Waiting for a client on %s\n", path);
+  else
+    fprintf (stderr, "Waiting for a client on port %d\n", port);
+
+  int client = accept (server, NULL, NULL);
+
+  if (client < 0)
+    perror ("Failed to accept");
+
+  close (server);
+
+  if (path)
+    unlink (path);
+
+  return client;
+}
+
+
+void
+usage (const char *name)
+{
+  fprintf (stderr, "USAGE: %s [OPTIONS] <ROM>\n", name);
+  fprintf (stderr, "    OPTIONS\n");
+  fprintf (stderr, "        -p PORT  Listen on 127.0.0.1:PORT, default 1234\n");
+  fprintf (stderr, "        -u PATH  Listen on a Unix socket instead\n");
+}
+
+
+int
+main (int argc, char **argv)
+{
+  int port = 1234;
+  const char *path = NULL;
+
+  int option;
+  while ((option = getopt (argc, argv, "p:u:")) != -1)
+    switch (option)
+      {
+      case 'p':
+        port = strtol (optarg, NULL, 0);
+        break;
+      case 'u':
+        path = optarg;
+        break;
+      default:
+        usage (argv[0]);
+        return 1;
+      }
+
+  if (optind >= argc)
+    {
+      usage (argv[0]);
+      return 1;
+    }
+
+  VM vm = {0};
+
+  vm_create (&vm);
+
+  vm_map_device (&vm, &vm_device_counter, 0x9100, 0x9100);
+
+  if (!vm_load_file (&vm, argv[optind]))
+    return 1;
+
+  VM_Debugger debugger;
+  vm_debugger_create (&debugger, NULL);
+
+  struct connection connection = { .fd = accept_client (port, path) };
+
+  if (connection.fd < 0)
+    return 1;
+
+  serve (&connection, &vm, &debugger);
+
+  close (connection.fd);
+
+  vm_debugger_destroy (&debugger, &vm);
+  vm_destroy (&vm);
+
+  return 0;
+}
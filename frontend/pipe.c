@@ -0,0 +1,200 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include "../vm/vm.h"
+#include "../vm/mailbox.h"
+#include "../vm/queue.h"
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define DEFAULT_CAPACITY 256
+#define MAILBOX_ADDRESS 0x9200
+
+// A VM of a pipeline, receiving from the stage before it and sending to the one after.
+struct stage
+{
+  VM vm;
+  VM_Mailbox mailbox;
+  const VM_Engine *engine;
+  size_t group;
+  size_t replica;
+  pthread_t thread;
+};
+
+
+void
+writer_store_byte (VM *vm, VM_Device *device, word address, byte value)
+{
+  (void)vm, (void)device, (void)address;
+  putc (value, stdout);
+}
+
+byte
+reader_read_byte (VM *vm, VM_Device *device, word address)
+{
+  (void)vm, (void)device, (void)address;
+  return getc (stdin);
+}
+
+VM_Device writer = {
+  .read_byte = vm_default_read_byte,
+  .read_word = vm_default_read_word,
+  .store_byte = writer_store_byte,
+  .store_word = vm_default_store_word,
+};
+
+VM_Device reader = {
+  .read_byte = reader_read_byte,
+  .read_word = vm_default_read_word,
+  .store_byte = vm_default_store_byte,
+  .store_word = vm_default_store_word,
+};
+
+
+// The next stage sees the queue closed once every replica of this one halted.
+void *
+stage_run (void *argument)
+{
+  struct stage *stage = argument;
+
+  vm_run (&stage->vm, stage->engine);
+
+  if (stage->mailbox.send)
+    vm_queue_close (stage->mailbox.send);
+
+  return NULL;
+}
+
+int
+main (int argc, char **argv)
+{
+  size_t capacity = DEFAULT_CAPACITY;
+
+  int option;
+  while ((option = getopt (argc, argv, "n:")) != -1)
+    switch (option)
+      {
+      case 'n':
+        capacity = strtoul (optarg, NULL, 0);
+        break;
+      default:
+        optind = argc;
+        break;
+      }
+
+  if (optind >= argc)
+    {
+      fprintf (stderr, "USAGE: %s [OPTIONS] <ROM[:COUNT]>...\n", argv[0]);
+      fprintf (stderr, "    Runs each ROM in its own VM on its own thread, COUNT replicas of it\n");
+      fprintf (stderr, "    with their replica index in ID. Every replica's mailbox at %04x\n",
+               MAILBOX_ADDRESS);
+      fprintf (stderr, "    receives from the ROM before and sends to the ROM after it.\n");
+      fprintf (stderr, "    OPTIONS\n");
+      fprintf (stderr, "        -n COUNT  Words each queue holds (default %d)\n",
+               DEFAULT_CAPACITY);
+      return 1;
+    }
+
+  size_t ngroup = argc - optind;
+  size_t *counts = calloc (ngroup, sizeof (size_t));
+  size_t nstage = 0;
+
+  for (size_t i = 0; i < ngroup; ++i)
+    {
+      char *separator = strrchr (argv[optind + i], ':');
+
+      counts[i] = 1;
+
+      if (separator)
+        {
+          *separator = '\0';
+          counts[i] = strtoul (separator + 1, NULL, 0);
+        }
+
+      if (counts[i] == 0)
+        {
+          fprintf (stderr, "No replicas of `%s`\n", argv[optind + i]);
+          return 1;
+        }
+
+      nstage += counts[i];
+    }
+
+  // Queue `i` connects every replica of ROM `i` to every replica of ROM `i + 1`.
+  VM_Queue *queues = calloc (ngroup, sizeof (VM_Queue));
+
+  for (size_t i = 0; i + 1 < ngroup; ++i)
+    if (!vm_queue_create (&queues[i], capacity, counts[i], counts[i + 1]))
+      return 1;
+
+  struct stage *stages = calloc (nstage, sizeof (struct stage));
+  size_t s = 0;
+
+  for (size_t i = 0; i < ngroup; ++i)
+    for (size_t j = 0; j < counts[i]; ++j, ++s)
+      {
+        struct stage *stage = &stages[s];
+
+        vm_create (&stage->vm);
+
+        stage->engine = vm_find_engine ("fast");
+        stage->group = i;
+        stage->replica = j;
+
+        vm_mailbox_create (&stage->mailbox, i + 1 < ngroup ? &queues[i] : NULL,
+                           i > 0 ? &queues[i - 1] : NULL);
+
+        vm_map_device (&stage->vm, &writer, 0x3000, 0x3100);
+        vm_map_device (&stage->vm, &reader, 0x3100, 0x3200);
+        vm_map_device (&stage->vm, &vm_device_counter, 0x9100, 0x9100);
+        vm_map_device (&stage->vm, &stage->mailbox.device, MAILBOX_ADDRESS, MAILBOX_ADDRESS);
+
+        if (!vm_load_file (&stage->vm, argv[optind + i]))
+          return 1;
+
+        stage->vm.registers[VM_REGISTER_ID] = j;
+      }
+
+  for (size_t i = 0; i < nstage; ++i)
+    {
+      int error = pthread_create (&stages[i].thread, NULL, stage_run, &stages[i]);
+
+      if (error != 0)
+        {
+          fprintf (stderr, "Failed to start stage %zu: %s\n", i, strerror (error));
+          return 1;
+        }
+    }
+
+  bool ok = true;
+
+  for (size_t i = 0; i < nstage; ++i)
+    {
+      pthread_join (stages[i].thread, NULL);
+
+      VM_Trap *trap = &stages[i].vm.trap;
+
+      if (trap->error != VM_ERROR_NONE)
+        {
+          fprintf (stderr, "%s at " VM_FMT_WORD ", address " VM_FMT_WORD " in `%s`, ID %zu\n",
+                   vm_error_name (trap->error), trap->ip, trap->address,
+                   argv[optind + stages[i].group], stages[i].replica);
+          ok = false;
+        }
+    }
+
+  for (size_t i = 0; i < nstage; ++i)
+    vm_destroy (&stages[i].vm);
+
+  for (size_t i = 0; i + 1 < ngroup; ++i)
+    vm_queue_destroy (&queues[i]);
+
+  free (stages);
+  free (queues);
+  free (counts);
+
+  return ok ? 0 : 1;
+}
@@ -1,6 +1,14 @@
+#define _POSIX_C_SOURCE 200809L
+
 #include "../vm/vm.h"
+#include "../vm/heatmap.h"
+#include "../vm/replay.h"
+#include "../vm/trace.h"
 
 #include <SDL2/SDL.h>
+#include <unistd.h>
+
+#define DEFAULT_INTERVAL 10000
 
 SDL_Window *sdl_window;
 SDL_Renderer *sdl_renderer;
@@ -61,9 +69,48 @@ keyboard_read_byte (VM *vm, VM_Device *device, word address)
 int
 main (int argc, char **argv)
 {
-  if (argc <= 1)
+  const char *working_set = NULL;
+  const char *heatmap_path = NULL;
+  const char *trace_path = NULL;
+  const char *record_path = NULL;
+  uint64_t interval = DEFAULT_INTERVAL;
+
+  int option;
+  while ((option = getopt (argc, argv, "w:W:H:t:r:")) != -1)
+    switch (option)
+      {
+      case 'w':
+        working_set = optarg;
+        break;
+      case 'W':
+        interval = strtoull (optarg, NULL, 0);
+        break;
+      case 'H':
+        heatmap_path = optarg;
+        break;
+      case 't':
+        trace_path = optarg;
+        break;
+      case 'r':
+        record_path = optarg;
+        break;
+      default:
+        optind = argc;
+        break;
+      }
+
+  if (optind >= argc)
     {
-      fprintf (stderr, "USAGE: %s <ROM>\n", argv[0]);
+      fprintf (stderr, "USAGE: %s [OPTIONS] <ROM>\n", argv[0]);
+      fprintf (stderr, "    OPTIONS\n");
+      fprintf (stderr, "        -w FILE   Write the working-set curve as CSV\n");
+      fprintf (stderr, "        -W COUNT  Instructions between working-set samples "
+                       "(default %d)\n", DEFAULT_INTERVAL);
+      fprintf (stderr, "        -H FILE   Write per-block accesses on exit, "
+                       "as PPM if FILE ends in .ppm, else CSV\n");
+      fprintf (stderr, "        -t FILE   Record an execution trace, see `vm-trace`\n");
+      fprintf (stderr, "        -r FILE   Record every device read, replay with "
+                       "`vm-tty -p FILE`\n");
       return 1;
     }
 
@@ -90,17 +137,34 @@ main (int argc, char **argv)
   keyboard.state = (void *)SDL_GetKeyboardState (NULL);
 
   vm_map_device (&vm, &keyboard, 0x7000, 0x7200);
+  vm_map_device (&vm, &vm_device_counter, 0x9100, 0x9100);
+
+  if (!vm_load_file (&vm, argv[optind]))
+    return 1;
+
+  VM_Recording recording = { 0 };
+
+  if (record_path && !vm_recording_create (&recording, &vm, record_path))
+    return 1;
+
+  VM_Heatmap heatmap = { 0 };
+
+  if (working_set && !vm_heatmap_create (&heatmap, working_set, interval))
+    return 1;
+
+  VM_Trace trace = { 0 };
 
-  if (!vm_load_file (&vm, argv[1]))
+  if (trace_path && !vm_trace_create (&trace, &vm, trace_path))
     return 1;
 
   render_init ("", 768, 768, 6);
 
   while (!vm.halt)
     {
-      if (vm_read_byte (&vm, 0x9000) == 1)
+      // Polled straight from RAM, so the frontend doesn't show up in the guest's counters.
+      if (vm.memory[0x9000] == 1)
         {
-          vm_store_byte (&vm, 0x9000, 0);
+          vm.memory[0x9000] = 0;
 
           SDL_Event event;
           while (SDL_PollEvent (&event))
@@ -117,11 +181,17 @@ main (int argc, char **argv)
             pixel_buffer[i] = 0x000000;
         }
 
-      vm_step (&vm);
+      if (trace_path)
+        vm_trace_step (&trace, &vm);
+      else
+        vm_step (&vm);
 
-      if (vm_read_byte (&vm, 0x9001) == 1)
+      if (working_set)
+        vm_heatmap_update (&heatmap, &vm);
+
+      if (vm.memory[0x9001] == 1)
         {
-          vm_store_byte (&vm, 0x9001, 0);
+          vm.memory[0x9001] = 0;
 
           SDL_UpdateTexture (sdl_texture, NULL, pixel_buffer,
                              width * sizeof (uint32_t));
@@ -137,8 +207,26 @@ main (int argc, char **argv)
   SDL_DestroyRenderer (sdl_renderer);
   SDL_DestroyWindow (sdl_window);
 
+  if (trace_path && !vm_trace_destroy (&trace, &vm))
+    return 1;
+
+  if (record_path && !vm_recording_destroy (&recording, &vm))
+    return 1;
+
+  if (working_set)
+    vm_heatmap_destroy (&heatmap, &vm);
+
+  if (heatmap_path && !vm_heatmap_dump (&vm, heatmap_path))
+    return 1;
+
+  if (vm.trap.error != VM_ERROR_NONE)
+    fprintf (stderr, "%s at " VM_FMT_WORD ", address " VM_FMT_WORD "\n",
+             vm_error_name (vm.trap.error), vm.trap.ip, vm.trap.address);
+
+  bool ok = vm.trap.error == VM_ERROR_NONE;
+
   vm_destroy (&vm);
 
-  return 0;
+  return ok ? 0 : 1;
 }
 
@@ -0,0 +1,494 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include "../vm/vm.h"
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+// Under $XDG_RUNTIME_DIR, which only the user can write to.
+#define DEFAULT_NAME "vm-server.sock"
+#define DEFAULT_WORKERS 4
+
+#define LINE_SIZE 4096
+#define OUTPUT_SIZE 4096
+#define MAX_INPUT (16 << 20)
+
+// Memory, protection and registers as `vm_load_file` left them, before the ROM ran anything.
+// Restored before every job that runs it.
+struct image
+{
+  byte memory[0x10000];
+  byte protection[VM_DEVICE_BLOCK_COUNT];
+  word registers[VM_REGISTER_COUNT];
+};
+
+struct connection
+{
+  int fd;
+  byte buffer[LINE_SIZE];
+  size_t start;
+  size_t end;
+};
+
+// The job's input, and its output streamed back in chunks of up to OUTPUT_SIZE bytes.
+struct io
+{
+  struct connection *connection;
+  bool failed;
+
+  byte *input;
+  size_t ninput;
+  size_t cursor;
+
+  byte output[OUTPUT_SIZE];
+  size_t noutput;
+};
+
+struct server
+{
+  int listener;
+  struct image *images;
+  size_t nimage;
+  struct image blank;
+  const VM_Engine *engine;
+};
+
+// A warm VM with its devices mapped, reused by every job its thread accepts.
+struct worker
+{
+  pthread_t thread;
+  struct server *server;
+  VM vm;
+  VM_Device writer;
+  VM_Device reader;
+  struct io io;
+};
+
+
+bool
+write_all (int fd, const void *data, size_t n)
+{
+  const byte *bytes = data;
+
+  while (n > 0)
+    {
+      ssize_t written = send (fd, bytes, n, MSG_NOSIGNAL);
+
+      if (written <= 0)
+        return false;
+
+      bytes += written;
+      n -= written;
+    }
+
+  return true;
+}
+
+
+bool
+flush_output (struct io *io)
+{
+  char header[32];
+  int n = snprintf (header, sizeof header, "OUT %zu\n", io->noutput);
+
+  if (io->noutput > 0 && !io->failed)
+    io->failed = !write_all (io->connection->fd, header, n)
+                 || !write_all (io->connection->fd, io->output, io->noutput);
+
+  io->noutput = 0;
+
+  return !io->failed;
+}
+
+
+// A client that went away halts the job.
+void
+writer_store_byte (VM *vm, VM_Device *device, word address, byte value)
+{
+  (void)address;
+  struct io *io = device->state;
+
+  io->output[io->noutput++] = value;
+
+  if (io->noutput == OUTPUT_SIZE && !flush_output (io))
+    vm->halt = true;
+}
+
+byte
+reader_read_byte (VM *vm, VM_Device *device, word address)
+{
+  (void)vm, (void)address;
+  struct io *io = device->state;
+
+  if (io->cursor >= io->ninput)
+    return EOF;
+
+  return io->input[io->cursor++];
+}
+
+
+// Reads up to `n` bytes, from what's buffered first. Returns 0 once the client hung up.
+size_t
+read_some (struct connection *connection, byte *data, size_t n)
+{
+  if (connection->start == connection->end)
+    {
+      ssize_t got = read (connection->fd, connection->buffer, sizeof connection->buffer);
+
+      if (got <= 0)
+        return 0;
+
+      connection->start = 0;
+      connection->end = got;
+    }
+
+  if (n > connection->end - connection->start)
+    n = connection->end - connection->start;
+
+  memcpy (data, &connection->buffer[connection->start], n);
+  connection->start += n;
+
+  return n;
+}
+
+bool
+read_exact (struct connection *connection, byte *data, size_t n)
+{
+  for (size_t got; n > 0; data += got, n -= got)
+    if ((got = read_some (connection, data, n)) == 0)
+      return false;
+
+  return true;
+}
+
+// Reads a line without its newline, false at the end of the stream or if it doesn't fit.
+bool
+read_line (struct connection *connection, char *line, size_t n)
+{
+  for (size_t i = 0; i + 1 < n; ++i)
+    {
+      if (!read_exact (connection, (byte *)&line[i], 1))
+        return false;
+
+      if (line[i] == '\n')
+        {
+          line[i] = '\0';
+          return true;
+        }
+    }
+
+  return false;
+}
+
+
+void
+save_image (struct image *image, VM *vm)
+{
+  memcpy (image->memory, vm->memory, sizeof image->memory);
+  memcpy (image->protection, vm->protection, sizeof image->protection);
+  memcpy (image->registers, vm->registers, sizeof image->registers);
+}
+
+void
+restore_image (VM *vm, const struct image *image)
+{
+  memcpy (vm->memory, image->memory, sizeof image->memory);
+  memcpy (vm->protection, image->protection, sizeof image->protection);
+  memcpy (vm->registers, image->registers, sizeof vm->registers);
+  memset (vm->vectors, 0, sizeof vm->vectors);
+
+  vm->stack = *vm->sp;
+  vm->flags.z = vm->flags.c = 0;
+  vm->halt = false;
+  vm->trap = (VM_Trap){ VM_ERROR_NONE, 0, 0 };
+
+  memset (&vm->stats, 0, sizeof (VM_Stats));
+  memset (vm->counters, 0, sizeof vm->counters);
+}
+
+
+void
+map_devices (VM *vm, VM_Device *writer, VM_Device *reader, struct io *io)
+{
+  writer->read_byte = vm_default_read_byte;
+  writer->read_word = vm_default_read_word;
+  writer->store_byte = writer_store_byte;
+  writer->store_word = vm_default_store_word;
+  writer->state = io;
+
+  vm_map_device (vm, writer, 0x3000, 0x3100);
+
+  reader->read_byte = reader_read_byte;
+  reader->read_word = vm_default_read_word;
+  reader->store_byte = vm_default_store_byte;
+  reader->store_word = vm_default_store_word;
+  reader->state = io;
+
+  vm_map_device (vm, reader, 0x3100, 0x3200);
+  vm_map_device (vm, &vm_device_counter, 0x9100, 0x9100);
+}
+
+
+// Loads the ROM named by a request, `#N` for the Nth preloaded one, anything else a path.
+bool
+prepare (struct worker *worker, const char *rom)
+{
+  struct server *server = worker->server;
+
+  if (rom[0] == '#')
+    {
+      char *end;
+      unsigned long index = strtoul (rom + 1, &end, 10);
+
+      if (end == rom + 1 || *end || index >= server->nimage)
+        return false;
+
+      restore_image (&worker->vm, &server->images[index]);
+      return true;
+    }
+
+  restore_image (&worker->vm, &server->blank);
+
+  return vm_load_file (&worker->vm, rom);
+}
+
+
+// Runs every job of one connection, each a `RUN <ROM> <BUDGET> <NINPUT>` line followed by
+// NINPUT bytes of input.
+void
+serve (struct worker *worker, struct connection *connection)
+{
+  VM *vm = &worker->vm;
+  struct io *io = &worker->io;
+  char line[LINE_SIZE], rom[LINE_SIZE], reply[LINE_SIZE + 32];
+  unsigned long long budget;
+  size_t ninput;
+
+  while (read_line (connection, line, sizeof line))
+    {
+      if (sscanf (line, "RUN %4095s %llu %zu", rom, &budget, &ninput) != 3
+          || ninput > MAX_INPUT)
+        {
+          write_all (connection->fd, "ERR bad request\n", 16);
+          return;
+        }
+
+      *io = (struct io){ .connection = connection, .ninput = ninput };
+      io->input = malloc (ninput ? ninput : 1);
+
+      if (!read_exact (connection, io->input, ninput))
+        {
+          free (io->input);
+          return;
+        }
+
+      if (!prepare (worker, rom))
+        {
+          free (io->input);
+          snprintf (reply, sizeof reply, "ERR can't load %s\n", rom);
+
+          if (!write_all (connection->fd, reply, strlen (reply)))
+            return;
+          continue;
+        }
+
+      uint64_t limit = budget ? vm->stats.instructions + budget : UINT64_MAX;
+
+      while (!vm->halt && vm->stats.instructions < limit)
+        worker->server->engine->run_block (vm);
+
+      free (io->input);
+
+      const char *status = vm->trap.error != VM_ERROR_NONE ? vm_error_name (vm->trap.error)
+                           : vm->halt                      ? "halt"
+                                                           : "budget";
+
+      snprintf (reply, sizeof reply, "END %llu %s\n",
+                (unsigned long long)vm->stats.instructions, status);
+
+      if (!flush_output (io) || !write_all (connection->fd, reply, strlen (reply)))
+        return;
+    }
+}
+
+
+void *
+worker_run (void *argument)
+{
+  struct worker *worker = argument;
+
+  for (;;)
+    {
+      struct connection connection = { .fd = accept (worker->server->listener, NULL, NULL) };
+
+      if (connection.fd < 0)
+        {
+          perror ("Failed to accept");
+          return NULL;
+        }
+
+      serve (worker, &connection);
+      close (connection.fd);
+    }
+}
+
+
+// Only a stale socket is replaced, any other file at `path` makes binding fail.
+int
+listen_on (const char *path)
+{
+  struct sockaddr_un address = { .sun_family = AF_UNIX };
+  strncpy (address.sun_path, path, sizeof address.sun_path - 1);
+
+  struct stat status;
+  if (lstat (path, &status) == 0 && S_ISSOCK (status.st_mode))
+    unlink (path);
+
+  int server = socket (AF_UNIX, SOCK_STREAM, 0);
+
+  if (server < 0 || bind (server, (struct sockaddr *)&address, sizeof address) < 0)
+    {
+      perror ("Failed to bind socket");
+      return -1;
+    }
+
+  if (listen (server, SOMAXCONN) < 0)
+    {
+      perror ("Failed to listen");
+      close (server);
+      return -1;
+    }
+
+  return server;
+}
+
+
+void
+usage (const char *name)
+{
+  fprintf (stderr, "USAGE: %s [OPTIONS] [ROM]...\n", name);
+  fprintf (stderr, "    Runs jobs sent to a Unix socket on a pool of VMs. A job is a\n");
+  fprintf (stderr, "    `RUN <ROM> <BUDGET> <NINPUT>` line followed by NINPUT bytes of input,\n");
+  fprintf (stderr, "    ROM being `#N` for the Nth ROM given here or a path, BUDGET 0 for none.\n");
+  fprintf (stderr, "    It is answered by `OUT <N>` lines each followed by N bytes of output,\n");
+  fprintf (stderr, "    then `END <INSTRUCTIONS> <STATUS>`, or by `ERR <MESSAGE>`.\n");
+  fprintf (stderr, "    OPTIONS\n");
+  fprintf (stderr, "        -u PATH   Listen on PATH, default $XDG_RUNTIME_DIR/" DEFAULT_NAME "\n");
+  fprintf (stderr, "        -j COUNT  Worker threads, each with its own VM (default %d)\n",
+           DEFAULT_WORKERS);
+  fprintf (stderr, "        -e NAME   Engine to run jobs on (default fast)\n");
+}
+
+
+int
+main (int argc, char **argv)
+{
+  const char *path = NULL;
+  size_t nworker = DEFAULT_WORKERS;
+  const char *engine = "fast";
+
+  int option;
+  while ((option = getopt (argc, argv, "u:j:e:")) != -1)
+    switch (option)
+      {
+      case 'u':
+        path = optarg;
+        break;
+      case 'j':
+        nworker = strtoul (optarg, NULL, 0);
+        break;
+      case 'e':
+        engine = optarg;
+        break;
+      default:
+        usage (argv[0]);
+        return 1;
+      }
+
+  struct server server = { .engine = vm_find_engine (engine) };
+
+  if (!server.engine)
+    {
+      fprintf (stderr, "Unknown engine `%s`\n", engine);
+      return 1;
+    }
+
+  if (nworker == 0)
+    nworker = 1;
+
+  char runtime[sizeof ((struct sockaddr_un *)0)->sun_path];
+  const char *directory = getenv ("XDG_RUNTIME_DIR");
+
+  if (!path && directory && *directory
+      && (size_t)snprintf (runtime, sizeof runtime, "%s/" DEFAULT_NAME, directory)
+           < sizeof runtime)
+    path = runtime;
+
+  if (!path)
+    {
+      fprintf (stderr, "XDG_RUNTIME_DIR isn't set, give a socket path with -u\n");
+      return 1;
+    }
+
+  // Every image is taken from a VM with the workers' device map.
+  VM vm = {0};
+  struct io io = {0};
+  VM_Device writer, reader;
+
+  vm_create (&vm);
+  map_devices (&vm, &writer, &reader, &io);
+  save_image (&server.blank, &vm);
+
+  server.nimage = argc - optind;
+  server.images = calloc (server.nimage, sizeof (struct image));
+
+  for (size_t i = 0; i < server.nimage; ++i)
+    {
+      restore_image (&vm, &server.blank);
+
+      if (!vm_load_file (&vm, argv[optind + i]))
+        return 1;
+
+      save_image (&server.images[i], &vm);
+    }
+
+  vm_destroy (&vm);
+
+  server.listener = listen_on (path);
+
+  if (server.listener < 0)
+    return 1;
+
+  struct worker *workers = calloc (nworker, sizeof (struct worker));
+
+  for (size_t i = 0; i < nworker; ++i)
+    {
+      workers[i].server = &server;
+      vm_create (&workers[i].vm);
+      map_devices (&workers[i].vm, &workers[i].writer, &workers[i].reader, &workers[i].io);
+
+      int error = pthread_create (&workers[i].thread, NULL, worker_run, &workers[i]);
+
+      if (error != 0)
+        {
+          fprintf (stderr, "Failed to start worker %zu: %s\n", i, strerror (error));
+          return 1;
+        }
+    }
+
+  fprintf (stderr, "Serving %zu ROMs on %s with %zu workers\n", server.nimage, path, nworker);
+
+  for (size_t i = 0; i < nworker; ++i)
+    pthread_join (workers[i].thread, NULL);
+
+  close (server.listener);
+  unlink (path);
+
+  return 1;
+}
@@ -0,0 +1,304 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include "../vm/vm.h"
+#include "../vm/symbols.h"
+#include "../vm/trace.h"
+
+#include <ctype.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <unistd.h>
+
+struct range
+{
+  word start;
+  word end;
+};
+
+struct record
+{
+  uint64_t index;
+  word ip;
+  byte opcode;
+  VM_TraceWrite writes[VM_TRACE_MAX_WRITES];
+  size_t nwrites;
+};
+
+
+bool
+read_varint (FILE *file, uint32_t *value)
+{
+  *value = 0;
+
+  for (int shift = 0; shift < 32; shift += 7)
+    {
+      int c = getc (file);
+
+      if (c == EOF)
+        return false;
+
+      *value |= (uint32_t)(c & 0x7F) << shift;
+
+      if (!(c & 0x80))
+        return true;
+    }
+
+  return false;
+}
+
+
+bool
+read_word (FILE *file, word *value)
+{
+  int l = getc (file);
+  int h = getc (file);
+
+  if (l == EOF || h == EOF)
+    return false;
+
+  *value = VM_WORD_PACK (h, l);
+  return true;
+}
+
+
+// Returns false at the end of the trace, and reports truncated records.
+bool
+read_record (FILE *file, struct record *record, word *previous)
+{
+  uint32_t header, count = 0;
+
+  if (!read_varint (file, &header))
+    return false;
+
+  int opcode = getc (file);
+  bool truncated = opcode == EOF;
+
+  if (!truncated && (header & 1))
+    truncated = !read_varint (file, &count);
+
+  uint32_t zigzag = header >> 1;
+  int delta = zigzag & 1 ? -(int)((zigzag + 1) >> 1) : (int)(zigzag >> 1);
+
+  record->ip = *previous + delta;
+  record->opcode = opcode;
+  record->nwrites = 0;
+
+  for (uint32_t i = 0; i < count && !truncated; ++i)
+    {
+      int wide = getc (file);
+      word address, value = 0;
+
+      truncated = wide == EOF || !read_word (file, &address);
+
+      if (!truncated && wide)
+        truncated = !read_word (file, &value);
+      else if (!truncated)
+        {
+          int c = getc (file);
+          truncated = c == EOF;
+          value = c;
+        }
+
+      if (!truncated && record->nwrites < VM_TRACE_MAX_WRITES)
+        record->writes[record->nwrites++] = (VM_TraceWrite){ address, value, wide };
+    }
+
+  if (truncated)
+    {
+      fprintf (stderr, "Truncated record %llu\n",
+               (unsigned long long)record->index);
+      return false;
+    }
+
+  *previous = record->ip;
+  return true;
+}
+
+
+bool
+parse_range (const char *s, struct range *range)
+{
+  char *end;
+  range->start = strtol (s, &end, 0);
+  range->end = *end == ':' ? strtol (end + 1, NULL, 0) : range->start;
+  return end != s;
+}
+
+
+bool
+matches (struct record *record, struct range *ips, int opcode, struct range *writes)
+{
+  if (ips && (record->ip < ips->start || record->ip > ips->end))
+    return false;
+
+  if (opcode >= 0 && record->opcode != opcode)
+    return false;
+
+  if (!writes)
+    return true;
+
+  for (size_t i = 0; i < record->nwrites; ++i)
+    if (record->writes[i].address >= writes->start
+        && record->writes[i].address <= writes->end)
+      return true;
+
+  return false;
+}
+
+
+void
+print_record (struct record *record, VM_Symbols *symbols)
+{
+  char name[32];
+  const char *s = vm_operation_name (record->opcode);
+  size_t n = 0;
+
+  for (; s[n] && n < sizeof name - 1; ++n)
+    name[n] = tolower (s[n]);
+  name[n] = 0;
+
+  printf ("%10llu  " VM_FMT_WORD "  %-10s", (unsigned long long)record->index,
+          record->ip, name);
+
+  for (size_t i = 0; i < record->nwrites; ++i)
+    {
+      VM_TraceWrite *write = &record->writes[i];
+
+      if (write->wide)
+        printf ("  [" VM_FMT_WORD "]=" VM_FMT_WORD, write->address, write->value);
+      else
+        printf ("  [" VM_FMT_WORD "]=" VM_FMT_BYTE, write->address, write->value);
+    }
+
+  if (symbols)
+    {
+      char location[256];
+      vm_symbols_format (symbols, record->ip, location, sizeof location);
+      printf ("  ; %s", location);
+    }
+
+  printf ("\n");
+}
+
+
+void
+usage (const char *name)
+{
+  fprintf (stderr, "USAGE: %s [OPTIONS] <TRACE>\n", name);
+  fprintf (stderr, "    OPTIONS\n");
+  fprintf (stderr, "        -a START[:END]  Only operations at these addresses\n");
+  fprintf (stderr, "        -o NAME         Only this operation, e.g. `call_i`\n");
+  fprintf (stderr, "        -w START[:END]  Only operations storing to these addresses\n");
+  fprintf (stderr, "        -s COUNT        Skip the first COUNT operations\n");
+  fprintf (stderr, "        -n COUNT        Print at most COUNT operations\n");
+  fprintf (stderr, "        -c              Print operation counts instead\n");
+  fprintf (stderr, "        -m MAP          Source map used to symbolize addresses\n");
+}
+
+
+int
+main (int argc, char **argv)
+{
+  struct range ips, writes;
+  bool filter_ips = false, filter_writes = false, histogram = false;
+  int opcode = -1;
+  uint64_t skip = 0, limit = UINT64_MAX;
+
+  VM_Symbols symbols = {0};
+  bool has_symbols = false;
+
+  int option;
+  while ((option = getopt (argc, argv, "a:o:w:s:n:cm:")) != -1)
+    switch (option)
+      {
+      case 'a':
+        filter_ips = parse_range (optarg, &ips);
+        break;
+      case 'o':
+        for (int i = 0; i < VM_OPERATION_COUNT; ++i)
+          if (strcasecmp (vm_operation_name (i), optarg) == 0)
+            opcode = i;
+        if (opcode < 0)
+          {
+            fprintf (stderr, "Unknown operation `%s`\n", optarg);
+            return 1;
+          }
+        break;
+      case 'w':
+        filter_writes = parse_range (optarg, &writes);
+        break;
+      case 's':
+        skip = strtoull (optarg, NULL, 0);
+        break;
+      case 'n':
+        limit = strtoull (optarg, NULL, 0);
+        break;
+      case 'c':
+        histogram = true;
+        break;
+      case 'm':
+        if (!(has_symbols = vm_symbols_load (&symbols, optarg)))
+          return 1;
+        break;
+      default:
+        usage (argv[0]);
+        return 1;
+      }
+
+  if (optind >= argc)
+    {
+      usage (argv[0]);
+      return 1;
+    }
+
+  FILE *file = fopen (argv[optind], "rb");
+
+  if (!file)
+    {
+      perror ("Failed to open file");
+      return 1;
+    }
+
+  char magic[sizeof VM_TRACE_MAGIC - 1];
+
+  if (fread (magic, 1, sizeof magic, file) != sizeof magic
+      || memcmp (magic, VM_TRACE_MAGIC, sizeof magic) != 0)
+    {
+      fprintf (stderr, "Not a trace file `%s`\n", argv[optind]);
+      fclose (file);
+      return 1;
+    }
+
+  uint64_t counts[256] = {0};
+  uint64_t printed = 0;
+
+  struct record record = {0};
+  word previous = 0;
+
+  for (; printed < limit && read_record (file, &record, &previous); ++record.index)
+    {
+      if (record.index < skip
+          || !matches (&record, filter_ips ? &ips : NULL, opcode,
+                       filter_writes ? &writes : NULL))
+        continue;
+
+      if (histogram)
+        counts[record.opcode]++;
+      else
+        print_record (&record, has_symbols ? &symbols : NULL);
+
+      printed++;
+    }
+
+  if (histogram)
+    for (int i = 0; i < 256; ++i)
+      if (counts[i])
+        printf ("%-10s %llu\n", vm_operation_name (i), (unsigned long long)counts[i]);
+
+  fclose (file);
+  vm_symbols_destroy (&symbols);
+
+  return 0;
+}
@@ -1,6 +1,20 @@
+#define _POSIX_C_SOURCE 200809L
+
 #include "../vm/vm.h"
+#include "../vm/bank.h"
+#include "../vm/disk.h"
+#include "../vm/heatmap.h"
+#include "../vm/replay.h"
+#include "../vm/ring.h"
+#include "../vm/smp.h"
+#include "../vm/symbols.h"
+#include "../vm/trace.h"
 
 #include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#define DEFAULT_INTERVAL 10000
 
 void
 writer_store_byte (VM *vm, VM_Device *device, word address, byte value)
@@ -16,12 +30,119 @@ reader_read_byte (VM *vm, VM_Device *device, word address)
   return getc (stdin);
 }
 
+// One `name value` line per counter, followed by the accesses of each device.
+void
+print_stats (VM *vm, VM_Device *writer, VM_Device *reader)
+{
+  VM_Stats stats;
+  vm_get_stats (vm, &stats);
+
+  fprintf (stderr, "instructions %llu\n", (unsigned long long)stats.instructions);
+  fprintf (stderr, "branches_taken %llu\n", (unsigned long long)stats.branches_taken);
+  fprintf (stderr, "branches_not_taken %llu\n",
+           (unsigned long long)stats.branches_not_taken);
+  fprintf (stderr, "calls %llu\n", (unsigned long long)stats.calls);
+  fprintf (stderr, "stack_high_water %u\n", stats.stack_high_water);
+
+  VM_Device *devices[] = { &vm_device_ram, writer, reader };
+  const char *names[] = { "ram", "writer", "reader" };
+
+  for (size_t i = 0; i < VM_ARRAY_SIZE (devices); ++i)
+    {
+      uint64_t reads, stores;
+      vm_get_device_stats (vm, devices[i], &reads, &stores);
+      fprintf (stderr, "%s_reads %llu\n%s_stores %llu\n", names[i],
+               (unsigned long long)reads, names[i], (unsigned long long)stores);
+    }
+}
+
 int
 main (int argc, char **argv)
 {
-  if (argc <= 1)
+  bool stats = false;
+  const char *working_set = NULL;
+  const char *heatmap_path = NULL;
+  const char *trace_path = NULL;
+  const char *record_path = NULL;
+  const char *replay_path = NULL;
+  const char *map_path = NULL;
+  const char *disk_path = NULL;
+  bool disk_writable = false;
+  size_t nbank = 0;
+  size_t ncore = 1;
+  uint64_t interval = DEFAULT_INTERVAL;
+
+  int option;
+  while ((option = getopt (argc, argv, "sw:W:H:t:r:p:m:c:d:D:b:")) != -1)
+    switch (option)
+      {
+      case 's':
+        stats = true;
+        break;
+      case 'w':
+        working_set = optarg;
+        break;
+      case 'W':
+        interval = strtoull (optarg, NULL, 0);
+        break;
+      case 'H':
+        heatmap_path = optarg;
+        break;
+      case 't':
+        trace_path = optarg;
+        break;
+      case 'r':
+        record_path = optarg;
+        break;
+      case 'p':
+        replay_path = optarg;
+        break;
+      case 'm':
+        map_path = optarg;
+        break;
+      case 'c':
+        ncore = strtoul (optarg, NULL, 0);
+        break;
+      case 'd':
+      case 'D':
+        disk_path = optarg;
+        disk_writable = option == 'D';
+        break;
+      case 'b':
+        nbank = strtoul (optarg, NULL, 0);
+        break;
+      default:
+        optind = argc;
+        break;
+      }
+
+  if (optind >= argc)
+    {
+      fprintf (stderr, "USAGE: %s [OPTIONS] <ROM>\n", argv[0]);
+      fprintf (stderr, "    OPTIONS\n");
+      fprintf (stderr, "        -s        Print performance counters to stderr on exit\n");
+      fprintf (stderr, "        -w FILE   Write the working-set curve as CSV\n");
+      fprintf (stderr, "        -W COUNT  Instructions between working-set samples "
+                       "(default %d)\n", DEFAULT_INTERVAL);
+      fprintf (stderr, "        -H FILE   Write per-block accesses on exit, "
+                       "as PPM if FILE ends in .ppm, else CSV\n");
+      fprintf (stderr, "        -t FILE   Record an execution trace, see `vm-trace`\n");
+      fprintf (stderr, "        -r FILE   Record every device read\n");
+      fprintf (stderr, "        -p FILE   Replay recorded device reads instead of "
+                       "using the devices\n");
+      fprintf (stderr, "        -m MAP    Fault on writes to code and execution of data, "
+                       "as laid out in the source map\n");
+      fprintf (stderr, "        -c COUNT  Run COUNT cores, each on its own thread\n");
+      fprintf (stderr, "        -d FILE   Map FILE as a read-only disk at 9400\n");
+      fprintf (stderr, "        -D FILE   Map FILE as a writable disk at 9400\n");
+      fprintf (stderr, "        -b COUNT  Back a window at a000-dfff and two at e000-e1ff with "
+                       "COUNT 16 KiB banks, selected at 9500\n");
+      return 1;
+    }
+
+  if (ncore > 1 && (working_set || trace_path || record_path || replay_path))
     {
-      fprintf (stderr, "USAGE: %s <ROM>\n", argv[0]);
+      fprintf (stderr, "-c can't be combined with -w, -t, -r or -p\n");
       return 1;
     }
 
@@ -48,17 +169,146 @@ main (int argc, char **argv)
   reader.state = NULL;
 
   vm_map_device (&vm, &reader, 0x3100, 0x3200);
+  vm_map_device (&vm, &vm_device_counter, 0x9100, 0x9100);
+
+  VM_RingFile console = { .input = STDIN_FILENO, .output = STDOUT_FILENO };
+  VM_Ring ring;
+
+  if (!vm_ring_create (&ring, &vm, vm_ring_file_transfer, &console))
+    return 1;
+
+  vm_map_device (&vm, &ring.device, 0x9300, 0x9300);
+
+  VM_Disk disk = {0};
+
+  if (disk_path)
+    {
+      if (!vm_disk_create (&disk, disk_path, disk_writable))
+        return 1;
+      vm_map_device (&vm, &disk.device, 0x9400, 0x9400);
+    }
+
+  VM_Banks banks = {0};
+
+  if (nbank)
+    {
+      if (!vm_banks_create (&banks, nbank * VM_BANK_CHUNK_SIZE)
+          || !vm_banks_add_window (&banks, &vm, 0xA000, VM_BANK_WINDOW_LARGE)
+          || !vm_banks_add_window (&banks, &vm, 0xE000, VM_BANK_WINDOW_SMALL)
+          || !vm_banks_add_window (&banks, &vm, 0xE100, VM_BANK_WINDOW_SMALL))
+        return 1;
+      vm_map_device (&vm, &banks.control, 0x9500, 0x9500);
+    }
+
+  if (!vm_load_file (&vm, argv[optind]))
+    return 1;
+
+  if (map_path)
+    {
+      VM_Symbols symbols;
+      if (!vm_symbols_load (&symbols, map_path))
+        return 1;
+      vm_symbols_protect (&symbols, &vm);
+      vm_symbols_destroy (&symbols);
+    }
 
-  if (!vm_load_file (&vm, argv[1]))
+  VM_Recording recording = {0};
+  VM_Replay replay = {0};
+
+  if (record_path && !vm_recording_create (&recording, &vm, record_path))
     return 1;
 
+  if (replay_path)
+    {
+      if (!vm_replay_load (&replay, replay_path))
+        return 1;
+      vm_replay_attach (&replay, &vm);
+    }
+
+  VM_Heatmap heatmap = {0};
+
+  if (working_set && !vm_heatmap_create (&heatmap, working_set, interval))
+    return 1;
+
+  VM_Trace trace = {0};
+
+  if (trace_path && !vm_trace_create (&trace, &vm, trace_path))
+    return 1;
+
+  VM_Smp smp;
+  if (!vm_smp_create (&smp, &vm, ncore))
+    return 1;
+
+  if (ncore > 1)
+    vm_smp_run (&smp, vm_find_engine ("fast"));
+
   while (!vm.halt)
     {
-      vm_step (&vm);
+      if (trace_path)
+        vm_trace_step (&trace, &vm);
+      else
+        vm_step (&vm);
+
+      if (working_set)
+        vm_heatmap_update (&heatmap, &vm);
+    }
+
+  if (trace_path && !vm_trace_destroy (&trace, &vm))
+    return 1;
+
+  if (record_path && !vm_recording_destroy (&recording, &vm))
+    return 1;
+
+  if (replay.diverged)
+    {
+      fprintf (stderr, "Replay diverged at instruction %llu\n",
+               (unsigned long long)vm.stats.instructions);
+      return 1;
     }
 
+  vm_replay_destroy (&replay);
+
+  bool ok = true;
+
+  for (size_t i = 0; i < smp.ncore; ++i)
+    if (smp.cores[i]->trap.error != VM_ERROR_NONE)
+      {
+        VM_Trap *trap = &smp.cores[i]->trap;
+        fprintf (stderr, "%s at " VM_FMT_WORD ", address " VM_FMT_WORD,
+                 vm_error_name (trap->error), trap->ip, trap->address);
+        if (smp.ncore > 1)
+          fprintf (stderr, " on core %zu\n", i);
+        else
+          fprintf (stderr, "\n");
+        ok = false;
+      }
+
+  if (stats)
+    for (size_t i = 0; i < smp.ncore; ++i)
+      {
+        if (smp.ncore > 1)
+          fprintf (stderr, "core %zu\n", i);
+        print_stats (smp.cores[i], &writer, &reader);
+      }
+
+  vm_smp_destroy (&smp);
+
+  vm_ring_destroy (&ring);
+
+  if (disk_path && !vm_disk_destroy (&disk))
+    return 1;
+
+  if (nbank)
+    vm_banks_destroy (&banks);
+
+  if (working_set)
+    vm_heatmap_destroy (&heatmap, &vm);
+
+  if (heatmap_path && !vm_heatmap_dump (&vm, heatmap_path))
+    return 1;
+
   vm_destroy (&vm);
 
-  return 0;
+  return ok ? 0 : 1;
 }
 
@@ -0,0 +1,205 @@
+#include "bank.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+
+static byte
+vm_bank_read_byte (VM *vm, VM_Device *device, word address)
+{
+  (void)vm;
+  VM_Banks *banks = device->state;
+  return banks->blocks[address / VM_DEVICE_BLOCK_SIZE][address % VM_DEVICE_BLOCK_SIZE];
+}
+
+
+static word
+vm_bank_read_word (VM *vm, VM_Device *device, word address)
+{
+  VM_Banks *banks = device->state;
+
+  // The second byte may be in another bank, or another device.
+  if (address % VM_DEVICE_BLOCK_SIZE == VM_DEVICE_BLOCK_SIZE - 1)
+    return vm_default_read_word (vm, device, address);
+
+  const byte *block = banks->blocks[address / VM_DEVICE_BLOCK_SIZE];
+  size_t offset = address % VM_DEVICE_BLOCK_SIZE;
+
+  return VM_WORD_PACK (block[offset + 1], block[offset]);
+}
+
+
+static void
+vm_bank_store_byte (VM *vm, VM_Device *device, word address, byte value)
+{
+  (void)vm;
+  VM_Banks *banks = device->state;
+  banks->blocks[address / VM_DEVICE_BLOCK_SIZE][address % VM_DEVICE_BLOCK_SIZE] = value;
+}
+
+
+static void
+vm_bank_store_word (VM *vm, VM_Device *device, word address, word value)
+{
+  VM_Banks *banks = device->state;
+
+  if (address % VM_DEVICE_BLOCK_SIZE == VM_DEVICE_BLOCK_SIZE - 1)
+    {
+      vm_default_store_word (vm, device, address, value);
+      return;
+    }
+
+  byte *block = banks->blocks[address / VM_DEVICE_BLOCK_SIZE];
+  size_t offset = address % VM_DEVICE_BLOCK_SIZE;
+
+  block[offset + 0] = VM_WORD_L (value);
+  block[offset + 1] = VM_WORD_H (value);
+}
+
+
+static word
+vm_bank_control_read_word (VM *vm, VM_Device *device, word address)
+{
+  (void)vm;
+  VM_Banks *banks = device->state;
+  size_t offset = address % VM_DEVICE_BLOCK_SIZE;
+
+  if (offset == VM_BANK_COUNT)
+    return banks->nchunk;
+
+  if (offset % 2 == 0 && offset / 2 < banks->nwindow)
+    return banks->windows[offset / 2].bank;
+
+  return 0;
+}
+
+
+// Selecting a bank past the end of the store faults, leaving the window where it was.
+static void
+vm_bank_control_store_word (VM *vm, VM_Device *device, word address, word value)
+{
+  VM_Banks *banks = device->state;
+  size_t offset = address % VM_DEVICE_BLOCK_SIZE;
+
+  if (offset % 2 == 0 && offset / 2 < banks->nwindow
+      && !vm_banks_select (banks, offset / 2, value))
+    vm_fault (vm, VM_ERROR_PROTECTION, address);
+}
+
+
+static byte
+vm_bank_control_read_byte (VM *vm, VM_Device *device, word address)
+{
+  if (address % 2)
+    return 0;
+
+  return VM_WORD_L (vm_bank_control_read_word (vm, device, address));
+}
+
+
+static void
+vm_bank_control_store_byte (VM *vm, VM_Device *device, word address, byte value)
+{
+  if (address % 2 == 0)
+    vm_bank_control_store_word (vm, device, address, value);
+}
+
+
+bool
+vm_banks_create (VM_Banks *banks, size_t size)
+{
+  memset (banks, 0, sizeof (VM_Banks));
+
+  if (size > VM_BANK_MAX_SIZE)
+    size = VM_BANK_MAX_SIZE;
+
+  banks->nchunk = (size + VM_BANK_CHUNK_SIZE - 1) / VM_BANK_CHUNK_SIZE;
+  banks->chunks = calloc (banks->nchunk, sizeof (byte *));
+
+  if (!banks->chunks)
+    {
+      perror ("Failed to allocate banks");
+      return false;
+    }
+
+  banks->device.read_byte = vm_bank_read_byte;
+  banks->device.read_word = vm_bank_read_word;
+  banks->device.store_byte = vm_bank_store_byte;
+  banks->device.store_word = vm_bank_store_word;
+  banks->device.state = banks;
+
+  banks->control.read_byte = vm_bank_control_read_byte;
+  banks->control.read_word = vm_bank_control_read_word;
+  banks->control.store_byte = vm_bank_control_store_byte;
+  banks->control.store_word = vm_bank_control_store_word;
+  banks->control.state = banks;
+
+  return true;
+}
+
+
+void
+vm_banks_destroy (VM_Banks *banks)
+{
+  for (size_t i = 0; i < banks->nchunk; ++i)
+    free (banks->chunks[i]);
+
+  free (banks->chunks);
+  memset (banks, 0, sizeof (VM_Banks));
+}
+
+
+bool
+vm_banks_add_window (VM_Banks *banks, VM *vm, word start, VM_BankWindowSize size)
+{
+  size_t length = (size_t)size * VM_DEVICE_BLOCK_SIZE;
+
+  if (banks->nwindow == VM_BANK_MAX_WINDOWS || start % VM_DEVICE_BLOCK_SIZE != 0
+      || start + length > vm->nmemory)
+    {
+      fprintf (stderr, "Can't add a bank window at " VM_FMT_WORD "\n", start);
+      return false;
+    }
+
+  banks->windows[banks->nwindow++] = (VM_BankWindow){ .start = start, .size = size };
+
+  if (!vm_banks_select (banks, banks->nwindow - 1, 0))
+    {
+      banks->nwindow--;
+      return false;
+    }
+
+  vm_map_device (vm, &banks->device, start, start + length - 1);
+
+  return true;
+}
+
+
+// Windows are at most a chunk and aligned to their size in the store, so each one selects a
+// part of a single chunk.
+bool
+vm_banks_select (VM_Banks *banks, size_t window, word bank)
+{
+  VM_BankWindow *w = &banks->windows[window];
+  size_t length = (size_t)w->size * VM_DEVICE_BLOCK_SIZE;
+  size_t offset = bank * length;
+
+  if (offset + length > banks->nchunk * VM_BANK_CHUNK_SIZE)
+    return false;
+
+  byte **chunk = &banks->chunks[offset / VM_BANK_CHUNK_SIZE];
+
+  if (!*chunk && !(*chunk = calloc (VM_BANK_CHUNK_SIZE, 1)))
+    {
+      perror ("Failed to allocate bank");
+      return false;
+    }
+
+  for (size_t i = 0; i < (size_t)w->size; ++i)
+    banks->blocks[w->start / VM_DEVICE_BLOCK_SIZE + i]
+      = *chunk + offset % VM_BANK_CHUNK_SIZE + i * VM_DEVICE_BLOCK_SIZE;
+
+  w->bank = bank;
+
+  return true;
+}
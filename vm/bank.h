@@ -0,0 +1,74 @@
+#ifndef VM_BANK_H
+#define VM_BANK_H
+
+
+#include "vm.h"
+
+
+#define VM_BANK_MAX_WINDOWS 16
+
+// The backing store is allocated this much at a time, the first time a window selects it.
+#define VM_BANK_CHUNK_SIZE 0x4000
+
+// Every 256-byte bank of the largest store is still numbered by a word.
+#define VM_BANK_MAX_SIZE (0x10000 * VM_DEVICE_BLOCK_SIZE)
+
+
+// Window sizes, in device blocks.
+typedef enum
+{
+  VM_BANK_WINDOW_SMALL = 1,
+  VM_BANK_WINDOW_LARGE = VM_BANK_CHUNK_SIZE / VM_DEVICE_BLOCK_SIZE,
+} VM_BankWindowSize;
+
+
+// Word registers, as offsets into the block the control device is mapped at.
+typedef enum
+{
+  // Bank selected by each window, numbered in units of that window's size.
+  VM_BANK_SELECT = 0x00,
+  // Size of the backing store in large banks.
+  VM_BANK_COUNT = 2 * VM_BANK_MAX_WINDOWS,
+} VM_BankRegister;
+
+
+typedef struct VM_BankWindow
+{
+  word start;
+  VM_BankWindowSize size;
+  word bank;
+} VM_BankWindow;
+
+
+// A backing store larger than the address space, seen through windows of it. Selecting a
+// bank only repoints the window's blocks at another part of the store, nothing is copied.
+//
+// The windows are mapped to `device`, the registers to `control`. Like any device the
+// selection is shared by every core of a VM.
+typedef struct VM_Banks
+{
+  VM_Device device;
+  VM_Device control;
+
+  byte **chunks;
+  size_t nchunk;
+
+  // Backing of every block mapped to `device`, by block.
+  byte *blocks[VM_DEVICE_BLOCK_COUNT];
+
+  VM_BankWindow windows[VM_BANK_MAX_WINDOWS];
+  size_t nwindow;
+} VM_Banks;
+
+
+// `size` is rounded up to whole chunks, and clamped to VM_BANK_MAX_SIZE.
+bool vm_banks_create (VM_Banks *banks, size_t size);
+void vm_banks_destroy (VM_Banks *banks);
+
+// Maps a window of `size` blocks starting at `start`, with bank 0 selected. Windows get the
+// select registers in the order they're added.
+bool vm_banks_add_window (VM_Banks *banks, VM *vm, word start, VM_BankWindowSize size);
+bool vm_banks_select (VM_Banks *banks, size_t window, word bank);
+
+
+#endif // VM_BANK_H
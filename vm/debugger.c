@@ -0,0 +1,252 @@
+#include "debugger.h"
+#include <string.h>
+
+
+static inline bool
+vm_debugger_watches (VM_Debugger *debugger, word address, bool wide, bool store)
+{
+  for (size_t i = 0; i < debugger->nwatchpoint; ++i)
+    {
+      VM_Watchpoint *watchpoint = &debugger->watchpoints[i];
+
+      if ((store || watchpoint->read)
+          && ((address >= watchpoint->start && address <= watchpoint->end)
+              || (wide && (word)(address + 1) >= watchpoint->start
+                  && (word)(address + 1) <= watchpoint->end)))
+        return true;
+    }
+
+  return false;
+}
+
+
+// Halting is the only way to leave the engine mid-block, the debugger undoes its own halt
+// afterwards.
+static void
+vm_debugger_trap (VM_Debugger *debugger, VM *vm, word address, word value, bool store)
+{
+  if (debugger->hit)
+    return;
+
+  debugger->hit = true;
+  debugger->hit_address = address;
+  debugger->hit_value = value;
+  debugger->hit_store = store;
+  debugger->hit_halted = !vm->halt;
+
+  vm->halt = true;
+}
+
+
+static void
+vm_debugger_on_read (VM_Tap *tap, VM *vm, word address, word value, bool wide)
+{
+  VM_Debugger *debugger = tap->state;
+
+  if (debugger->armed && vm_debugger_watches (debugger, address, wide, false))
+    vm_debugger_trap (debugger, vm, address, value, false);
+}
+
+
+static void
+vm_debugger_on_store (VM_Tap *tap, VM *vm, word address, word value, bool wide)
+{
+  VM_Debugger *debugger = tap->state;
+
+  if (debugger->armed && vm_debugger_watches (debugger, address, wide, true))
+    vm_debugger_trap (debugger, vm, address, value, true);
+}
+
+
+void
+vm_debugger_create (VM_Debugger *debugger, VM_History *history)
+{
+  memset (debugger, 0, sizeof (VM_Debugger));
+
+  debugger->history = history;
+
+  vm_tap_create (&debugger->tap);
+  debugger->tap.on_read = vm_debugger_on_read;
+  debugger->tap.on_store = vm_debugger_on_store;
+  debugger->tap.state = debugger;
+}
+
+
+void
+vm_debugger_destroy (VM_Debugger *debugger, VM *vm)
+{
+  vm_tap_detach (&debugger->tap, vm);
+  memset (debugger, 0, sizeof (VM_Debugger));
+}
+
+
+bool
+vm_debugger_is_breakpoint (VM_Debugger *debugger, word address)
+{
+  return debugger->breakpoints[address / 8] >> (address % 8) & 1;
+}
+
+
+bool
+vm_debugger_toggle_breakpoint (VM_Debugger *debugger, word address)
+{
+  debugger->breakpoints[address / 8] ^= 1 << (address % 8);
+  debugger->generation++;
+
+  if (!vm_debugger_is_breakpoint (debugger, address))
+    {
+      debugger->nbreakpoint--;
+      return false;
+    }
+
+  debugger->nbreakpoint++;
+  return true;
+}
+
+
+// Only the watched blocks are remapped, everything else keeps its device.
+bool
+vm_debugger_toggle_watchpoint (VM_Debugger *debugger, VM *vm, word start, word end,
+                               bool read)
+{
+  size_t index = debugger->nwatchpoint;
+
+  for (size_t i = 0; i < debugger->nwatchpoint; ++i)
+    if (debugger->watchpoints[i].start == start && debugger->watchpoints[i].end == end)
+      index = i;
+
+  if (index < debugger->nwatchpoint)
+    debugger->watchpoints[index] = debugger->watchpoints[--debugger->nwatchpoint];
+  else if (debugger->nwatchpoint == VM_DEBUGGER_MAX_WATCHPOINTS)
+    return false;
+  else
+    debugger->watchpoints[debugger->nwatchpoint++] = (VM_Watchpoint){ start, end, read };
+
+  vm_tap_detach (&debugger->tap, vm);
+
+  for (size_t i = 0; i < debugger->nwatchpoint; ++i)
+    vm_tap_attach (&debugger->tap, vm, debugger->watchpoints[i].start,
+                   debugger->watchpoints[i].end);
+
+  return true;
+}
+
+
+// Decodes the block from `start` up to the operation that ends it.
+static bool
+vm_debugger_block_has_breakpoint (VM_Debugger *debugger, VM *vm, word start)
+{
+  word address = start;
+
+  for (size_t i = 0; i < VM_DEBUGGER_MAX_BLOCK; ++i)
+    {
+      if (vm_debugger_is_breakpoint (debugger, address))
+        return true;
+
+      VM_Operation operation = vm_peek_byte (vm, address);
+
+      if (operation >= VM_OPERATION_COUNT || vm_operation_ends_block (operation))
+        return false;
+
+      address += vm_operation_size (operation);
+    }
+
+  return true;
+}
+
+
+static inline bool
+vm_debugger_lookup (VM_Debugger *debugger, VM *vm, word start)
+{
+  if (debugger->nbreakpoint == 0)
+    return false;
+
+  VM_DebuggerBlock *block = &debugger->cache[start % VM_DEBUGGER_CACHE_SIZE];
+
+  if (!block->valid || block->start != start || block->generation != debugger->generation)
+    {
+      block->start = start;
+      block->valid = true;
+      block->generation = debugger->generation;
+      block->breakpoint = vm_debugger_block_has_breakpoint (debugger, vm, start);
+    }
+
+  return block->breakpoint;
+}
+
+
+static inline VM_DebuggerStop
+vm_debugger_settle (VM_Debugger *debugger, VM *vm)
+{
+  debugger->armed = false;
+
+  // A fault in the same operation keeps the VM halted, with its trap.
+  if (debugger->hit && debugger->hit_halted && vm->trap.error == VM_ERROR_NONE)
+    vm->halt = false;
+
+  if (vm->halt)
+    return VM_DEBUGGER_STOP_HALT;
+
+  return debugger->hit ? VM_DEBUGGER_STOP_WATCHPOINT : VM_DEBUGGER_STOP_NONE;
+}
+
+
+VM_DebuggerStop
+vm_debugger_step (VM_Debugger *debugger, VM *vm)
+{
+  debugger->armed = true;
+  debugger->hit = false;
+
+  if (debugger->history)
+    vm_history_step (debugger->history, vm);
+  else
+    vm_step (vm);
+
+  VM_DebuggerStop stop = vm_debugger_settle (debugger, vm);
+
+  if (stop == VM_DEBUGGER_STOP_NONE && vm_debugger_is_breakpoint (debugger, *vm->ip))
+    return VM_DEBUGGER_STOP_BREAKPOINT;
+
+  return stop;
+}
+
+
+VM_DebuggerStop
+vm_debugger_continue (VM_Debugger *debugger, VM *vm, const VM_Engine *engine,
+                      uint64_t budget)
+{
+  debugger->armed = true;
+  debugger->hit = false;
+
+  uint64_t end = vm->stats.instructions + budget;
+
+  if (end < budget)
+    end = UINT64_MAX;
+
+  for (bool first = true; !vm->halt && vm->stats.instructions < end; first = false)
+    {
+      word ip = *vm->ip;
+
+      if (!first && vm_debugger_is_breakpoint (debugger, ip))
+        {
+          debugger->armed = false;
+          return VM_DEBUGGER_STOP_BREAKPOINT;
+        }
+
+      // A block with a breakpoint inside is stepped up to it, the rest of it then decodes
+      // as a shorter block without one.
+      if (vm_debugger_lookup (debugger, vm, ip))
+        {
+          if (debugger->history)
+            vm_history_step (debugger->history, vm);
+          else
+            vm_step (vm);
+        }
+      else if (debugger->history)
+        vm_history_run_block (debugger->history, vm, engine);
+      else
+        engine->run_block (vm);
+    }
+
+  return vm_debugger_settle (debugger, vm);
+}
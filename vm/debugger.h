@@ -0,0 +1,98 @@
+#ifndef VM_DEBUGGER_H
+#define VM_DEBUGGER_H
+
+
+#include "history.h"
+#include "tap.h"
+#include "vm.h"
+
+
+#define VM_DEBUGGER_CACHE_SIZE 1024
+#define VM_DEBUGGER_MAX_WATCHPOINTS 16
+
+// Blocks longer than this aren't decoded to the end, they're single stepped when any
+// breakpoint is set.
+#define VM_DEBUGGER_MAX_BLOCK 256
+
+
+typedef enum VM_DebuggerStop
+{
+  VM_DEBUGGER_STOP_NONE,
+  VM_DEBUGGER_STOP_HALT,
+  VM_DEBUGGER_STOP_BREAKPOINT,
+  VM_DEBUGGER_STOP_WATCHPOINT,
+} VM_DebuggerStop;
+
+
+// Whether a decoded block starting at `start` contains a breakpoint, valid while the
+// breakpoint table is at the same generation.
+typedef struct VM_DebuggerBlock
+{
+  word start;
+  bool valid;
+  bool breakpoint;
+  uint32_t generation;
+} VM_DebuggerBlock;
+
+
+typedef struct VM_Watchpoint
+{
+  word start;
+  word end;
+  bool read;
+} VM_Watchpoint;
+
+
+// Breakpoints are only checked between decoded blocks, a block with one inside is single
+// stepped. Watchpoints remap the watched blocks to a trapping tap, which halts the VM right
+// after the access. Between events, blocks run on the engine with no per-operation checks.
+// A halt or fault around the hit is reported as a halt, `hit` still telling the watchpoint.
+//
+// Blocks are decoded from memory once per breakpoint table generation, a breakpoint in code
+// that was rewritten since may be missed.
+typedef struct VM_Debugger
+{
+  byte breakpoints[0x10000 / 8];
+  size_t nbreakpoint;
+  uint32_t generation;
+  VM_DebuggerBlock cache[VM_DEBUGGER_CACHE_SIZE];
+
+  VM_Tap tap;
+  VM_Watchpoint watchpoints[VM_DEBUGGER_MAX_WATCHPOINTS];
+  size_t nwatchpoint;
+
+  // Watchpoints only trap while the debugger runs the VM, not while history re-executes.
+  bool armed;
+  bool hit;
+  // Whether the hit halted the VM, which is then the debugger's to undo.
+  bool hit_halted;
+  word hit_address;
+  word hit_value;
+  bool hit_store;
+
+  VM_History *history;
+} VM_Debugger;
+
+
+// Steps go through `history` when there is one, it must be created before the debugger.
+void vm_debugger_create (VM_Debugger *debugger, VM_History *history);
+void vm_debugger_destroy (VM_Debugger *debugger, VM *vm);
+
+bool vm_debugger_is_breakpoint (VM_Debugger *debugger, word address);
+
+// Toggles the breakpoint, returns whether it is now set.
+bool vm_debugger_toggle_breakpoint (VM_Debugger *debugger, word address);
+
+// Toggles a watchpoint on stores, or on any access with `read`, to [start, end]. Returns
+// false when the table is full.
+bool vm_debugger_toggle_watchpoint (VM_Debugger *debugger, VM *vm, word start, word end,
+                                    bool read);
+
+// Both return why they stopped, a breakpoint under IP is left before it's checked.
+// Continuing also stops between blocks once `budget` operations ran, with nothing to report.
+VM_DebuggerStop vm_debugger_step (VM_Debugger *debugger, VM *vm);
+VM_DebuggerStop vm_debugger_continue (VM_Debugger *debugger, VM *vm,
+                                      const VM_Engine *engine, uint64_t budget);
+
+
+#endif // VM_DEBUGGER_H
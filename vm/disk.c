@@ -0,0 +1,241 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include "disk.h"
+#include "tap.h"
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+
+static uint32_t
+vm_disk_sectors (VM_Disk *disk)
+{
+  return (disk->size + VM_DISK_SECTOR_SIZE - 1) / VM_DISK_SECTOR_SIZE;
+}
+
+
+// Asks the kernel to page in the sectors following a sequential read, while the guest works on
+// the ones it just got.
+static void
+vm_disk_read_ahead (VM_Disk *disk, size_t offset)
+{
+  size_t page = sysconf (_SC_PAGESIZE);
+  size_t start = offset / page * page;
+  size_t end = offset + VM_DISK_READ_AHEAD * VM_DISK_SECTOR_SIZE;
+
+  if (end > disk->size)
+    end = disk->size;
+
+  if (start < end)
+    posix_madvise (disk->data + start, end - start, POSIX_MADV_WILLNEED);
+}
+
+
+static void
+vm_disk_transfer (VM *vm, VM_Disk *disk, bool store)
+{
+  uint32_t sectors = vm_disk_sectors (disk);
+  size_t count = disk->count;
+
+  disk->done = 0;
+
+  if (disk->sector >= sectors || (store && !disk->writable))
+    return;
+
+  if (count > sectors - disk->sector)
+    count = sectors - disk->sector;
+
+  if (count == 0)
+    return;
+
+  size_t length = count * VM_DISK_SECTOR_SIZE;
+  size_t first = disk->address / VM_DEVICE_BLOCK_SIZE;
+  size_t last = (disk->address + length - 1) / VM_DEVICE_BLOCK_SIZE;
+  byte protection = store ? VM_PROTECTION_READ : VM_PROTECTION_WRITE;
+
+  for (size_t i = first; i <= last; ++i)
+    if (i >= vm->ndevice || !vm_block_is_ram (vm, i)
+        || !(vm->protection[i] & protection))
+      {
+        vm_fault (vm, VM_ERROR_PROTECTION,
+                  i == first ? disk->address : (word)(i * VM_DEVICE_BLOCK_SIZE));
+        return;
+      }
+
+  size_t offset = (size_t)disk->sector * VM_DISK_SECTOR_SIZE;
+  size_t n = length < disk->size - offset ? length : disk->size - offset;
+  byte *memory = &vm->memory[disk->address];
+
+  if (store)
+    memcpy (disk->data + offset, memory, n);
+  else
+    {
+      memcpy (memory, disk->data + offset, n);
+      memset (memory + n, 0, length - n);
+
+      if (disk->sector == disk->end)
+        vm_disk_read_ahead (disk, offset + length);
+
+      disk->end = disk->sector + count;
+    }
+
+  for (size_t i = first; i <= last; ++i)
+    if (store)
+      vm->stats.reads[i]++;
+    else
+      vm->stats.stores[i]++;
+
+  disk->sector += count;
+  disk->done = count;
+}
+
+
+static word
+vm_disk_read_word (VM *vm, VM_Device *device, word address)
+{
+  (void)vm;
+  VM_Disk *disk = device->state;
+
+  switch (address % VM_DEVICE_BLOCK_SIZE)
+    {
+    case VM_DISK_SECTOR_L:
+      return disk->sector;
+    case VM_DISK_SECTOR_H:
+      return disk->sector >> 16;
+    case VM_DISK_ADDRESS:
+      return disk->address;
+    case VM_DISK_COUNT:
+      return disk->count;
+    case VM_DISK_DONE:
+      return disk->done;
+    case VM_DISK_SECTORS_L:
+      return vm_disk_sectors (disk);
+    case VM_DISK_SECTORS_H:
+      return vm_disk_sectors (disk) >> 16;
+    default:
+      return 0;
+    }
+}
+
+
+static void
+vm_disk_store_word (VM *vm, VM_Device *device, word address, word value)
+{
+  VM_Disk *disk = device->state;
+
+  switch (address % VM_DEVICE_BLOCK_SIZE)
+    {
+    case VM_DISK_SECTOR_L:
+      disk->sector = (disk->sector & 0xFFFF0000) | value;
+      break;
+    case VM_DISK_SECTOR_H:
+      disk->sector = (disk->sector & 0xFFFF) | (uint32_t)value << 16;
+      break;
+    case VM_DISK_ADDRESS:
+      disk->address = value;
+      break;
+    case VM_DISK_COUNT:
+      disk->count = value;
+      break;
+    case VM_DISK_READ:
+      vm_disk_transfer (vm, disk, false);
+      break;
+    case VM_DISK_WRITE:
+      vm_disk_transfer (vm, disk, true);
+      break;
+    }
+}
+
+
+static byte
+vm_disk_read_byte (VM *vm, VM_Device *device, word address)
+{
+  if (address % 2)
+    return 0;
+
+  return VM_WORD_L (vm_disk_read_word (vm, device, address));
+}
+
+
+static void
+vm_disk_store_byte (VM *vm, VM_Device *device, word address, byte value)
+{
+  if (address % 2 == 0)
+    vm_disk_store_word (vm, device, address, value);
+}
+
+
+bool
+vm_disk_create (VM_Disk *disk, const char *path, bool writable)
+{
+  memset (disk, 0, sizeof (VM_Disk));
+
+  disk->fd = open (path, writable ? O_RDWR : O_RDONLY);
+
+  if (disk->fd < 0)
+    {
+      perror ("Failed to open disk");
+      return false;
+    }
+
+  struct stat st;
+
+  if (fstat (disk->fd, &st) != 0)
+    {
+      perror ("Failed to stat disk");
+      close (disk->fd);
+      return false;
+    }
+
+  disk->size = st.st_size;
+  disk->writable = writable;
+
+  if (disk->size > 0)
+    {
+      disk->data = mmap (NULL, disk->size, PROT_READ | (writable ? PROT_WRITE : 0), MAP_SHARED,
+                         disk->fd, 0);
+
+      if (disk->data == MAP_FAILED)
+        {
+          perror ("Failed to map disk");
+          close (disk->fd);
+          return false;
+        }
+
+      posix_madvise (disk->data, disk->size, POSIX_MADV_SEQUENTIAL);
+    }
+
+  disk->device.read_byte = vm_disk_read_byte;
+  disk->device.read_word = vm_disk_read_word;
+  disk->device.store_byte = vm_disk_store_byte;
+  disk->device.store_word = vm_disk_store_word;
+  disk->device.state = disk;
+
+  return true;
+}
+
+
+bool
+vm_disk_destroy (VM_Disk *disk)
+{
+  bool ok = true;
+
+  if (disk->data)
+    {
+      if (disk->writable && msync (disk->data, disk->size, MS_SYNC) != 0)
+        {
+          perror ("Failed to write disk");
+          ok = false;
+        }
+
+      munmap (disk->data, disk->size);
+    }
+
+  close (disk->fd);
+  memset (disk, 0, sizeof (VM_Disk));
+
+  return ok;
+}
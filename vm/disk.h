@@ -0,0 +1,62 @@
+#ifndef VM_DISK_H
+#define VM_DISK_H
+
+
+#include "vm.h"
+
+
+// Sectors are the size of a device block, so a transfer never splits one across devices.
+#define VM_DISK_SECTOR_SIZE VM_DEVICE_BLOCK_SIZE
+
+// Sectors past a sequential read that the kernel is asked to start reading in.
+#define VM_DISK_READ_AHEAD 64
+
+
+// Word registers, as offsets into the block the disk is mapped at.
+typedef enum
+{
+  // Sector of the next transfer, 32 bits wide. Every transfer advances it.
+  VM_DISK_SECTOR_L = 0x00,
+  VM_DISK_SECTOR_H = 0x02,
+  // Guest address of the first sector's buffer.
+  VM_DISK_ADDRESS = 0x04,
+  // Sectors per transfer.
+  VM_DISK_COUNT = 0x06,
+  // Stores copy COUNT sectors from the disk to memory, or from memory to the disk.
+  VM_DISK_READ = 0x08,
+  VM_DISK_WRITE = 0x0A,
+  // Sectors moved by the last transfer.
+  VM_DISK_DONE = 0x0C,
+  // Size of the disk in sectors, the last one padded with zeroes.
+  VM_DISK_SECTORS_L = 0x0E,
+  VM_DISK_SECTORS_H = 0x10,
+} VM_DiskRegister;
+
+
+// A host file mapped into the host's address space, moved into guest RAM a sector at a time
+// with `memcpy`. Transfers stop at the end of the disk, and fault without copying anything if
+// the buffer isn't RAM with the needed rights.
+typedef struct VM_Disk
+{
+  VM_Device device;
+
+  int fd;
+  byte *data;
+  size_t size;
+  bool writable;
+
+  uint32_t sector;
+  word address;
+  word count;
+  word done;
+
+  // Where the last read ended, a read starting there is sequential.
+  uint32_t end;
+} VM_Disk;
+
+
+bool vm_disk_create (VM_Disk *disk, const char *path, bool writable);
+bool vm_disk_destroy (VM_Disk *disk);
+
+
+#endif // VM_DISK_H
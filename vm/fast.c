@@ -0,0 +1,19 @@
+#include "vm.h"
+#include "simd.h"
+
+
+// Accesses that miss RAM go through the device callbacks, like the reference engine's.
+#define VM_FAST_FUNCTION static inline
+#define VM_FAST_DEVICE_READ_BYTE vm_read_byte
+#define VM_FAST_DEVICE_READ_WORD vm_read_word
+#define VM_FAST_DEVICE_STORE_BYTE vm_store_byte
+#define VM_FAST_DEVICE_STORE_WORD vm_store_word
+
+#include "fast.h"
+
+
+size_t
+vm_fast_run_block (VM *vm)
+{
+  return vm_fast_engine (vm);
+}
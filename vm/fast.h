@@ -0,0 +1,1126 @@
+// The fast engine, included by `fast.c` and by `vm.hpp`. The includer defines:
+//   VM_FAST_FUNCTION            the specifiers of every function defined here
+//   VM_FAST_DEVICE_READ_BYTE    the accesses that don't short-circuit to RAM, with the
+//   VM_FAST_DEVICE_READ_WORD    signatures of `vm_read_byte` and so on
+//   VM_FAST_DEVICE_STORE_BYTE
+//   VM_FAST_DEVICE_STORE_WORD
+// and gets `vm_fast_engine`, a `VM_Engine.run_block`. Every macro is undefined at the end, so
+// this has no include guard.
+
+
+// The largest operation is an opcode followed by two 16-bit operands, e.g. MOV_IM_IM or ADD_I.
+#define VM_FAST_MAX_SIZE 5
+
+#define VM_FAST_REGISTER(offset) vm_fast_register (vm, code, ip, offset)
+#define VM_FAST_DEST(offset) (&vm->registers[code[offset]])
+#define VM_FAST_WORD(offset) VM_WORD_PACK (code[(offset) + 1], code[offset])
+
+// The registers of a v2 register pair, high nibble first.
+#define VM_FAST_HIGH(offset) vm_fast_packed (vm, ip, code[offset] >> 4, offset)
+#define VM_FAST_LOW(offset) vm_fast_packed (vm, ip, code[offset] & 0xF, offset)
+#define VM_FAST_HIGH_DEST(offset) (&vm->registers[code[offset] >> 4])
+
+// Operands are decoded in place, so IP moves past the whole operation before it executes.
+#define VM_FAST_ADVANCE(size) (*vm->ip = ip + (size))
+
+
+VM_FAST_FUNCTION bool
+vm_fast_ram (VM *vm, word address)
+{
+  return vm->devices[address / VM_DEVICE_BLOCK_SIZE] == &vm_device_ram;
+}
+
+
+// Data accesses short-circuit to RAM only when they are allowed, faults are raised by the
+// reference path.
+VM_FAST_FUNCTION bool
+vm_fast_allows (VM *vm, word address, byte protection)
+{
+  return vm_fast_ram (vm, address)
+         && (vm->protection[address / VM_DEVICE_BLOCK_SIZE] & protection);
+}
+
+
+// Operations are decoded straight from memory when every byte they could span is plain RAM,
+// anything else goes through the devices like the reference engine.
+VM_FAST_FUNCTION bool
+vm_fast_fetchable (VM *vm, word ip)
+{
+  return ip <= vm->nmemory - VM_FAST_MAX_SIZE && vm_fast_ram (vm, ip)
+         && vm_fast_ram (vm, ip + VM_FAST_MAX_SIZE - 1);
+}
+
+
+// Reading IP as an operand observes it mid-fetch, right past the register byte, exactly like
+// `vm_next_register_value` does.
+VM_FAST_FUNCTION word
+vm_fast_register (VM *vm, const byte *code, word ip, word offset)
+{
+  byte index = code[offset];
+  return index == VM_REGISTER_IP ? (word)(ip + offset + 1) : vm->registers[index];
+}
+
+
+VM_FAST_FUNCTION word
+vm_fast_packed (VM *vm, word ip, byte index, word offset)
+{
+  return index == VM_REGISTER_IP ? (word)(ip + offset + 1) : vm->registers[index];
+}
+
+
+// Operations naming a register past the last one are left to the reference decoder, which
+// faults.
+VM_FAST_FUNCTION bool
+vm_fast_pair_valid (const byte *code, word offset)
+{
+  return code[offset] >> 4 < VM_REGISTER_COUNT && (code[offset] & 0xF) < VM_REGISTER_COUNT;
+}
+
+
+VM_FAST_FUNCTION byte
+vm_fast_read_byte (VM *vm, word address)
+{
+  if (!vm_fast_allows (vm, address, VM_PROTECTION_READ))
+    return VM_FAST_DEVICE_READ_BYTE (vm, address);
+
+  vm->stats.reads[address / VM_DEVICE_BLOCK_SIZE]++;
+  return vm->memory[address];
+}
+
+
+VM_FAST_FUNCTION word
+vm_fast_read_word (VM *vm, word address)
+{
+  if ((address & 0xFF) == 0xFF || !vm_fast_allows (vm, address, VM_PROTECTION_READ))
+    return VM_FAST_DEVICE_READ_WORD (vm, address);
+
+  vm->stats.reads[address / VM_DEVICE_BLOCK_SIZE]++;
+  return VM_WORD_PACK (vm->memory[address + 1], vm->memory[address]);
+}
+
+
+VM_FAST_FUNCTION void
+vm_fast_store_byte (VM *vm, word address, byte value)
+{
+  if (!vm_fast_allows (vm, address, VM_PROTECTION_WRITE))
+    {
+      VM_FAST_DEVICE_STORE_BYTE (vm, address, value);
+      return;
+    }
+
+  vm->stats.stores[address / VM_DEVICE_BLOCK_SIZE]++;
+  vm->memory[address] = value;
+}
+
+
+VM_FAST_FUNCTION void
+vm_fast_store_word (VM *vm, word address, word value)
+{
+  if ((address & 0xFF) == 0xFF || !vm_fast_allows (vm, address, VM_PROTECTION_WRITE))
+    {
+      VM_FAST_DEVICE_STORE_WORD (vm, address, value);
+      return;
+    }
+
+  vm->stats.stores[address / VM_DEVICE_BLOCK_SIZE]++;
+  vm->memory[address + 0] = VM_WORD_L (value);
+  vm->memory[address + 1] = VM_WORD_H (value);
+}
+
+
+// Vectors within one block of RAM are accessed at once, counted like the byte accesses the
+// reference path makes.
+VM_FAST_FUNCTION uint64_t
+vm_fast_read_vector (VM *vm, word address)
+{
+  uint64_t value = 0;
+
+  if ((address & 0xFF) > VM_DEVICE_BLOCK_SIZE - VM_VECTOR_LANES
+      || !vm_fast_allows (vm, address, VM_PROTECTION_READ))
+    {
+      for (int i = 0; i < VM_VECTOR_LANES; ++i)
+        value |= (uint64_t)vm_fast_read_byte (vm, address + i) << i * 8;
+      return value;
+    }
+
+  vm->stats.reads[address / VM_DEVICE_BLOCK_SIZE] += VM_VECTOR_LANES;
+
+  for (int i = 0; i < VM_VECTOR_LANES; ++i)
+    value |= (uint64_t)vm->memory[address + i] << i * 8;
+
+  return value;
+}
+
+
+VM_FAST_FUNCTION void
+vm_fast_store_vector (VM *vm, word address, uint64_t value)
+{
+  if ((address & 0xFF) > VM_DEVICE_BLOCK_SIZE - VM_VECTOR_LANES
+      || !vm_fast_allows (vm, address, VM_PROTECTION_WRITE))
+    {
+      for (int i = 0; i < VM_VECTOR_LANES; ++i)
+        vm_fast_store_byte (vm, address + i, value >> i * 8);
+      return;
+    }
+
+  vm->stats.stores[address / VM_DEVICE_BLOCK_SIZE] += VM_VECTOR_LANES;
+
+  for (int i = 0; i < VM_VECTOR_LANES; ++i)
+    vm->memory[address + i] = value >> i * 8;
+}
+
+
+VM_FAST_FUNCTION void
+vm_fast_push_word (VM *vm, word value)
+{
+  vm_fast_store_word (vm, *vm->sp, value);
+  *vm->sp -= sizeof (word);
+
+  if (*vm->sp < vm->stack && vm->stack - *vm->sp > vm->stats.stack_high_water)
+    vm->stats.stack_high_water = vm->stack - *vm->sp;
+}
+
+
+VM_FAST_FUNCTION word
+vm_fast_pop_word (VM *vm)
+{
+  *vm->sp += sizeof (word);
+  return vm_fast_read_word (vm, *vm->sp);
+}
+
+
+// Leaves the operation at IP to the reference decoder.
+VM_FAST_FUNCTION void
+vm_fast_defer (VM *vm)
+{
+  vm_execute (vm, (VM_Operation)vm_next_byte (vm));
+}
+
+
+// Same semantics as `vm_run_block`, but decodes operands directly from RAM and short-circuits
+// data accesses to RAM, instead of going through a device callback for every byte.
+VM_FAST_FUNCTION size_t
+vm_fast_engine (VM *vm)
+{
+  size_t n = 0;
+
+  while (!vm->halt)
+    {
+      word ip = *vm->ip;
+
+      if (!(vm->protection[ip / VM_DEVICE_BLOCK_SIZE] & VM_PROTECTION_EXECUTE))
+        {
+          vm_fetch_fault (vm, ip);
+          continue;
+        }
+
+      vm->stats.instructions++;
+      vm->stats.executes[ip / VM_DEVICE_BLOCK_SIZE]++;
+
+      if (!vm_fast_fetchable (vm, ip))
+        {
+          VM_Operation operation = (VM_Operation)vm_next_byte (vm);
+          vm_execute (vm, operation);
+          n++;
+
+          if (vm->halt)
+            vm_trap (vm, ip);
+
+          if (vm_operation_ends_block (operation))
+            break;
+          continue;
+        }
+
+      const byte *code = &vm->memory[ip];
+      VM_Operation operation = (VM_Operation)code[0];
+      n++;
+
+      switch (operation)
+        {
+        case VM_OPERATION_NOP:
+          VM_FAST_ADVANCE (1);
+          break;
+        case VM_OPERATION_MOV_R_I:
+          {
+            if (code[1] >= VM_REGISTER_COUNT)
+              {
+                vm_fast_defer (vm);
+                break;
+              }
+
+            VM_FAST_ADVANCE (4);
+            *VM_FAST_DEST (1) = VM_FAST_WORD (2);
+          }
+          break;
+        case VM_OPERATION_MOV_R_R:
+          {
+            if (code[1] >= VM_REGISTER_COUNT || code[2] >= VM_REGISTER_COUNT)
+              {
+                vm_fast_defer (vm);
+                break;
+              }
+
+            VM_FAST_ADVANCE (3);
+            *VM_FAST_DEST (1) = VM_FAST_REGISTER (2);
+          }
+          break;
+        case VM_OPERATION_MOV_R_IM:
+          {
+            if (code[1] >= VM_REGISTER_COUNT)
+              {
+                vm_fast_defer (vm);
+                break;
+              }
+
+            VM_FAST_ADVANCE (4);
+            *VM_FAST_DEST (1) = vm_fast_read_word (vm, VM_FAST_WORD (2));
+          }
+          break;
+        case VM_OPERATION_MOV_R_RM:
+          {
+            if (code[1] >= VM_REGISTER_COUNT || code[2] >= VM_REGISTER_COUNT)
+              {
+                vm_fast_defer (vm);
+                break;
+              }
+
+            VM_FAST_ADVANCE (3);
+            word address = VM_FAST_REGISTER (2);
+            *VM_FAST_DEST (1) = vm_fast_read_word (vm, address);
+          }
+          break;
+        case VM_OPERATION_MOV_IM_I:
+          {
+            VM_FAST_ADVANCE (5);
+            vm_fast_store_word (vm, VM_FAST_WORD (1), VM_FAST_WORD (3));
+          }
+          break;
+        case VM_OPERATION_MOV_IM_R:
+          {
+            if (code[3] >= VM_REGISTER_COUNT)
+              {
+                vm_fast_defer (vm);
+                break;
+              }
+
+            VM_FAST_ADVANCE (4);
+            vm_fast_store_word (vm, VM_FAST_WORD (1), VM_FAST_REGISTER (3));
+          }
+          break;
+        case VM_OPERATION_MOV_IM_IM:
+          {
+            VM_FAST_ADVANCE (5);
+            word value = vm_fast_read_word (vm, VM_FAST_WORD (3));
+            vm_fast_store_word (vm, VM_FAST_WORD (1), value);
+          }
+          break;
+        case VM_OPERATION_MOV_IM_RM:
+          {
+            if (code[3] >= VM_REGISTER_COUNT)
+              {
+                vm_fast_defer (vm);
+                break;
+              }
+
+            VM_FAST_ADVANCE (4);
+            word value = vm_fast_read_word (vm, VM_FAST_REGISTER (3));
+            vm_fast_store_word (vm, VM_FAST_WORD (1), value);
+          }
+          break;
+        case VM_OPERATION_MOV_RM_I:
+          {
+            if (code[1] >= VM_REGISTER_COUNT)
+              {
+                vm_fast_defer (vm);
+                break;
+              }
+
+            VM_FAST_ADVANCE (4);
+            vm_fast_store_word (vm, VM_FAST_REGISTER (1), VM_FAST_WORD (2));
+          }
+          break;
+        case VM_OPERATION_MOV_RM_R:
+          {
+            if (code[1] >= VM_REGISTER_COUNT || code[2] >= VM_REGISTER_COUNT)
+              {
+                vm_fast_defer (vm);
+                break;
+              }
+
+            VM_FAST_ADVANCE (3);
+            vm_fast_store_word (vm, VM_FAST_REGISTER (1), VM_FAST_REGISTER (2));
+          }
+          break;
+        case VM_OPERATION_MOV_RM_IM:
+          {
+            if (code[1] >= VM_REGISTER_COUNT)
+              {
+                vm_fast_defer (vm);
+                break;
+              }
+
+            VM_FAST_ADVANCE (4);
+            word dest = VM_FAST_REGISTER (1);
+            word value = vm_fast_read_word (vm, VM_FAST_WORD (2));
+            vm_fast_store_word (vm, dest, value);
+          }
+          break;
+        case VM_OPERATION_MOV_RM_RM:
+          {
+            if (code[1] >= VM_REGISTER_COUNT || code[2] >= VM_REGISTER_COUNT)
+              {
+                vm_fast_defer (vm);
+                break;
+              }
+
+            VM_FAST_ADVANCE (3);
+            word dest = VM_FAST_REGISTER (1);
+            word value = vm_fast_read_word (vm, VM_FAST_REGISTER (2));
+            vm_fast_store_word (vm, dest, value);
+          }
+          break;
+        case VM_OPERATION_MOVB_R_I:
+          {
+            if (code[1] >= VM_REGISTER_COUNT)
+              {
+                vm_fast_defer (vm);
+                break;
+              }
+
+            VM_FAST_ADVANCE (3);
+            *VM_FAST_DEST (1) = code[2];
+          }
+          break;
+        case VM_OPERATION_MOVB_R_R:
+          {
+            if (code[1] >= VM_REGISTER_COUNT || code[2] >= VM_REGISTER_COUNT)
+              {
+                vm_fast_defer (vm);
+                break;
+              }
+
+            VM_FAST_ADVANCE (3);
+            *VM_FAST_DEST (1) = (byte)VM_FAST_REGISTER (2);
+          }
+          break;
+        case VM_OPERATION_MOVB_R_IM:
+          {
+            if (code[1] >= VM_REGISTER_COUNT)
+              {
+                vm_fast_defer (vm);
+                break;
+              }
+
+            VM_FAST_ADVANCE (4);
+            *VM_FAST_DEST (1) = vm_fast_read_byte (vm, VM_FAST_WORD (2));
+          }
+          break;
+        case VM_OPERATION_MOVB_R_RM:
+          {
+            if (code[1] >= VM_REGISTER_COUNT || code[2] >= VM_REGISTER_COUNT)
+              {
+                vm_fast_defer (vm);
+                break;
+              }
+
+            VM_FAST_ADVANCE (3);
+            word address = VM_FAST_REGISTER (2);
+            *VM_FAST_DEST (1) = vm_fast_read_byte (vm, address);
+          }
+          break;
+        case VM_OPERATION_MOVB_IM_I:
+          {
+            VM_FAST_ADVANCE (4);
+            vm_fast_store_byte (vm, VM_FAST_WORD (1), code[3]);
+          }
+          break;
+        case VM_OPERATION_MOVB_IM_R:
+          {
+            if (code[3] >= VM_REGISTER_COUNT)
+              {
+                vm_fast_defer (vm);
+                break;
+              }
+
+            VM_FAST_ADVANCE (4);
+            vm_fast_store_byte (vm, VM_FAST_WORD (1), VM_FAST_REGISTER (3));
+          }
+          break;
+        case VM_OPERATION_MOVB_IM_IM:
+          {
+            VM_FAST_ADVANCE (5);
+            byte value = vm_fast_read_byte (vm, VM_FAST_WORD (3));
+            vm_fast_store_byte (vm, VM_FAST_WORD (1), value);
+          }
+          break;
+        case VM_OPERATION_MOVB_IM_RM:
+          {
+            if (code[3] >= VM_REGISTER_COUNT)
+              {
+                vm_fast_defer (vm);
+                break;
+              }
+
+            VM_FAST_ADVANCE (4);
+            byte value = vm_fast_read_byte (vm, VM_FAST_REGISTER (3));
+            vm_fast_store_byte (vm, VM_FAST_WORD (1), value);
+          }
+          break;
+        case VM_OPERATION_MOVB_RM_I:
+          {
+            if (code[1] >= VM_REGISTER_COUNT)
+              {
+                vm_fast_defer (vm);
+                break;
+              }
+
+            VM_FAST_ADVANCE (3);
+            vm_fast_store_byte (vm, VM_FAST_REGISTER (1), code[2]);
+          }
+          break;
+        case VM_OPERATION_MOVB_RM_R:
+          {
+            if (code[1] >= VM_REGISTER_COUNT || code[2] >= VM_REGISTER_COUNT)
+              {
+                vm_fast_defer (vm);
+                break;
+              }
+
+            VM_FAST_ADVANCE (3);
+            vm_fast_store_byte (vm, VM_FAST_REGISTER (1), VM_FAST_REGISTER (2));
+          }
+          break;
+        case VM_OPERATION_MOVB_RM_IM:
+          {
+            if (code[1] >= VM_REGISTER_COUNT)
+              {
+                vm_fast_defer (vm);
+                break;
+              }
+
+            VM_FAST_ADVANCE (4);
+            word dest = VM_FAST_REGISTER (1);
+            byte value = vm_fast_read_byte (vm, VM_FAST_WORD (2));
+            vm_fast_store_byte (vm, dest, value);
+          }
+          break;
+        case VM_OPERATION_MOVB_RM_RM:
+          {
+            if (code[1] >= VM_REGISTER_COUNT || code[2] >= VM_REGISTER_COUNT)
+              {
+                vm_fast_defer (vm);
+                break;
+              }
+
+            VM_FAST_ADVANCE (3);
+            word dest = VM_FAST_REGISTER (1);
+            byte value = vm_fast_read_byte (vm, VM_FAST_REGISTER (2));
+            vm_fast_store_byte (vm, dest, value);
+          }
+          break;
+        case VM_OPERATION_MOV_R_RD:
+          {
+            if (code[1] >= VM_REGISTER_COUNT || code[2] >= VM_REGISTER_COUNT)
+              {
+                vm_fast_defer (vm);
+                break;
+              }
+
+            VM_FAST_ADVANCE (5);
+            word address = VM_FAST_REGISTER (2) + VM_FAST_WORD (3);
+            *VM_FAST_DEST (1) = vm_fast_read_word (vm, address);
+          }
+          break;
+        case VM_OPERATION_MOV_RD_R:
+          {
+            if (code[1] >= VM_REGISTER_COUNT || code[4] >= VM_REGISTER_COUNT)
+              {
+                vm_fast_defer (vm);
+                break;
+              }
+
+            VM_FAST_ADVANCE (5);
+            word dest = VM_FAST_REGISTER (1) + VM_FAST_WORD (2);
+            vm_fast_store_word (vm, dest, VM_FAST_REGISTER (4));
+          }
+          break;
+        case VM_OPERATION_MOVB_R_RD:
+          {
+            if (code[1] >= VM_REGISTER_COUNT || code[2] >= VM_REGISTER_COUNT)
+              {
+                vm_fast_defer (vm);
+                break;
+              }
+
+            VM_FAST_ADVANCE (5);
+            word address = VM_FAST_REGISTER (2) + VM_FAST_WORD (3);
+            *VM_FAST_DEST (1) = vm_fast_read_byte (vm, address);
+          }
+          break;
+        case VM_OPERATION_MOVB_RD_R:
+          {
+            if (code[1] >= VM_REGISTER_COUNT || code[4] >= VM_REGISTER_COUNT)
+              {
+                vm_fast_defer (vm);
+                break;
+              }
+
+            VM_FAST_ADVANCE (5);
+            word dest = VM_FAST_REGISTER (1) + VM_FAST_WORD (2);
+            vm_fast_store_byte (vm, dest, VM_FAST_REGISTER (4));
+          }
+          break;
+        case VM_OPERATION_MOV_R_RX:
+        case VM_OPERATION_MOVB_R_RX:
+          {
+            if (code[1] >= VM_REGISTER_COUNT || !vm_fast_pair_valid (code, 2))
+              {
+                vm_fast_defer (vm);
+                break;
+              }
+
+            VM_FAST_ADVANCE (3);
+            word address = VM_FAST_HIGH (2) + VM_FAST_LOW (2);
+
+            if (operation == VM_OPERATION_MOV_R_RX)
+              *VM_FAST_DEST (1) = vm_fast_read_word (vm, address);
+            else
+              *VM_FAST_DEST (1) = vm_fast_read_byte (vm, address);
+          }
+          break;
+        case VM_OPERATION_MOV_RX_R:
+        case VM_OPERATION_MOVB_RX_R:
+          {
+            if (!vm_fast_pair_valid (code, 1) || code[2] >= VM_REGISTER_COUNT)
+              {
+                vm_fast_defer (vm);
+                break;
+              }
+
+            VM_FAST_ADVANCE (3);
+            word dest = VM_FAST_HIGH (1) + VM_FAST_LOW (1);
+
+            if (operation == VM_OPERATION_MOV_RX_R)
+              vm_fast_store_word (vm, dest, VM_FAST_REGISTER (2));
+            else
+              vm_fast_store_byte (vm, dest, VM_FAST_REGISTER (2));
+          }
+          break;
+        case VM_OPERATION_PUSH_I:
+          {
+            VM_FAST_ADVANCE (3);
+            vm_fast_push_word (vm, VM_FAST_WORD (1));
+          }
+          break;
+        case VM_OPERATION_PUSH_R:
+          {
+            if (code[1] >= VM_REGISTER_COUNT)
+              {
+                vm_fast_defer (vm);
+                break;
+              }
+
+            VM_FAST_ADVANCE (2);
+            vm_fast_push_word (vm, VM_FAST_REGISTER (1));
+          }
+          break;
+        case VM_OPERATION_POP:
+          {
+            if (code[1] >= VM_REGISTER_COUNT)
+              {
+                vm_fast_defer (vm);
+                break;
+              }
+
+            VM_FAST_ADVANCE (2);
+            word *dest = VM_FAST_DEST (1);
+            *dest = vm_fast_pop_word (vm);
+          }
+          break;
+        case VM_OPERATION_ADD_I:
+        case VM_OPERATION_SUB_I:
+        case VM_OPERATION_MUL_I:
+        case VM_OPERATION_AND_I:
+        case VM_OPERATION_OR_I:
+        case VM_OPERATION_XOR_I:
+        case VM_OPERATION_SHL_I:
+        case VM_OPERATION_SHR_I:
+        case VM_OPERATION_ADD_R:
+        case VM_OPERATION_SUB_R:
+        case VM_OPERATION_MUL_R:
+        case VM_OPERATION_AND_R:
+        case VM_OPERATION_OR_R:
+        case VM_OPERATION_XOR_R:
+        case VM_OPERATION_SHL_R:
+        case VM_OPERATION_SHR_R:
+        case VM_OPERATION_FMUL_I:
+        case VM_OPERATION_FMUL_R:
+        case VM_OPERATION_MULW_I:
+        case VM_OPERATION_MULW_R:
+          {
+            bool immediate = operation == VM_OPERATION_ADD_I
+                             || operation == VM_OPERATION_SUB_I
+                             || operation == VM_OPERATION_MUL_I
+                             || operation == VM_OPERATION_AND_I
+                             || operation == VM_OPERATION_OR_I
+                             || operation == VM_OPERATION_XOR_I
+                             || operation == VM_OPERATION_SHL_I
+                             || operation == VM_OPERATION_SHR_I
+                             || operation == VM_OPERATION_FMUL_I
+                             || operation == VM_OPERATION_MULW_I;
+
+            if (code[1] >= VM_REGISTER_COUNT || code[2] >= VM_REGISTER_COUNT
+                || (!immediate && code[3] >= VM_REGISTER_COUNT))
+              {
+                vm_fast_defer (vm);
+                break;
+              }
+
+            VM_FAST_ADVANCE (immediate ? 5 : 4);
+
+            word *dest = VM_FAST_DEST (1);
+            word src1 = VM_FAST_REGISTER (2);
+            word src2 = immediate ? VM_FAST_WORD (3) : VM_FAST_REGISTER (3);
+
+            switch (operation)
+              {
+              case VM_OPERATION_ADD_I:
+              case VM_OPERATION_ADD_R:
+                *dest = src1 + src2;
+                break;
+              case VM_OPERATION_SUB_I:
+              case VM_OPERATION_SUB_R:
+                *dest = src1 - src2;
+                break;
+              case VM_OPERATION_MUL_I:
+              case VM_OPERATION_MUL_R:
+                *dest = src1 * src2;
+                break;
+              case VM_OPERATION_AND_I:
+              case VM_OPERATION_AND_R:
+                *dest = src1 & src2;
+                break;
+              case VM_OPERATION_OR_I:
+              case VM_OPERATION_OR_R:
+                *dest = src1 | src2;
+                break;
+              case VM_OPERATION_XOR_I:
+              case VM_OPERATION_XOR_R:
+                *dest = src1 ^ src2;
+                break;
+              case VM_OPERATION_SHL_I:
+              case VM_OPERATION_SHL_R:
+                *dest = src1 << src2;
+                break;
+              case VM_OPERATION_FMUL_I:
+              case VM_OPERATION_FMUL_R:
+                *dest = vm_fixed_multiply (src1, src2);
+                break;
+              case VM_OPERATION_MULW_I:
+              case VM_OPERATION_MULW_R:
+                {
+                  uint32_t product = (uint32_t)src1 * src2;
+                  vm->registers[VM_REGISTER_AC] = product >> 16;
+                  *dest = product;
+                }
+                break;
+              default:
+                *dest = src1 >> src2;
+                break;
+              }
+          }
+          break;
+        case VM_OPERATION_PADD:
+        case VM_OPERATION_PSUB:
+        case VM_OPERATION_PCMPEQ:
+        case VM_OPERATION_PCMPGT:
+        case VM_OPERATION_PMIN:
+        case VM_OPERATION_PMAX:
+        case VM_OPERATION_PSHUF:
+          {
+            if (code[1] >= VM_REGISTER_COUNT || code[2] >= VM_REGISTER_COUNT
+                || code[3] >= VM_REGISTER_COUNT)
+              {
+                vm_fast_defer (vm);
+                break;
+              }
+
+            VM_FAST_ADVANCE (4);
+            *VM_FAST_DEST (1) = vm_simd (operation, VM_FAST_REGISTER (2), VM_FAST_REGISTER (3),
+                                         VM_SIMD_PACKED_LANES);
+          }
+          break;
+        case VM_OPERATION_VLD:
+          {
+            if (code[1] >= VM_VECTOR_COUNT || code[2] >= VM_REGISTER_COUNT)
+              {
+                vm_fast_defer (vm);
+                break;
+              }
+
+            VM_FAST_ADVANCE (3);
+            vm->vectors[code[1]] = vm_fast_read_vector (vm, VM_FAST_REGISTER (2));
+          }
+          break;
+        case VM_OPERATION_VST:
+          {
+            if (code[1] >= VM_REGISTER_COUNT || code[2] >= VM_VECTOR_COUNT)
+              {
+                vm_fast_defer (vm);
+                break;
+              }
+
+            VM_FAST_ADVANCE (3);
+            vm_fast_store_vector (vm, VM_FAST_REGISTER (1), vm->vectors[code[2]]);
+          }
+          break;
+        case VM_OPERATION_VSPLAT:
+          {
+            if (code[1] >= VM_VECTOR_COUNT || code[2] >= VM_REGISTER_COUNT)
+              {
+                vm_fast_defer (vm);
+                break;
+              }
+
+            VM_FAST_ADVANCE (3);
+            vm->vectors[code[1]] = (uint64_t)(byte)VM_FAST_REGISTER (2) * 0x0101010101010101;
+          }
+          break;
+        case VM_OPERATION_VADD:
+        case VM_OPERATION_VSUB:
+        case VM_OPERATION_VCMPEQ:
+        case VM_OPERATION_VCMPGT:
+        case VM_OPERATION_VMIN:
+        case VM_OPERATION_VMAX:
+        case VM_OPERATION_VSHUF:
+        case VM_OPERATION_VAND:
+        case VM_OPERATION_VOR:
+        case VM_OPERATION_VXOR:
+          {
+            if (code[1] >= VM_VECTOR_COUNT || code[2] >= VM_VECTOR_COUNT
+                || code[3] >= VM_VECTOR_COUNT)
+              {
+                vm_fast_defer (vm);
+                break;
+              }
+
+            VM_FAST_ADVANCE (4);
+            vm->vectors[code[1]]
+              = vm_simd (operation, vm->vectors[code[2]], vm->vectors[code[3]], VM_VECTOR_LANES);
+          }
+          break;
+        case VM_OPERATION_NOT:
+          {
+            if (code[1] >= VM_REGISTER_COUNT || code[2] >= VM_REGISTER_COUNT)
+              {
+                vm_fast_defer (vm);
+                break;
+              }
+
+            VM_FAST_ADVANCE (3);
+            *VM_FAST_DEST (1) = ~VM_FAST_REGISTER (2);
+          }
+          break;
+        case VM_OPERATION_CMP_I:
+          {
+            if (code[1] >= VM_REGISTER_COUNT)
+              {
+                vm_fast_defer (vm);
+                break;
+              }
+
+            VM_FAST_ADVANCE (4);
+            vm_compare (vm, VM_FAST_REGISTER (1), VM_FAST_WORD (2));
+          }
+          break;
+        case VM_OPERATION_CMP_R:
+          {
+            if (code[1] >= VM_REGISTER_COUNT || code[2] >= VM_REGISTER_COUNT)
+              {
+                vm_fast_defer (vm);
+                break;
+              }
+
+            VM_FAST_ADVANCE (3);
+            vm_compare (vm, VM_FAST_REGISTER (1), VM_FAST_REGISTER (2));
+          }
+          break;
+        case VM_OPERATION_MOV_P:
+          {
+            if (!vm_fast_pair_valid (code, 1))
+              {
+                vm_fast_defer (vm);
+                break;
+              }
+
+            VM_FAST_ADVANCE (2);
+            *VM_FAST_HIGH_DEST (1) = VM_FAST_LOW (1);
+          }
+          break;
+        case VM_OPERATION_CMP_P:
+          {
+            if (!vm_fast_pair_valid (code, 1))
+              {
+                vm_fast_defer (vm);
+                break;
+              }
+
+            VM_FAST_ADVANCE (2);
+            vm_compare (vm, VM_FAST_HIGH (1), VM_FAST_LOW (1));
+          }
+          break;
+        case VM_OPERATION_CMP_B:
+          {
+            if (code[1] >= VM_REGISTER_COUNT)
+              {
+                vm_fast_defer (vm);
+                break;
+              }
+
+            VM_FAST_ADVANCE (3);
+            vm_compare (vm, VM_FAST_REGISTER (1), code[2]);
+          }
+          break;
+        case VM_OPERATION_ADD_P:
+        case VM_OPERATION_SUB_P:
+        case VM_OPERATION_MUL_P:
+        case VM_OPERATION_AND_P:
+        case VM_OPERATION_OR_P:
+        case VM_OPERATION_XOR_P:
+        case VM_OPERATION_SHL_P:
+        case VM_OPERATION_SHR_P:
+        case VM_OPERATION_ADD_B:
+        case VM_OPERATION_SUB_B:
+        case VM_OPERATION_SHL_B:
+          {
+            bool immediate = operation == VM_OPERATION_ADD_B
+                             || operation == VM_OPERATION_SUB_B
+                             || operation == VM_OPERATION_SHL_B;
+
+            if (!vm_fast_pair_valid (code, 1)
+                || (!immediate && code[2] >= VM_REGISTER_COUNT))
+              {
+                vm_fast_defer (vm);
+                break;
+              }
+
+            VM_FAST_ADVANCE (3);
+
+            word *dest = VM_FAST_HIGH_DEST (1);
+            word src1 = VM_FAST_LOW (1);
+            word src2 = immediate ? code[2] : VM_FAST_REGISTER (2);
+
+            switch (operation)
+              {
+              case VM_OPERATION_ADD_P:
+              case VM_OPERATION_ADD_B:
+                *dest = src1 + src2;
+                break;
+              case VM_OPERATION_SUB_P:
+              case VM_OPERATION_SUB_B:
+                *dest = src1 - src2;
+                break;
+              case VM_OPERATION_MUL_P:
+                *dest = src1 * src2;
+                break;
+              case VM_OPERATION_AND_P:
+                *dest = src1 & src2;
+                break;
+              case VM_OPERATION_OR_P:
+                *dest = src1 | src2;
+                break;
+              case VM_OPERATION_XOR_P:
+                *dest = src1 ^ src2;
+                break;
+              case VM_OPERATION_SHL_P:
+              case VM_OPERATION_SHL_B:
+                *dest = src1 << src2;
+                break;
+              default:
+                *dest = src1 >> src2;
+                break;
+              }
+          }
+          break;
+        case VM_OPERATION_JMP_I:
+          *vm->ip = VM_FAST_WORD (1);
+          break;
+        case VM_OPERATION_JMP_R:
+          if (code[1] >= VM_REGISTER_COUNT)
+            {
+              vm_fast_defer (vm);
+              break;
+            }
+
+          *vm->ip = VM_FAST_REGISTER (1);
+          break;
+        case VM_OPERATION_JEQ_I:
+        case VM_OPERATION_JEQ_R:
+        case VM_OPERATION_JNE_I:
+        case VM_OPERATION_JNE_R:
+        case VM_OPERATION_JLT_I:
+        case VM_OPERATION_JLT_R:
+        case VM_OPERATION_JGT_I:
+        case VM_OPERATION_JGT_R:
+        case VM_OPERATION_JLE_I:
+        case VM_OPERATION_JLE_R:
+        case VM_OPERATION_JGE_I:
+        case VM_OPERATION_JGE_R:
+          {
+            // Immediate and register forms alternate from JEQ_I through JGE_R.
+            bool immediate = (operation - VM_OPERATION_JEQ_I) % 2 == 0;
+
+            if (!immediate && code[1] >= VM_REGISTER_COUNT)
+              {
+                vm_fast_defer (vm);
+                break;
+              }
+
+            VM_FAST_ADVANCE (immediate ? 3 : 2);
+
+            word address = immediate ? VM_FAST_WORD (1) : VM_FAST_REGISTER (1);
+            bool z = vm->flags.z, c = vm->flags.c;
+            bool condition;
+
+            switch (operation)
+              {
+              case VM_OPERATION_JEQ_I:
+              case VM_OPERATION_JEQ_R:
+                condition = z;
+                break;
+              case VM_OPERATION_JNE_I:
+              case VM_OPERATION_JNE_R:
+                condition = !z;
+                break;
+              case VM_OPERATION_JLT_I:
+              case VM_OPERATION_JLT_R:
+                condition = c;
+                break;
+              case VM_OPERATION_JGT_I:
+              case VM_OPERATION_JGT_R:
+                condition = !z && !c;
+                break;
+              case VM_OPERATION_JLE_I:
+              case VM_OPERATION_JLE_R:
+                condition = z || c;
+                break;
+              default:
+                condition = !c;
+                break;
+              }
+
+            vm_jump (vm, address, condition);
+          }
+          break;
+        case VM_OPERATION_JMP_S:
+          *vm->ip = ip + 2 + (int8_t)code[1];
+          break;
+        case VM_OPERATION_JEQ_S:
+        case VM_OPERATION_JNE_S:
+        case VM_OPERATION_JLT_S:
+        case VM_OPERATION_JGT_S:
+        case VM_OPERATION_JLE_S:
+        case VM_OPERATION_JGE_S:
+          {
+            VM_FAST_ADVANCE (2);
+
+            word address = ip + 2 + (int8_t)code[1];
+            bool z = vm->flags.z, c = vm->flags.c;
+            bool condition;
+
+            switch (operation)
+              {
+              case VM_OPERATION_JEQ_S:
+                condition = z;
+                break;
+              case VM_OPERATION_JNE_S:
+                condition = !z;
+                break;
+              case VM_OPERATION_JLT_S:
+                condition = c;
+                break;
+              case VM_OPERATION_JGT_S:
+                condition = !z && !c;
+                break;
+              case VM_OPERATION_JLE_S:
+                condition = z || c;
+                break;
+              default:
+                condition = !c;
+                break;
+              }
+
+            vm_jump (vm, address, condition);
+          }
+          break;
+        case VM_OPERATION_CALL_S:
+          {
+            VM_FAST_ADVANCE (2);
+            word address = ip + 2 + (int8_t)code[1];
+            vm_fast_push_word (vm, *vm->ip);
+            *vm->ip = address;
+            vm->stats.calls++;
+          }
+          break;
+        case VM_OPERATION_CALL_I:
+          {
+            VM_FAST_ADVANCE (3);
+            word address = VM_FAST_WORD (1);
+            vm_fast_push_word (vm, *vm->ip);
+            *vm->ip = address;
+            vm->stats.calls++;
+          }
+          break;
+        case VM_OPERATION_CALL_R:
+          {
+            if (code[1] >= VM_REGISTER_COUNT)
+              {
+                vm_fast_defer (vm);
+                break;
+              }
+
+            VM_FAST_ADVANCE (2);
+            word address = VM_FAST_REGISTER (1);
+            vm_fast_push_word (vm, *vm->ip);
+            *vm->ip = address;
+            vm->stats.calls++;
+          }
+          break;
+        case VM_OPERATION_RET:
+          *vm->ip = vm_fast_pop_word (vm);
+          break;
+        case VM_OPERATION_HALT:
+          VM_FAST_ADVANCE (1);
+          vm->halt = true;
+          break;
+        default:
+          // Rare operations (DIV, FDIV, PUSHA, POPA, PRINT, ...) defer to the reference decoder.
+          vm_fast_defer (vm);
+          break;
+        }
+
+      if (vm->halt)
+        vm_trap (vm, ip);
+
+      if (vm_operation_ends_block (operation))
+        break;
+    }
+
+  return n;
+}
+
+
+#undef VM_FAST_MAX_SIZE
+#undef VM_FAST_REGISTER
+#undef VM_FAST_DEST
+#undef VM_FAST_WORD
+#undef VM_FAST_HIGH
+#undef VM_FAST_LOW
+#undef VM_FAST_HIGH_DEST
+#undef VM_FAST_ADVANCE
+
+#undef VM_FAST_FUNCTION
+#undef VM_FAST_DEVICE_READ_BYTE
+#undef VM_FAST_DEVICE_READ_WORD
+#undef VM_FAST_DEVICE_STORE_BYTE
+#undef VM_FAST_DEVICE_STORE_WORD
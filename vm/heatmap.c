@@ -0,0 +1,174 @@
+#include "heatmap.h"
+#include <string.h>
+
+
+// The PPM image lays blocks out on a 16x16 grid, 4 KiB per row, each block a square of pixels.
+#define VM_HEATMAP_GRID 16
+#define VM_HEATMAP_SCALE 16
+
+
+bool
+vm_heatmap_create (VM_Heatmap *heatmap, const char *path, uint64_t interval)
+{
+  memset (heatmap, 0, sizeof (VM_Heatmap));
+
+  heatmap->file = fopen (path, "w");
+
+  if (!heatmap->file)
+    {
+      perror ("Failed to open file");
+      return false;
+    }
+
+  heatmap->interval = interval ? interval : 1;
+  heatmap->next = heatmap->interval;
+
+  fprintf (heatmap->file, "instructions,blocks_read,blocks_stored,blocks_executed,"
+                          "working_set,footprint\n");
+
+  return true;
+}
+
+
+// Takes a final sample, so the curve always ends at the last retired instruction.
+void
+vm_heatmap_destroy (VM_Heatmap *heatmap, VM *vm)
+{
+  if (!heatmap->file)
+    return;
+
+  if (vm->stats.instructions + heatmap->interval != heatmap->next)
+    vm_heatmap_sample (heatmap, vm);
+
+  fclose (heatmap->file);
+  heatmap->file = NULL;
+}
+
+
+void
+vm_heatmap_sample (VM_Heatmap *heatmap, VM *vm)
+{
+  size_t read = 0, stored = 0, executed = 0, working = 0, footprint = 0;
+
+  for (size_t i = 0; i < VM_DEVICE_BLOCK_COUNT; ++i)
+    {
+      bool r = vm->stats.reads[i] != heatmap->reads[i];
+      bool s = vm->stats.stores[i] != heatmap->stores[i];
+      bool x = vm->stats.executes[i] != heatmap->executes[i];
+
+      read += r;
+      stored += s;
+      executed += x;
+      working += r || s || x;
+
+      heatmap->touched[i] |= r || s || x;
+      footprint += heatmap->touched[i];
+    }
+
+  memcpy (heatmap->reads, vm->stats.reads, sizeof heatmap->reads);
+  memcpy (heatmap->stores, vm->stats.stores, sizeof heatmap->stores);
+  memcpy (heatmap->executes, vm->stats.executes, sizeof heatmap->executes);
+
+  fprintf (heatmap->file, "%llu,%zu,%zu,%zu,%zu,%zu\n",
+           (unsigned long long)vm->stats.instructions, read, stored, executed,
+           working, footprint);
+
+  heatmap->next = vm->stats.instructions + heatmap->interval;
+}
+
+
+static inline int
+vm_heatmap_bits (uint64_t n)
+{
+  int bits = 0;
+
+  while (n)
+    {
+      n >>= 1;
+      bits++;
+    }
+
+  return bits;
+}
+
+
+// Log-scaled intensity of `n` relative to the hottest block, so cold blocks stay visible.
+static inline byte
+vm_heatmap_intensity (uint64_t n, uint64_t max)
+{
+  return max ? 255 * vm_heatmap_bits (n) / vm_heatmap_bits (max) : 0;
+}
+
+
+static bool
+vm_heatmap_dump_ppm (VM *vm, FILE *file)
+{
+  uint64_t reads = 0, stores = 0, executes = 0;
+
+  for (size_t i = 0; i < VM_DEVICE_BLOCK_COUNT; ++i)
+    {
+      reads = vm->stats.reads[i] > reads ? vm->stats.reads[i] : reads;
+      stores = vm->stats.stores[i] > stores ? vm->stats.stores[i] : stores;
+      executes = vm->stats.executes[i] > executes ? vm->stats.executes[i] : executes;
+    }
+
+  int size = VM_HEATMAP_GRID * VM_HEATMAP_SCALE;
+  fprintf (file, "P6\n%d %d\n255\n", size, size);
+
+  // Stores are red, reads green and executes blue.
+  for (int y = 0; y < size; ++y)
+    for (int x = 0; x < size; ++x)
+      {
+        size_t i = y / VM_HEATMAP_SCALE * VM_HEATMAP_GRID + x / VM_HEATMAP_SCALE;
+
+        byte pixel[3] = {
+          vm_heatmap_intensity (vm->stats.stores[i], stores),
+          vm_heatmap_intensity (vm->stats.reads[i], reads),
+          vm_heatmap_intensity (vm->stats.executes[i], executes),
+        };
+
+        fwrite (pixel, 1, sizeof pixel, file);
+      }
+
+  return !ferror (file);
+}
+
+
+static bool
+vm_heatmap_dump_csv (VM *vm, FILE *file)
+{
+  fprintf (file, "address,reads,stores,executes\n");
+
+  for (size_t i = 0; i < VM_DEVICE_BLOCK_COUNT; ++i)
+    fprintf (file, VM_FMT_WORD ",%llu,%llu,%llu\n", (word)(i * VM_DEVICE_BLOCK_SIZE),
+             (unsigned long long)vm->stats.reads[i],
+             (unsigned long long)vm->stats.stores[i],
+             (unsigned long long)vm->stats.executes[i]);
+
+  return !ferror (file);
+}
+
+
+bool
+vm_heatmap_dump (VM *vm, const char *path)
+{
+  size_t n = strlen (path);
+  bool ppm = n >= 4 && strcmp (path + n - 4, ".ppm") == 0;
+
+  FILE *file = fopen (path, ppm ? "wb" : "w");
+
+  if (!file)
+    {
+      perror ("Failed to open file");
+      return false;
+    }
+
+  bool ok = ppm ? vm_heatmap_dump_ppm (vm, file) : vm_heatmap_dump_csv (vm, file);
+
+  if (!ok)
+    perror ("Failed to write file");
+
+  fclose (file);
+
+  return ok;
+}
@@ -0,0 +1,45 @@
+#ifndef VM_HEATMAP_H
+#define VM_HEATMAP_H
+
+
+#include "vm.h"
+
+#include <stdio.h>
+
+
+// Samples the per-block counters of `VM_Stats` every `interval` instructions and appends one
+// CSV row per sample: the number of blocks read, stored, executed and touched at all since the
+// previous sample (the working set), and since the start of the run (the footprint).
+typedef struct VM_Heatmap
+{
+  FILE *file;
+
+  uint64_t interval;
+  uint64_t next;
+
+  uint64_t reads[VM_DEVICE_BLOCK_COUNT];
+  uint64_t stores[VM_DEVICE_BLOCK_COUNT];
+  uint64_t executes[VM_DEVICE_BLOCK_COUNT];
+
+  bool touched[VM_DEVICE_BLOCK_COUNT];
+} VM_Heatmap;
+
+
+bool vm_heatmap_create (VM_Heatmap *heatmap, const char *path, uint64_t interval);
+void vm_heatmap_destroy (VM_Heatmap *heatmap, VM *vm);
+
+void vm_heatmap_sample (VM_Heatmap *heatmap, VM *vm);
+
+// Cheap enough to call after every step or block, samples once the interval has elapsed.
+static inline void
+vm_heatmap_update (VM_Heatmap *heatmap, VM *vm)
+{
+  if (vm->stats.instructions >= heatmap->next)
+    vm_heatmap_sample (heatmap, vm);
+}
+
+// Per-block totals, as CSV when `path` doesn't end in `.ppm`.
+bool vm_heatmap_dump (VM *vm, const char *path);
+
+
+#endif // VM_HEATMAP_H
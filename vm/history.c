@@ -0,0 +1,232 @@
+#include "history.h"
+#include <stdlib.h>
+#include <string.h>
+
+
+static void
+vm_history_save_block (VM_Checkpoint *checkpoint, VM *vm, size_t index)
+{
+  if (checkpoint->dirty[index] || !vm_block_is_ram (vm, index))
+    return;
+
+  checkpoint->dirty[index] = true;
+
+  checkpoint->blocks = realloc (checkpoint->blocks,
+                                (checkpoint->nblock + 1) * VM_DEVICE_BLOCK_SIZE);
+  checkpoint->indices = realloc (checkpoint->indices,
+                                 (checkpoint->nblock + 1) * sizeof (word));
+
+  memcpy (checkpoint->blocks[checkpoint->nblock],
+          &vm->memory[index * VM_DEVICE_BLOCK_SIZE], VM_DEVICE_BLOCK_SIZE);
+  checkpoint->indices[checkpoint->nblock++] = index;
+}
+
+
+// Copy on write: a block's pre-image is saved the first time it's stored to after a checkpoint.
+static void
+vm_history_on_store (VM_Tap *tap, VM *vm, word address, word value, bool wide)
+{
+  (void)value;
+  VM_History *history = tap->state;
+  VM_Checkpoint *checkpoint = &history->checkpoints[history->ncheckpoint - 1];
+
+  vm_history_save_block (checkpoint, vm, address / VM_DEVICE_BLOCK_SIZE);
+
+  if (wide)
+    vm_history_save_block (checkpoint, vm, (word)(address + 1) / VM_DEVICE_BLOCK_SIZE);
+}
+
+
+static void
+vm_history_clear (VM_Checkpoint *checkpoint)
+{
+  free (checkpoint->blocks);
+  free (checkpoint->indices);
+
+  checkpoint->blocks = NULL;
+  checkpoint->indices = NULL;
+  checkpoint->nblock = 0;
+
+  memset (checkpoint->dirty, 0, sizeof checkpoint->dirty);
+}
+
+
+static void
+vm_history_checkpoint (VM_History *history, VM *vm)
+{
+  // Forget the oldest checkpoint, its undo log is only needed to go back to it.
+  if (history->ncheckpoint == VM_HISTORY_MAX_CHECKPOINTS)
+    {
+      vm_history_clear (&history->checkpoints[0]);
+      memmove (&history->checkpoints[0], &history->checkpoints[1],
+               (history->ncheckpoint - 1) * sizeof (VM_Checkpoint));
+      history->ncheckpoint--;
+    }
+
+  VM_Checkpoint *checkpoint = &history->checkpoints[history->ncheckpoint++];
+
+  memset (checkpoint, 0, sizeof (VM_Checkpoint));
+  memcpy (checkpoint->registers, vm->registers, sizeof vm->registers);
+  memcpy (checkpoint->vectors, vm->vectors, sizeof vm->vectors);
+  checkpoint->scratch = vm->scratch;
+  checkpoint->z = vm->flags.z;
+  checkpoint->c = vm->flags.c;
+  checkpoint->halt = vm->halt;
+  checkpoint->trap = vm->trap;
+  checkpoint->stats = vm->stats;
+  memcpy (checkpoint->counters, vm->counters, sizeof vm->counters);
+}
+
+
+void
+vm_history_create (VM_History *history, VM *vm, uint64_t interval)
+{
+  memset (history, 0, sizeof (VM_History));
+
+  history->interval = interval ? interval : 1;
+  history->checkpoints = calloc (VM_HISTORY_MAX_CHECKPOINTS, sizeof (VM_Checkpoint));
+
+  vm_tap_create (&history->tap);
+  history->tap.on_store = vm_history_on_store;
+  history->tap.state = history;
+
+  vm_tap_attach (&history->tap, vm, 0, vm->nmemory - 1);
+
+  vm_history_checkpoint (history, vm);
+}
+
+
+void
+vm_history_destroy (VM_History *history, VM *vm)
+{
+  vm_tap_detach (&history->tap, vm);
+
+  for (size_t i = 0; i < history->ncheckpoint; ++i)
+    vm_history_clear (&history->checkpoints[i]);
+
+  free (history->checkpoints);
+  memset (history, 0, sizeof (VM_History));
+}
+
+
+void
+vm_history_step (VM_History *history, VM *vm)
+{
+  VM_Checkpoint *last = &history->checkpoints[history->ncheckpoint - 1];
+
+  if (vm->stats.instructions - last->stats.instructions >= history->interval)
+    vm_history_checkpoint (history, vm);
+
+  vm_step (vm);
+}
+
+
+// Checkpoints are only taken between blocks, rewinding still lands on exact instructions.
+size_t
+vm_history_run_block (VM_History *history, VM *vm, const VM_Engine *engine)
+{
+  VM_Checkpoint *last = &history->checkpoints[history->ncheckpoint - 1];
+
+  if (vm->stats.instructions - last->stats.instructions >= history->interval)
+    vm_history_checkpoint (history, vm);
+
+  return engine->run_block (vm);
+}
+
+
+bool
+vm_history_rewind (VM_History *history, VM *vm, uint64_t instruction)
+{
+  if (instruction > vm->stats.instructions)
+    return false;
+
+  // The nearest checkpoint at or before `instruction`.
+  size_t target = history->ncheckpoint;
+
+  while (target > 0
+         && history->checkpoints[target - 1].stats.instructions > instruction)
+    target--;
+
+  if (target-- == 0)
+    return false;
+
+  // Undo every store made since the target checkpoint, newest first.
+  for (size_t i = history->ncheckpoint; i-- > target;)
+    {
+      VM_Checkpoint *checkpoint = &history->checkpoints[i];
+
+      for (size_t j = checkpoint->nblock; j-- > 0;)
+        memcpy (&vm->memory[checkpoint->indices[j] * VM_DEVICE_BLOCK_SIZE],
+                checkpoint->blocks[j], VM_DEVICE_BLOCK_SIZE);
+
+      vm_history_clear (checkpoint);
+    }
+
+  history->ncheckpoint = target + 1;
+
+  VM_Checkpoint *checkpoint = &history->checkpoints[target];
+
+  memcpy (vm->registers, checkpoint->registers, sizeof vm->registers);
+  memcpy (vm->vectors, checkpoint->vectors, sizeof vm->vectors);
+  vm->scratch = checkpoint->scratch;
+  vm->flags.z = checkpoint->z;
+  vm->flags.c = checkpoint->c;
+  vm->halt = checkpoint->halt;
+  vm->trap = checkpoint->trap;
+  vm->stats = checkpoint->stats;
+  memcpy (vm->counters, checkpoint->counters, sizeof vm->counters);
+
+  while (vm->stats.instructions < instruction && !vm->halt)
+    vm_history_step (history, vm);
+
+  return true;
+}
+
+
+bool
+vm_history_reverse (VM_History *history, VM *vm, bool (*stop) (VM *, void *),
+                    void *state)
+{
+  uint64_t end = vm->stats.instructions;
+
+  if (!stop)
+    end = 0;
+
+  // Search one checkpoint interval at a time, newest first, re-executing each up to `end`.
+  while (history->ncheckpoint > 0)
+    {
+      size_t index = history->ncheckpoint;
+      uint64_t start;
+
+      do
+        start = history->checkpoints[--index].stats.instructions;
+      while (index > 0 && start >= end);
+
+      if (start >= end)
+        break;
+
+      vm_history_rewind (history, vm, start);
+
+      uint64_t found = UINT64_MAX;
+
+      while (vm->stats.instructions < end && !vm->halt)
+        {
+          if (stop && stop (vm, state))
+            found = vm->stats.instructions;
+
+          vm_history_step (history, vm);
+        }
+
+      if (found != UINT64_MAX)
+        return vm_history_rewind (history, vm, found);
+
+      if (index == 0)
+        break;
+
+      end = start;
+    }
+
+  vm_history_rewind (history, vm, history->checkpoints[0].stats.instructions);
+
+  return false;
+}
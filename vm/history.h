@@ -0,0 +1,61 @@
+#ifndef VM_HISTORY_H
+#define VM_HISTORY_H
+
+
+#include "tap.h"
+#include "vm.h"
+
+
+#define VM_HISTORY_MAX_CHECKPOINTS 1024
+
+
+// Registers and counters at the time of the checkpoint, plus the pre-image of every RAM block
+// stored to before the next one. Undoing checkpoints newest first restores memory to any of
+// them.
+typedef struct VM_Checkpoint
+{
+  word registers[VM_REGISTER_COUNT];
+  uint64_t vectors[VM_VECTOR_COUNT];
+  word scratch;
+  byte z, c;
+  bool halt;
+  VM_Trap trap;
+  VM_Stats stats;
+  uint64_t counters[VM_COUNTER_COUNT];
+
+  bool dirty[VM_DEVICE_BLOCK_COUNT];
+  byte (*blocks)[VM_DEVICE_BLOCK_SIZE];
+  word *indices;
+  size_t nblock;
+} VM_Checkpoint;
+
+
+// Execution history for reverse debugging. Moving back restores the nearest checkpoint and
+// re-executes forward from there, so devices must behave the same when re-executed. Only RAM is
+// restored: a device keeps its own state, such as the bank behind a bank window.
+typedef struct VM_History
+{
+  VM_Tap tap;
+  VM_Checkpoint *checkpoints;
+  size_t ncheckpoint;
+  uint64_t interval;
+} VM_History;
+
+
+void vm_history_create (VM_History *history, VM *vm, uint64_t interval);
+void vm_history_destroy (VM_History *history, VM *vm);
+
+void vm_history_step (VM_History *history, VM *vm);
+size_t vm_history_run_block (VM_History *history, VM *vm, const VM_Engine *engine);
+
+// Moves to the state right before `instruction`, counted like `VM_Stats.instructions`.
+bool vm_history_rewind (VM_History *history, VM *vm, uint64_t instruction);
+
+// Moves back to the last state before the current one for which `stop` holds, checked before
+// every operation. Returns false after moving to the oldest checkpoint when there is none, which
+// is all it does without a `stop`.
+bool vm_history_reverse (VM_History *history, VM *vm, bool (*stop) (VM *, void *),
+                         void *state);
+
+
+#endif // VM_HISTORY_H
@@ -0,0 +1,153 @@
+#include "mailbox.h"
+#include <string.h>
+
+
+static word
+vm_mailbox_send (VM *vm, VM_Mailbox *mailbox, word n)
+{
+  word buffer[VM_MAILBOX_CHUNK];
+  word sent = 0;
+
+  if (!mailbox->send)
+    return 0;
+
+  while (sent < n)
+    {
+      size_t chunk = vm_queue_space (mailbox->send);
+
+      if (chunk > VM_MAILBOX_CHUNK)
+        chunk = VM_MAILBOX_CHUNK;
+      if (chunk > (size_t)(n - sent))
+        chunk = n - sent;
+      if (chunk == 0)
+        break;
+
+      for (size_t i = 0; i < chunk; ++i)
+        buffer[i] = vm_read_word (vm, mailbox->address + (sent + i) * sizeof (word));
+
+      // A faulting read halts the VM, don't send what it returned.
+      if (vm->trap.error != VM_ERROR_NONE)
+        break;
+
+      size_t pushed = vm_queue_push_many (mailbox->send, buffer, chunk);
+      sent += pushed;
+
+      if (pushed < chunk)
+        break;
+    }
+
+  return sent;
+}
+
+
+// Received words are stored even if a store faults, the rest of the chunk is lost then.
+static word
+vm_mailbox_receive (VM *vm, VM_Mailbox *mailbox, word n)
+{
+  word buffer[VM_MAILBOX_CHUNK];
+  word received = 0;
+
+  if (!mailbox->receive)
+    return 0;
+
+  while (received < n)
+    {
+      size_t chunk = n - received < VM_MAILBOX_CHUNK ? n - received : VM_MAILBOX_CHUNK;
+      size_t popped = vm_queue_pop_many (mailbox->receive, buffer, chunk);
+
+      for (size_t i = 0; i < popped; ++i)
+        vm_store_word (vm, mailbox->address + (received + i) * sizeof (word), buffer[i]);
+
+      received += popped;
+
+      if (popped < chunk || vm->trap.error != VM_ERROR_NONE)
+        break;
+    }
+
+  return received;
+}
+
+
+static word
+vm_mailbox_read_word (VM *vm, VM_Device *device, word address)
+{
+  (void)vm;
+  VM_Mailbox *mailbox = device->state;
+  word value = 0;
+
+  switch (address % VM_DEVICE_BLOCK_SIZE)
+    {
+    case VM_MAILBOX_DATA:
+      mailbox->done = mailbox->receive && vm_queue_pop (mailbox->receive, &value);
+      return value;
+    case VM_MAILBOX_COUNT:
+      return mailbox->receive ? vm_queue_count (mailbox->receive) : 0;
+    case VM_MAILBOX_SPACE:
+      return mailbox->send ? vm_queue_space (mailbox->send) : 0;
+    case VM_MAILBOX_ADDRESS:
+      return mailbox->address;
+    case VM_MAILBOX_DONE:
+      return mailbox->done;
+    case VM_MAILBOX_CLOSED:
+      return !mailbox->receive || vm_queue_finished (mailbox->receive);
+    default:
+      return 0;
+    }
+}
+
+
+static void
+vm_mailbox_store_word (VM *vm, VM_Device *device, word address, word value)
+{
+  VM_Mailbox *mailbox = device->state;
+
+  switch (address % VM_DEVICE_BLOCK_SIZE)
+    {
+    case VM_MAILBOX_DATA:
+      mailbox->done = mailbox->send && vm_queue_push (mailbox->send, value);
+      break;
+    case VM_MAILBOX_ADDRESS:
+      mailbox->address = value;
+      break;
+    case VM_MAILBOX_SEND:
+      mailbox->done = vm_mailbox_send (vm, mailbox, value);
+      break;
+    case VM_MAILBOX_RECEIVE:
+      mailbox->done = vm_mailbox_receive (vm, mailbox, value);
+      break;
+    }
+}
+
+
+static byte
+vm_mailbox_read_byte (VM *vm, VM_Device *device, word address)
+{
+  if (address % 2)
+    return 0;
+
+  return VM_WORD_L (vm_mailbox_read_word (vm, device, address));
+}
+
+
+static void
+vm_mailbox_store_byte (VM *vm, VM_Device *device, word address, byte value)
+{
+  if (address % 2 == 0)
+    vm_mailbox_store_word (vm, device, address, value);
+}
+
+
+void
+vm_mailbox_create (VM_Mailbox *mailbox, VM_Queue *send, VM_Queue *receive)
+{
+  memset (mailbox, 0, sizeof (VM_Mailbox));
+
+  mailbox->send = send;
+  mailbox->receive = receive;
+
+  mailbox->device.read_byte = vm_mailbox_read_byte;
+  mailbox->device.read_word = vm_mailbox_read_word;
+  mailbox->device.store_byte = vm_mailbox_store_byte;
+  mailbox->device.store_word = vm_mailbox_store_word;
+  mailbox->device.state = mailbox;
+}
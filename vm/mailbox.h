@@ -0,0 +1,55 @@
+#ifndef VM_MAILBOX_H
+#define VM_MAILBOX_H
+
+
+#include "queue.h"
+#include "vm.h"
+
+
+// Bulk transfers move this many words between the queue and memory at a time.
+#define VM_MAILBOX_CHUNK 64
+
+
+// Word registers, as offsets into the block the mailbox is mapped at.
+typedef enum
+{
+  // Stores send the value, reads receive one or return 0.
+  VM_MAILBOX_DATA = 0x00,
+  // Messages waiting to be received.
+  VM_MAILBOX_COUNT = 0x02,
+  // Messages that can be sent before the queue is full.
+  VM_MAILBOX_SPACE = 0x04,
+  // Guest address of the buffer for bulk transfers.
+  VM_MAILBOX_ADDRESS = 0x06,
+  // Stores send up to that many words from the buffer.
+  VM_MAILBOX_SEND = 0x08,
+  // Stores receive up to that many words into the buffer.
+  VM_MAILBOX_RECEIVE = 0x0A,
+  // Words moved by the last access to DATA, SEND or RECEIVE.
+  VM_MAILBOX_DONE = 0x0C,
+  // 1 when every sender closed the receive queue and it is empty.
+  VM_MAILBOX_CLOSED = 0x0E,
+} VM_MailboxRegister;
+
+
+// A VM's end of two queues, which other VMs on other host threads hold the other ends of. It
+// never blocks, the guest polls COUNT or SPACE. Byte accesses act on the low byte of the
+// register at an even offset and are ignored at an odd one.
+//
+// The registers belong to one VM, cores of the same VM need a mailbox each.
+typedef struct VM_Mailbox
+{
+  VM_Device device;
+  VM_Queue *send;
+  VM_Queue *receive;
+
+  word address;
+  word done;
+} VM_Mailbox;
+
+
+// Either queue can be NULL, a mailbox without one never sends or never receives.
+void vm_mailbox_create (VM_Mailbox *mailbox, VM_Queue *send, VM_Queue *receive);
+
+
+#endif // VM_MAILBOX_H
@@ -0,0 +1,231 @@
+#include "queue.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+
+bool
+vm_queue_create (VM_Queue *queue, size_t capacity, size_t producers, size_t consumers)
+{
+  memset (queue, 0, sizeof (VM_Queue));
+
+  size_t size = 1;
+
+  while (size < capacity)
+    size <<= 1;
+
+  queue->slots = calloc (size, sizeof (VM_QueueSlot));
+
+  if (!queue->slots)
+    {
+      perror ("Failed to allocate queue");
+      return false;
+    }
+
+  for (size_t i = 0; i < size; ++i)
+    queue->slots[i].sequence = i;
+
+  queue->mask = size - 1;
+  queue->shared = producers > 1 || consumers > 1;
+  queue->open = producers;
+
+  return true;
+}
+
+
+void
+vm_queue_destroy (VM_Queue *queue)
+{
+  free (queue->slots);
+  memset (queue, 0, sizeof (VM_Queue));
+}
+
+
+// The producer owns `head` and the consumer `tail`, each reads the other's with acquire to see
+// the slots it published.
+static size_t
+vm_queue_push_single (VM_Queue *queue, const word *values, size_t n)
+{
+  size_t head = queue->head;
+  size_t tail = __atomic_load_n (&queue->tail, __ATOMIC_ACQUIRE);
+  size_t space = queue->mask + 1 - (head - tail);
+
+  if (n > space)
+    n = space;
+
+  for (size_t i = 0; i < n; ++i)
+    queue->slots[(head + i) & queue->mask].value = values[i];
+
+  __atomic_store_n (&queue->head, head + n, __ATOMIC_RELEASE);
+
+  return n;
+}
+
+
+static size_t
+vm_queue_pop_single (VM_Queue *queue, word *values, size_t n)
+{
+  size_t tail = queue->tail;
+  size_t head = __atomic_load_n (&queue->head, __ATOMIC_ACQUIRE);
+
+  if (n > head - tail)
+    n = head - tail;
+
+  for (size_t i = 0; i < n; ++i)
+    values[i] = queue->slots[(tail + i) & queue->mask].value;
+
+  __atomic_store_n (&queue->tail, tail + n, __ATOMIC_RELEASE);
+
+  return n;
+}
+
+
+// A slot is free for the producer claiming position `p` when its sequence is `p`, and full for
+// the consumer claiming it when it is `p + 1`. Popping hands it to the next lap.
+static bool
+vm_queue_push_shared (VM_Queue *queue, word value)
+{
+  size_t head = __atomic_load_n (&queue->head, __ATOMIC_RELAXED);
+  VM_QueueSlot *slot;
+
+  for (;;)
+    {
+      slot = &queue->slots[head & queue->mask];
+
+      size_t sequence = __atomic_load_n (&slot->sequence, __ATOMIC_ACQUIRE);
+      ptrdiff_t difference = (ptrdiff_t)(sequence - head);
+
+      if (difference == 0)
+        {
+          if (__atomic_compare_exchange_n (&queue->head, &head, head + 1, true,
+                                           __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+            break;
+        }
+      else if (difference < 0)
+        return false;
+      else
+        head = __atomic_load_n (&queue->head, __ATOMIC_RELAXED);
+    }
+
+  slot->value = value;
+  __atomic_store_n (&slot->sequence, head + 1, __ATOMIC_RELEASE);
+
+  return true;
+}
+
+
+static bool
+vm_queue_pop_shared (VM_Queue *queue, word *value)
+{
+  size_t tail = __atomic_load_n (&queue->tail, __ATOMIC_RELAXED);
+  VM_QueueSlot *slot;
+
+  for (;;)
+    {
+      slot = &queue->slots[tail & queue->mask];
+
+      size_t sequence = __atomic_load_n (&slot->sequence, __ATOMIC_ACQUIRE);
+      ptrdiff_t difference = (ptrdiff_t)(sequence - (tail + 1));
+
+      if (difference == 0)
+        {
+          if (__atomic_compare_exchange_n (&queue->tail, &tail, tail + 1, true,
+                                           __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+            break;
+        }
+      else if (difference < 0)
+        return false;
+      else
+        tail = __atomic_load_n (&queue->tail, __ATOMIC_RELAXED);
+    }
+
+  *value = slot->value;
+  __atomic_store_n (&slot->sequence, tail + queue->mask + 1, __ATOMIC_RELEASE);
+
+  return true;
+}
+
+
+bool
+vm_queue_push (VM_Queue *queue, word value)
+{
+  if (queue->shared)
+    return vm_queue_push_shared (queue, value);
+
+  return vm_queue_push_single (queue, &value, 1) == 1;
+}
+
+
+bool
+vm_queue_pop (VM_Queue *queue, word *value)
+{
+  if (queue->shared)
+    return vm_queue_pop_shared (queue, value);
+
+  return vm_queue_pop_single (queue, value, 1) == 1;
+}
+
+
+size_t
+vm_queue_push_many (VM_Queue *queue, const word *values, size_t n)
+{
+  if (!queue->shared)
+    return vm_queue_push_single (queue, values, n);
+
+  size_t i = 0;
+
+  while (i < n && vm_queue_push_shared (queue, values[i]))
+    i++;
+
+  return i;
+}
+
+
+size_t
+vm_queue_pop_many (VM_Queue *queue, word *values, size_t n)
+{
+  if (!queue->shared)
+    return vm_queue_pop_single (queue, values, n);
+
+  size_t i = 0;
+
+  while (i < n && vm_queue_pop_shared (queue, &values[i]))
+    i++;
+
+  return i;
+}
+
+
+size_t
+vm_queue_count (VM_Queue *queue)
+{
+  size_t tail = __atomic_load_n (&queue->tail, __ATOMIC_ACQUIRE);
+  size_t head = __atomic_load_n (&queue->head, __ATOMIC_ACQUIRE);
+
+  // Shared positions are claimed before the slot is written, and may be read out of order.
+  if ((ptrdiff_t)(head - tail) < 0)
+    return 0;
+
+  return head - tail > queue->mask + 1 ? queue->mask + 1 : head - tail;
+}
+
+
+size_t
+vm_queue_space (VM_Queue *queue)
+{
+  return queue->mask + 1 - vm_queue_count (queue);
+}
+
+
+void
+vm_queue_close (VM_Queue *queue)
+{
+  __atomic_sub_fetch (&queue->open, 1, __ATOMIC_RELEASE);
+}
+
+
+bool
+vm_queue_finished (VM_Queue *queue)
+{
+  return __atomic_load_n (&queue->open, __ATOMIC_ACQUIRE) == 0 && vm_queue_count (queue) == 0;
+}
@@ -0,0 +1,62 @@
+#ifndef VM_QUEUE_H
+#define VM_QUEUE_H
+
+
+#include "vm.h"
+
+
+// Keeps the producer and consumer positions on separate cache lines.
+#define VM_QUEUE_CACHE_LINE 64
+
+
+typedef struct VM_QueueSlot
+{
+  size_t sequence;
+  word value;
+} VM_QueueSlot;
+
+
+// Bounded lock-free queue of words between host threads. With one producer and one consumer
+// each side owns its position and only publishes it, with more of either the positions are
+// claimed by CAS and every slot carries a sequence number telling whose turn it is.
+//
+// Producers close the queue once they're done, it is closed when every one of them did.
+typedef struct VM_Queue
+{
+  VM_QueueSlot *slots;
+  size_t mask;
+  bool shared;
+
+  // Producers that haven't closed the queue yet.
+  size_t open;
+
+  char padding0[VM_QUEUE_CACHE_LINE];
+  size_t head;
+  char padding1[VM_QUEUE_CACHE_LINE - sizeof (size_t)];
+  size_t tail;
+  char padding2[VM_QUEUE_CACHE_LINE - sizeof (size_t)];
+} VM_Queue;
+
+
+// `capacity` is rounded up to a power of two.
+bool vm_queue_create (VM_Queue *queue, size_t capacity, size_t producers, size_t consumers);
+void vm_queue_destroy (VM_Queue *queue);
+
+bool vm_queue_push (VM_Queue *queue, word value);
+bool vm_queue_pop (VM_Queue *queue, word *value);
+
+// Move as many values as fit or are available, up to `n`, and return how many did.
+size_t vm_queue_push_many (VM_Queue *queue, const word *values, size_t n);
+size_t vm_queue_pop_many (VM_Queue *queue, word *values, size_t n);
+
+// Snapshots, exact only while the other side is idle.
+size_t vm_queue_count (VM_Queue *queue);
+size_t vm_queue_space (VM_Queue *queue);
+
+void vm_queue_close (VM_Queue *queue);
+
+// Closed and drained, nothing will ever be popped again.
+bool vm_queue_finished (VM_Queue *queue);
+
+
+#endif // VM_QUEUE_H
@@ -0,0 +1,261 @@
+#include "replay.h"
+#include <stdlib.h>
+#include <string.h>
+
+
+static void
+vm_recording_on_read (VM_Tap *tap, VM *vm, word address, word value, bool wide)
+{
+  VM_Recording *recording = tap->state;
+  uint64_t delta = vm->stats.instructions - recording->last;
+
+  while (delta >= 0x80)
+    {
+      putc ((delta & 0x7F) | 0x80, recording->file);
+      delta >>= 7;
+    }
+
+  putc (delta, recording->file);
+  putc (wide, recording->file);
+  putc (VM_WORD_L (address), recording->file);
+  putc (VM_WORD_H (address), recording->file);
+  putc (VM_WORD_L (value), recording->file);
+
+  if (wide)
+    putc (VM_WORD_H (value), recording->file);
+
+  recording->last = vm->stats.instructions;
+}
+
+
+// Start after every device is mapped, the blocks that aren't RAM by then are recorded.
+bool
+vm_recording_create (VM_Recording *recording, VM *vm, const char *path)
+{
+  memset (recording, 0, sizeof (VM_Recording));
+
+  recording->file = fopen (path, "wb");
+
+  if (!recording->file)
+    {
+      perror ("Failed to open file");
+      return false;
+    }
+
+  vm_tap_create (&recording->tap);
+  recording->tap.on_read = vm_recording_on_read;
+  recording->tap.state = recording;
+
+  byte bitmap[VM_DEVICE_BLOCK_COUNT / 8] = {0};
+
+  for (size_t i = 0; i < vm->ndevice; ++i)
+    if (vm->devices[i] != &vm_device_ram)
+      {
+        bitmap[i / 8] |= 1 << (i % 8);
+        vm_tap_attach (&recording->tap, vm, i * VM_DEVICE_BLOCK_SIZE,
+                       i * VM_DEVICE_BLOCK_SIZE);
+      }
+
+  fwrite (VM_REPLAY_MAGIC, 1, strlen (VM_REPLAY_MAGIC), recording->file);
+  fwrite (bitmap, 1, sizeof bitmap, recording->file);
+
+  recording->last = vm->stats.instructions;
+
+  return true;
+}
+
+
+bool
+vm_recording_destroy (VM_Recording *recording, VM *vm)
+{
+  vm_tap_detach (&recording->tap, vm);
+
+  bool ok = !ferror (recording->file);
+
+  if (fclose (recording->file) != 0 || !ok)
+    {
+      perror ("Failed to write recording");
+      ok = false;
+    }
+
+  recording->file = NULL;
+
+  return ok;
+}
+
+
+static bool
+vm_replay_next (VM_Replay *replay, VM *vm, word address, bool wide, word *value)
+{
+  if (replay->cursor == replay->nevent)
+    {
+      replay->exhausted = true;
+      vm->halt = true;
+      return false;
+    }
+
+  VM_ReplayEvent *event = &replay->events[replay->cursor];
+
+  if (event->instruction != vm->stats.instructions || event->address != address
+      || event->wide != wide)
+    {
+      replay->diverged = true;
+      vm->halt = true;
+      return false;
+    }
+
+  replay->cursor++;
+  *value = event->value;
+
+  return true;
+}
+
+
+static byte
+vm_replay_read_byte (VM *vm, VM_Device *device, word address)
+{
+  word value = 0;
+  vm_replay_next (device->state, vm, address, false, &value);
+  return value;
+}
+
+
+static word
+vm_replay_read_word (VM *vm, VM_Device *device, word address)
+{
+  word value = 0;
+  vm_replay_next (device->state, vm, address, true, &value);
+  return value;
+}
+
+
+static void
+vm_replay_store_byte (VM *vm, VM_Device *device, word address, byte value)
+{
+  VM_Replay *replay = device->state;
+  VM_Device *inner = replay->inner[address / VM_DEVICE_BLOCK_SIZE];
+
+  inner->store_byte (vm, inner, address, value);
+}
+
+
+static void
+vm_replay_store_word (VM *vm, VM_Device *device, word address, word value)
+{
+  VM_Replay *replay = device->state;
+  VM_Device *inner = replay->inner[address / VM_DEVICE_BLOCK_SIZE];
+
+  inner->store_word (vm, inner, address, value);
+}
+
+
+bool
+vm_replay_load (VM_Replay *replay, const char *path)
+{
+  memset (replay, 0, sizeof (VM_Replay));
+
+  FILE *file = fopen (path, "rb");
+
+  if (!file)
+    {
+      perror ("Failed to open file");
+      return false;
+    }
+
+  char magic[sizeof VM_REPLAY_MAGIC - 1];
+  byte bitmap[VM_DEVICE_BLOCK_COUNT / 8];
+
+  if (fread (magic, 1, sizeof magic, file) != sizeof magic
+      || memcmp (magic, VM_REPLAY_MAGIC, sizeof magic) != 0
+      || fread (bitmap, 1, sizeof bitmap, file) != sizeof bitmap)
+    {
+      fprintf (stderr, "Not a recording `%s`\n", path);
+      fclose (file);
+      return false;
+    }
+
+  for (size_t i = 0; i < VM_DEVICE_BLOCK_COUNT; ++i)
+    replay->blocks[i] = bitmap[i / 8] >> (i % 8) & 1;
+
+  size_t capacity = 0;
+  uint64_t instruction = 0;
+
+  for (;;)
+    {
+      uint64_t delta = 0;
+      int c, shift = 0;
+
+      while ((c = getc (file)) != EOF && shift < 64)
+        {
+          delta |= (uint64_t)(c & 0x7F) << shift;
+          shift += 7;
+
+          if (!(c & 0x80))
+            break;
+        }
+
+      if (c == EOF)
+        break;
+
+      int wide = getc (file);
+      int l = getc (file), h = getc (file);
+      int vl = getc (file), vh = wide == 1 ? getc (file) : 0;
+
+      if (wide == EOF || h == EOF || vl == EOF || vh == EOF)
+        {
+          fprintf (stderr, "Truncated recording `%s`\n", path);
+          break;
+        }
+
+      if (replay->nevent == capacity)
+        replay->events = realloc (replay->events, (capacity = capacity * 2 + 256)
+                                                  * sizeof (VM_ReplayEvent));
+
+      instruction += delta;
+
+      replay->events[replay->nevent++] = (VM_ReplayEvent){
+        .instruction = instruction,
+        .address = VM_WORD_PACK (h, l),
+        .value = VM_WORD_PACK (vh, vl),
+        .wide = wide == 1,
+      };
+    }
+
+  fclose (file);
+
+  replay->device.read_byte = vm_replay_read_byte;
+  replay->device.read_word = vm_replay_read_word;
+  replay->device.store_byte = vm_replay_store_byte;
+  replay->device.store_word = vm_replay_store_word;
+  replay->device.state = replay;
+
+  return true;
+}
+
+
+void
+vm_replay_destroy (VM_Replay *replay)
+{
+  free (replay->events);
+  memset (replay, 0, sizeof (VM_Replay));
+}
+
+
+void
+vm_replay_attach (VM_Replay *replay, VM *vm)
+{
+  for (size_t i = 0; i < vm->ndevice; ++i)
+    if (replay->blocks[i])
+      {
+        // Attaching again to the same VM keeps the devices found the first time.
+        if (vm->devices[i] != &replay->device)
+          replay->inner[i] = vm->devices[i];
+
+        vm_map_device (vm, &replay->device, i * VM_DEVICE_BLOCK_SIZE,
+                       i * VM_DEVICE_BLOCK_SIZE);
+      }
+
+  replay->cursor = 0;
+  replay->exhausted = false;
+  replay->diverged = false;
+}
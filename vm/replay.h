@@ -0,0 +1,67 @@
+#ifndef VM_REPLAY_H
+#define VM_REPLAY_H
+
+
+#include "tap.h"
+#include "vm.h"
+
+#include <stdio.h>
+
+
+#define VM_REPLAY_MAGIC "VMREPLAY"
+
+
+// A read from a device, stamped with the instruction it happened in (`VM_Stats.instructions`).
+typedef struct VM_ReplayEvent
+{
+  uint64_t instruction;
+  word address;
+  word value;
+  bool wide;
+} VM_ReplayEvent;
+
+
+// Logs every read from the blocks that aren't RAM when recording starts. After the magic, the
+// file holds a bitmap of those blocks, then one entry per read:
+//   varint  instructions since the previous read
+//   byte    0 (byte read) or 1 (word read)
+//   word    address
+//   byte or word value
+typedef struct VM_Recording
+{
+  FILE *file;
+  VM_Tap tap;
+  uint64_t last;
+} VM_Recording;
+
+
+// Feeds a recording back in place of the recorded devices, which don't need to exist. Stores
+// go to the device that was mapped there before, so output still shows. The VM halts when the
+// log is exhausted, or when a read doesn't match the log because the execution diverged from
+// the recorded one.
+typedef struct VM_Replay
+{
+  VM_Device device;
+  bool blocks[VM_DEVICE_BLOCK_COUNT];
+  VM_Device *inner[VM_DEVICE_BLOCK_COUNT];
+
+  VM_ReplayEvent *events;
+  size_t nevent;
+  size_t cursor;
+
+  bool exhausted;
+  bool diverged;
+} VM_Replay;
+
+
+bool vm_recording_create (VM_Recording *recording, VM *vm, const char *path);
+bool vm_recording_destroy (VM_Recording *recording, VM *vm);
+
+bool vm_replay_load (VM_Replay *replay, const char *path);
+void vm_replay_destroy (VM_Replay *replay);
+
+// Maps the replay over the recorded blocks and rewinds it, once per run.
+void vm_replay_attach (VM_Replay *replay, VM *vm);
+
+
+#endif // VM_REPLAY_H
@@ -0,0 +1,403 @@
+#include "ring.h"
+#include "tap.h"
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+
+#define VM_RING_DESCRIPTOR_SIZE (4 * sizeof (word))
+#define VM_RING_USED_SIZE (2 * sizeof (word))
+
+
+// The worker accesses guest memory directly, RAM is the only device it can reach, tapped or
+// not.
+static bool
+vm_ring_accessible (VM *vm, size_t address, size_t length, byte protection)
+{
+  if (length == 0)
+    return true;
+
+  if (address + length > vm->nmemory)
+    return false;
+
+  size_t first = address / VM_DEVICE_BLOCK_SIZE;
+  size_t last = (address + length - 1) / VM_DEVICE_BLOCK_SIZE;
+
+  for (size_t i = first; i <= last; ++i)
+    if (!vm_block_is_ram (vm, i) || (vm->protection[i] & protection) != protection)
+      return false;
+
+  return true;
+}
+
+
+// Tables are checked before the worker gets them, accesses past the memory are still dropped
+// rather than trusted to that.
+static word
+vm_ring_load (VM *vm, size_t address)
+{
+  if (address + sizeof (word) > vm->nmemory)
+    return 0;
+
+  return VM_WORD_PACK (vm->memory[address + 1], vm->memory[address]);
+}
+
+
+static void
+vm_ring_store (VM *vm, size_t address, word value)
+{
+  if (address + sizeof (word) > vm->nmemory)
+    return;
+
+  vm->memory[address + 0] = VM_WORD_L (value);
+  vm->memory[address + 1] = VM_WORD_H (value);
+}
+
+
+// The used index is the word the guest polls without the lock. It's stored last and with
+// release semantics, so the entries before it are visible to whoever acquires it.
+static void
+vm_ring_publish (VM *vm, size_t address, word value)
+{
+  if (address + sizeof (word) > vm->nmemory)
+    return;
+
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+  if (address % 2 == 0)
+    {
+      __atomic_store_n ((word *)&vm->memory[address], value, __ATOMIC_RELEASE);
+      return;
+    }
+#endif
+
+  __atomic_store_n (&vm->memory[address + 0], VM_WORD_L (value), __ATOMIC_RELEASE);
+  __atomic_store_n (&vm->memory[address + 1], VM_WORD_H (value), __ATOMIC_RELEASE);
+}
+
+
+// Processes descriptors outside the lock, then publishes the whole batch under it. Ring
+// addresses are the ones the doorbell checked, buffers are checked here.
+static void *
+vm_ring_worker (void *argument)
+{
+  VM_Ring *ring = argument;
+  VM *vm = ring->vm;
+
+  pthread_mutex_lock (&ring->mutex);
+
+  for (;;)
+    {
+      while (!ring->stop && ring->next == ring->target)
+        pthread_cond_wait (&ring->condition, &ring->mutex);
+
+      // Stopping still drains what was handed over.
+      if (ring->next == ring->target)
+        break;
+
+      word size = ring->tables.size, target = ring->target, next = ring->next;
+      word completed = ring->completed;
+      size_t descriptors = ring->tables.descriptors, available = ring->tables.available;
+      size_t used = ring->tables.used;
+
+      pthread_mutex_unlock (&ring->mutex);
+
+      for (; next != target; ++next, ++completed)
+        {
+          word index = vm_ring_load (vm, available + (1 + next % size) * sizeof (word)) % size;
+          size_t descriptor = descriptors + index * VM_RING_DESCRIPTOR_SIZE;
+
+          word address = vm_ring_load (vm, descriptor + 0);
+          word length = vm_ring_load (vm, descriptor + 2);
+          word flags = vm_ring_load (vm, descriptor + 4);
+          word argument = vm_ring_load (vm, descriptor + 6);
+
+          bool fill = flags & VM_RING_DESCRIPTOR_WRITE;
+          long moved = -1;
+
+          if (vm_ring_accessible (vm, address, length,
+                                  fill ? VM_PROTECTION_WRITE : VM_PROTECTION_READ))
+            moved = ring->transfer (ring, &vm->memory[address], length, fill, argument);
+
+          if (moved < 0)
+            flags |= VM_RING_DESCRIPTOR_ERROR, moved = 0;
+          else
+            flags &= ~VM_RING_DESCRIPTOR_ERROR;
+
+          vm_ring_store (vm, descriptor + 4, flags);
+
+          size_t entry = used + sizeof (word) + completed % size * VM_RING_USED_SIZE;
+
+          vm_ring_store (vm, entry + 0, index);
+          vm_ring_store (vm, entry + 2, moved);
+        }
+
+      pthread_mutex_lock (&ring->mutex);
+
+      vm_ring_publish (vm, used, completed);
+
+      ring->next = next;
+      ring->completed = completed;
+      ring->complete = true;
+      ring->busy = ring->next != ring->target;
+
+      pthread_cond_broadcast (&ring->condition);
+    }
+
+  pthread_mutex_unlock (&ring->mutex);
+
+  return NULL;
+}
+
+
+// Checks the tables as the registers hold them now, and hands that copy to the worker.
+static void
+vm_ring_doorbell (VM *vm, VM_Ring *ring)
+{
+  pthread_mutex_lock (&ring->mutex);
+
+  word size = ring->size;
+  word descriptors = ring->descriptors, available = ring->available, used = ring->used;
+
+  pthread_mutex_unlock (&ring->mutex);
+
+  if (size == 0)
+    return;
+
+  struct
+  {
+    word address;
+    size_t length;
+    byte protection;
+  } regions[] = {
+    { descriptors, size * VM_RING_DESCRIPTOR_SIZE, VM_PROTECTION_READ | VM_PROTECTION_WRITE },
+    { available, (1 + size) * sizeof (word), VM_PROTECTION_READ },
+    { used, sizeof (word) + size * VM_RING_USED_SIZE, VM_PROTECTION_READ | VM_PROTECTION_WRITE },
+  };
+
+  for (size_t i = 0; i < VM_ARRAY_SIZE (regions); ++i)
+    if (!vm_ring_accessible (vm, regions[i].address, regions[i].length, regions[i].protection))
+      {
+        vm_fault (vm, VM_ERROR_PROTECTION, regions[i].address);
+        return;
+      }
+
+  pthread_mutex_lock (&ring->mutex);
+
+  // A reset in between drained the worker, and the size it set is the one to check.
+  if (ring->size != size)
+    {
+      pthread_mutex_unlock (&ring->mutex);
+      return;
+    }
+
+  ring->tables.size = size;
+  ring->tables.descriptors = descriptors;
+  ring->tables.available = available;
+  ring->tables.used = used;
+
+  word target = vm_ring_load (vm, available);
+
+  // Rings that are never used never get a thread.
+  if (!ring->started && target != ring->next)
+    {
+      int error = pthread_create (&ring->thread, NULL, vm_ring_worker, ring);
+
+      if (error != 0)
+        {
+          fprintf (stderr, "Failed to start ring worker: %s\n", strerror (error));
+          pthread_mutex_unlock (&ring->mutex);
+          return;
+        }
+
+      ring->started = true;
+    }
+
+  ring->target = target;
+  ring->busy = ring->next != ring->target;
+
+  pthread_cond_broadcast (&ring->condition);
+  pthread_mutex_unlock (&ring->mutex);
+}
+
+
+// Waits for the worker to finish what it was given, the tables can't move under it.
+static void
+vm_ring_reset (VM_Ring *ring, word size)
+{
+  pthread_mutex_lock (&ring->mutex);
+
+  while (ring->next != ring->target)
+    pthread_cond_wait (&ring->condition, &ring->mutex);
+
+  ring->size = size && size <= VM_RING_MAX_SIZE && !(size & (size - 1)) ? size : 0;
+  ring->target = ring->next = ring->completed = 0;
+  ring->complete = ring->busy = false;
+
+  pthread_mutex_unlock (&ring->mutex);
+}
+
+
+static word
+vm_ring_read_word (VM *vm, VM_Device *device, word address)
+{
+  (void)vm;
+  VM_Ring *ring = device->state;
+  word value = 0;
+
+  pthread_mutex_lock (&ring->mutex);
+
+  switch (address % VM_DEVICE_BLOCK_SIZE)
+    {
+    case VM_RING_SIZE:
+      value = ring->size;
+      break;
+    case VM_RING_DESCRIPTORS:
+      value = ring->descriptors;
+      break;
+    case VM_RING_AVAILABLE:
+      value = ring->available;
+      break;
+    case VM_RING_USED:
+      value = ring->used;
+      break;
+    case VM_RING_COMPLETED:
+      value = ring->completed;
+      break;
+    case VM_RING_STATUS:
+      value = (ring->busy ? VM_RING_STATUS_BUSY : 0)
+              | (ring->complete ? VM_RING_STATUS_COMPLETE : 0);
+      ring->complete = false;
+      break;
+    }
+
+  pthread_mutex_unlock (&ring->mutex);
+
+  return value;
+}
+
+
+static void
+vm_ring_store_word (VM *vm, VM_Device *device, word address, word value)
+{
+  VM_Ring *ring = device->state;
+  word *field = NULL;
+
+  switch (address % VM_DEVICE_BLOCK_SIZE)
+    {
+    case VM_RING_SIZE:
+      vm_ring_reset (ring, value);
+      break;
+    case VM_RING_DESCRIPTORS:
+      field = &ring->descriptors;
+      break;
+    case VM_RING_AVAILABLE:
+      field = &ring->available;
+      break;
+    case VM_RING_USED:
+      field = &ring->used;
+      break;
+    case VM_RING_DOORBELL:
+      vm_ring_doorbell (vm, ring);
+      break;
+    }
+
+  // The worker takes its copy of the table addresses under the lock.
+  if (field)
+    {
+      pthread_mutex_lock (&ring->mutex);
+      *field = value;
+      pthread_mutex_unlock (&ring->mutex);
+    }
+}
+
+
+static byte
+vm_ring_read_byte (VM *vm, VM_Device *device, word address)
+{
+  if (address % 2)
+    return 0;
+
+  return VM_WORD_L (vm_ring_read_word (vm, device, address));
+}
+
+
+static void
+vm_ring_store_byte (VM *vm, VM_Device *device, word address, byte value)
+{
+  if (address % 2 == 0)
+    vm_ring_store_word (vm, device, address, value);
+}
+
+
+long
+vm_ring_file_transfer (VM_Ring *ring, byte *buffer, word length, bool fill, word argument)
+{
+  (void)argument;
+  VM_RingFile *file = ring->state;
+  ssize_t moved;
+
+  if (fill)
+    {
+      do
+        moved = read (file->input, buffer, length);
+      while (moved < 0 && errno == EINTR);
+
+      return moved;
+    }
+
+  size_t written = 0;
+
+  while (written < length)
+    {
+      moved = write (file->output, buffer + written, length - written);
+
+      if (moved < 0 && errno == EINTR)
+        continue;
+      if (moved <= 0)
+        return written ? (long)written : -1;
+
+      written += moved;
+    }
+
+  return written;
+}
+
+
+bool
+vm_ring_create (VM_Ring *ring, VM *vm,
+                long (*transfer) (VM_Ring *, byte *, word, bool, word), void *state)
+{
+  memset (ring, 0, sizeof (VM_Ring));
+
+  ring->vm = vm;
+  ring->transfer = transfer;
+  ring->state = state;
+
+  ring->device.read_byte = vm_ring_read_byte;
+  ring->device.read_word = vm_ring_read_word;
+  ring->device.store_byte = vm_ring_store_byte;
+  ring->device.store_word = vm_ring_store_word;
+  ring->device.state = ring;
+
+  pthread_mutex_init (&ring->mutex, NULL);
+  pthread_cond_init (&ring->condition, NULL);
+
+  return true;
+}
+
+
+void
+vm_ring_destroy (VM_Ring *ring)
+{
+  pthread_mutex_lock (&ring->mutex);
+  ring->stop = true;
+  pthread_cond_broadcast (&ring->condition);
+  pthread_mutex_unlock (&ring->mutex);
+
+  if (ring->started)
+    pthread_join (ring->thread, NULL);
+
+  pthread_cond_destroy (&ring->condition);
+  pthread_mutex_destroy (&ring->mutex);
+}
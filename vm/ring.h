@@ -0,0 +1,122 @@
+#ifndef VM_RING_H
+#define VM_RING_H
+
+
+#include "vm.h"
+#include <pthread.h>
+
+
+#define VM_RING_MAX_SIZE 256
+
+
+// Word registers, as offsets into the block the ring is mapped at.
+typedef enum
+{
+  // Entries in each table, a power of two up to VM_RING_MAX_SIZE. Storing it resets the ring.
+  VM_RING_SIZE = 0x00,
+  // Guest addresses of the descriptor table, the available ring and the used ring.
+  VM_RING_DESCRIPTORS = 0x02,
+  VM_RING_AVAILABLE = 0x04,
+  VM_RING_USED = 0x06,
+  // Stores hand every descriptor made available so far to the worker.
+  VM_RING_DOORBELL = 0x08,
+  // The used index, the entries below it have been written.
+  VM_RING_COMPLETED = 0x0A,
+  // `VM_RingStatus` bits.
+  VM_RING_STATUS = 0x0C,
+} VM_RingRegister;
+
+
+typedef enum
+{
+  // Descriptors are being processed.
+  VM_RING_STATUS_BUSY = 1 << 0,
+  // Descriptors completed since STATUS was last read.
+  VM_RING_STATUS_COMPLETE = 1 << 1,
+} VM_RingStatus;
+
+
+typedef enum
+{
+  // The device fills the buffer, otherwise it consumes it.
+  VM_RING_DESCRIPTOR_WRITE = 1 << 0,
+  // Set by the device when the transfer failed or the buffer isn't RAM with the right access.
+  VM_RING_DESCRIPTOR_ERROR = 1 << 15,
+} VM_RingDescriptorFlags;
+
+
+// Guest memory layout, all words little-endian like the rest of memory:
+//
+//   descriptor  { word address; word length; word flags; word argument; }  [SIZE]
+//   available   { word index; word ring[SIZE]; }
+//   used        { word index; struct { word descriptor; word length; } ring[SIZE]; }
+//
+// The guest fills descriptors, appends their indices to the available ring, bumps its index
+// and rings the doorbell. The worker thread transfers every buffer straight to or from guest
+// memory, appends each to the used ring, and publishes the used index once per batch with a
+// release store. Reading COMPLETED or STATUS, or a FADD of 0 on the used index, acquires it.
+// A plain load of the index orders nothing, like any other shared access.
+typedef struct VM_Ring VM_Ring;
+
+typedef struct VM_Ring
+{
+  VM_Device device;
+  VM *vm;
+
+  // Fills or consumes up to `length` bytes of `buffer`, returning how many or -1. `argument`
+  // is the descriptor's, for the backend to interpret. Runs on the worker thread.
+  long (*transfer) (VM_Ring *ring, byte *buffer, word length, bool fill, word argument);
+  void *state;
+
+  word size;
+  word descriptors;
+  word available;
+  word used;
+
+  // The tables as checked by the last doorbell, the only ones the worker uses. The guest can
+  // store other addresses to the registers at any time.
+  struct
+  {
+    word size;
+    word descriptors;
+    word available;
+    word used;
+  } tables;
+
+  // Available index up to which the worker has been asked to go, and where it is.
+  word target;
+  word next;
+
+  word completed;
+  bool complete;
+  bool busy;
+  bool stop;
+  bool started;
+
+  pthread_t thread;
+  pthread_mutex_t mutex;
+  pthread_cond_t condition;
+} VM_Ring;
+
+
+// Fills buffers from `input` and writes buffers to `output` of the `VM_RingFile` in `state`,
+// which may be the same descriptor for a file or a socket. The argument is ignored.
+typedef struct VM_RingFile
+{
+  int input;
+  int output;
+} VM_RingFile;
+
+long vm_ring_file_transfer (VM_Ring *ring, byte *buffer, word length, bool fill,
+                            word argument);
+
+
+// The worker starts on the first doorbell with descriptors to hand over. The ring is mapped
+// with `vm_map_device (vm, &ring->device, ...)`, destroying it waits for every descriptor the
+// doorbell handed over.
+bool vm_ring_create (VM_Ring *ring, VM *vm,
+                     long (*transfer) (VM_Ring *, byte *, word, bool, word), void *state);
+void vm_ring_destroy (VM_Ring *ring);
+
+
+#endif // VM_RING_H
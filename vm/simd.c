@@ -0,0 +1,179 @@
+#include "simd.h"
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+#if defined(__SSSE3__)
+#include <tmmintrin.h>
+#endif
+
+#if defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
+
+static inline byte
+vm_simd_lane (VM_Operation operation, byte a, byte b)
+{
+  switch (operation)
+    {
+    case VM_OPERATION_PADD:
+    case VM_OPERATION_VADD:
+      return a + b;
+    case VM_OPERATION_PSUB:
+    case VM_OPERATION_VSUB:
+      return a - b;
+    case VM_OPERATION_PCMPEQ:
+    case VM_OPERATION_VCMPEQ:
+      return a == b ? 0xFF : 0;
+    case VM_OPERATION_PCMPGT:
+    case VM_OPERATION_VCMPGT:
+      return a > b ? 0xFF : 0;
+    case VM_OPERATION_PMIN:
+    case VM_OPERATION_VMIN:
+      return a < b ? a : b;
+    default:
+      return a > b ? a : b;
+    }
+}
+
+
+static inline uint64_t
+vm_simd_shuffle (uint64_t a, uint64_t b, size_t nlane)
+{
+  uint64_t result = 0;
+
+  for (size_t i = 0; i < nlane; ++i)
+    {
+      size_t lane = (b >> i * 8) & (nlane - 1);
+      result |= ((a >> lane * 8) & 0xFF) << i * 8;
+    }
+
+  return result;
+}
+
+
+// The lane-wise operations on the host's SIMD unit, or one lane at a time without one. Lanes
+// past `nlane` are garbage.
+static inline uint64_t
+vm_simd_host (VM_Operation operation, uint64_t a, uint64_t b, size_t nlane)
+{
+#if defined(__SSE2__)
+  __m128i x = _mm_set_epi64x (0, a);
+  __m128i y = _mm_set_epi64x (0, b);
+  __m128i r;
+
+  // SSE2 only compares signed bytes, flipping their top bits compares them unsigned.
+  __m128i bias = _mm_set1_epi8 ((char)0x80);
+
+  switch (operation)
+    {
+    case VM_OPERATION_PADD:
+    case VM_OPERATION_VADD:
+      r = _mm_add_epi8 (x, y);
+      break;
+    case VM_OPERATION_PSUB:
+    case VM_OPERATION_VSUB:
+      r = _mm_sub_epi8 (x, y);
+      break;
+    case VM_OPERATION_PCMPEQ:
+    case VM_OPERATION_VCMPEQ:
+      r = _mm_cmpeq_epi8 (x, y);
+      break;
+    case VM_OPERATION_PCMPGT:
+    case VM_OPERATION_VCMPGT:
+      r = _mm_cmpgt_epi8 (_mm_xor_si128 (x, bias), _mm_xor_si128 (y, bias));
+      break;
+    case VM_OPERATION_PMIN:
+    case VM_OPERATION_VMIN:
+      r = _mm_min_epu8 (x, y);
+      break;
+    case VM_OPERATION_PMAX:
+    case VM_OPERATION_VMAX:
+      r = _mm_max_epu8 (x, y);
+      break;
+    default:
+#if defined(__SSSE3__)
+      r = _mm_shuffle_epi8 (x, _mm_and_si128 (y, _mm_set1_epi8 (nlane - 1)));
+      break;
+#else
+      return vm_simd_shuffle (a, b, nlane);
+#endif
+    }
+
+  uint64_t result;
+  _mm_storel_epi64 ((__m128i *)&result, r);
+
+  return result;
+#elif defined(__ARM_NEON)
+  uint8x8_t x = vcreate_u8 (a);
+  uint8x8_t y = vcreate_u8 (b);
+  uint8x8_t r;
+
+  switch (operation)
+    {
+    case VM_OPERATION_PADD:
+    case VM_OPERATION_VADD:
+      r = vadd_u8 (x, y);
+      break;
+    case VM_OPERATION_PSUB:
+    case VM_OPERATION_VSUB:
+      r = vsub_u8 (x, y);
+      break;
+    case VM_OPERATION_PCMPEQ:
+    case VM_OPERATION_VCMPEQ:
+      r = vceq_u8 (x, y);
+      break;
+    case VM_OPERATION_PCMPGT:
+    case VM_OPERATION_VCMPGT:
+      r = vcgt_u8 (x, y);
+      break;
+    case VM_OPERATION_PMIN:
+    case VM_OPERATION_VMIN:
+      r = vmin_u8 (x, y);
+      break;
+    case VM_OPERATION_PMAX:
+    case VM_OPERATION_VMAX:
+      r = vmax_u8 (x, y);
+      break;
+    default:
+      r = vtbl1_u8 (x, vand_u8 (y, vdup_n_u8 (nlane - 1)));
+      break;
+    }
+
+  return vget_lane_u64 (vreinterpret_u64_u8 (r), 0);
+#else
+  if (operation == VM_OPERATION_PSHUF || operation == VM_OPERATION_VSHUF)
+    return vm_simd_shuffle (a, b, nlane);
+
+  uint64_t result = 0;
+
+  for (size_t i = 0; i < nlane; ++i)
+    result |= (uint64_t)vm_simd_lane (operation, a >> i * 8, b >> i * 8) << i * 8;
+
+  return result;
+#endif
+}
+
+
+uint64_t
+vm_simd (VM_Operation operation, uint64_t a, uint64_t b, size_t nlane)
+{
+  uint64_t mask = nlane < VM_VECTOR_LANES ? ((uint64_t)1 << nlane * 8) - 1 : UINT64_MAX;
+
+  a &= mask;
+  b &= mask;
+
+  switch (operation)
+    {
+    case VM_OPERATION_VAND:
+      return a & b;
+    case VM_OPERATION_VOR:
+      return a | b;
+    case VM_OPERATION_VXOR:
+      return a ^ b;
+    default:
+      return vm_simd_host (operation, a, b, nlane) & mask;
+    }
+}
@@ -0,0 +1,28 @@
+#ifndef VM_SIMD_H
+#define VM_SIMD_H
+
+
+#include "vm.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+
+// Lanes of the packed operations on the word registers.
+#define VM_SIMD_PACKED_LANES 2
+
+
+// The lane-wise PADD ... PSHUF and VADD ... VXOR on the first `nlane` byte lanes of `a` and
+// `b`, lane 0 in the low byte, the other lanes of the result being 0. Lanes are unsigned,
+// comparisons set a lane to 0xFF when they hold and 0 otherwise, and a shuffle picks lane
+// `b[i] % nlane` of `a` for lane `i`. `nlane` is a power of two, at most VM_VECTOR_LANES.
+uint64_t vm_simd (VM_Operation operation, uint64_t a, uint64_t b, size_t nlane);
+
+
+#ifdef __cplusplus
+}
+#endif
+
+
+#endif // VM_SIMD_H
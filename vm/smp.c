@@ -0,0 +1,117 @@
+#include "smp.h"
+#include "tap.h"
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+
+typedef struct VM_SmpThread
+{
+  pthread_t thread;
+  VM *core;
+  const VM_Engine *engine;
+} VM_SmpThread;
+
+
+static void *
+vm_smp_thread (void *argument)
+{
+  VM_SmpThread *thread = argument;
+  vm_run (thread->core, thread->engine);
+  return NULL;
+}
+
+
+bool
+vm_smp_create (VM_Smp *smp, VM *vm, size_t ncore)
+{
+  memset (smp, 0, sizeof (VM_Smp));
+
+  if (ncore < 1)
+    ncore = 1;
+  if (ncore > VM_SMP_MAX_CORES)
+    ncore = VM_SMP_MAX_CORES;
+
+  // The other stacks lie below the first one, down to the bottom of the last.
+  if (ncore > 1)
+    {
+      size_t size = (ncore - 1) * VM_CORE_STACK_SIZE;
+
+      if (size > vm->stack)
+        {
+          fprintf (stderr, "Stacks of %zu cores don't fit below " VM_FMT_WORD "\n", ncore,
+                   vm->stack);
+          return false;
+        }
+
+      for (size_t block = (vm->stack - size) / VM_DEVICE_BLOCK_SIZE;
+           block <= vm->stack / VM_DEVICE_BLOCK_SIZE; ++block)
+        if (!vm_block_is_ram (vm, block) || !(vm->protection[block] & VM_PROTECTION_WRITE))
+          {
+            fprintf (stderr, "Stacks of %zu cores reach block " VM_FMT_WORD "\n", ncore,
+                     (word)(block * VM_DEVICE_BLOCK_SIZE));
+            return false;
+          }
+    }
+
+  smp->cores[0] = vm;
+  smp->ncore = ncore;
+
+  for (size_t i = 1; i < ncore; ++i)
+    {
+      smp->cores[i] = malloc (sizeof (VM));
+      vm_create_core (smp->cores[i], vm, i);
+    }
+
+  return true;
+}
+
+
+void
+vm_smp_destroy (VM_Smp *smp)
+{
+  for (size_t i = 1; i < smp->ncore; ++i)
+    {
+      vm_destroy (smp->cores[i]);
+      free (smp->cores[i]);
+    }
+
+  memset (smp, 0, sizeof (VM_Smp));
+}
+
+
+// Core 0 runs on the calling thread. A core whose thread can't be started runs there too,
+// after it.
+VM_Trap
+vm_smp_run (VM_Smp *smp, const VM_Engine *engine)
+{
+  VM_SmpThread threads[VM_SMP_MAX_CORES];
+  bool started[VM_SMP_MAX_CORES] = {0};
+
+  for (size_t i = 1; i < smp->ncore; ++i)
+    {
+      threads[i] = (VM_SmpThread){ .core = smp->cores[i], .engine = engine };
+
+      int error = pthread_create (&threads[i].thread, NULL, vm_smp_thread, &threads[i]);
+
+      if (error != 0)
+        fprintf (stderr, "Failed to start core %zu: %s\n", i, strerror (error));
+      else
+        started[i] = true;
+    }
+
+  vm_run (smp->cores[0], engine);
+
+  for (size_t i = 1; i < smp->ncore; ++i)
+    if (started[i])
+      pthread_join (threads[i].thread, NULL);
+    else
+      vm_run (smp->cores[i], engine);
+
+  for (size_t i = 0; i < smp->ncore; ++i)
+    if (smp->cores[i]->trap.error != VM_ERROR_NONE)
+      return smp->cores[i]->trap;
+
+  return smp->cores[0]->trap;
+}
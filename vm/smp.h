@@ -0,0 +1,33 @@
+#ifndef VM_SMP_H
+#define VM_SMP_H
+
+
+#include "vm.h"
+
+
+#define VM_SMP_MAX_CORES 64
+
+
+// Symmetric cores of one VM, each run by an engine on its own host thread. Core 0 is the VM
+// itself, the others are created with `vm_create_core` and start at the same IP, so the guest
+// tells them apart by their ID register. CAS and FADD are atomic, every other access to shared
+// memory is a plain host load or store: cores touching the same bytes race, and nothing orders
+// those accesses, FENCE included. The devices they share must be thread-safe.
+typedef struct VM_Smp
+{
+  VM *cores[VM_SMP_MAX_CORES];
+  size_t ncore;
+} VM_Smp;
+
+
+// Fails when a core's stack, `VM_CORE_STACK_SIZE` below the previous one, would wrap past 0 or
+// reach a block that isn't writable RAM.
+bool vm_smp_create (VM_Smp *smp, VM *vm, size_t ncore);
+void vm_smp_destroy (VM_Smp *smp);
+
+// Runs every core until all of them halted. Returns the trap of the first core that trapped,
+// each core's own is left in its `trap`.
+VM_Trap vm_smp_run (VM_Smp *smp, const VM_Engine *engine);
+
+
+#endif // VM_SMP_H
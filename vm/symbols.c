@@ -0,0 +1,243 @@
+#include "symbols.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+
+#define VM_SYMBOLS_LINE_SIZE 1024
+
+
+static void *
+vm_symbols_grow (void *xs, size_t n, size_t size)
+{
+  // Capacity starts at 16 and doubles whenever `n` reaches it.
+  if (n == 0)
+    return realloc (xs, 16 * size);
+  if (n < 16 || (n & (n - 1)) != 0)
+    return xs;
+  return realloc (xs, n * 2 * size);
+}
+
+
+static char *
+vm_symbols_copy (const char *string)
+{
+  size_t n = strlen (string) + 1;
+  return memcpy (malloc (n), string, n);
+}
+
+
+static const char *
+vm_symbols_intern (VM_Symbols *symbols, const char *file)
+{
+  for (size_t i = 0; i < symbols->nfile; ++i)
+    if (strcmp (symbols->files[i], file) == 0)
+      return symbols->files[i];
+
+  symbols->files = vm_symbols_grow (symbols->files, symbols->nfile,
+                                    sizeof (char *));
+  symbols->files[symbols->nfile] = vm_symbols_copy (file);
+
+  return symbols->files[symbols->nfile++];
+}
+
+
+static int
+vm_symbols_compare_label (const void *a, const void *b)
+{
+  const VM_Label *x = a, *y = b;
+  return (int)x->address - (int)y->address;
+}
+
+
+static int
+vm_symbols_compare_line (const void *a, const void *b)
+{
+  const VM_Line *x = a, *y = b;
+  return (int)x->start - (int)y->start;
+}
+
+
+bool
+vm_symbols_load (VM_Symbols *symbols, const char *path)
+{
+  FILE *file = fopen (path, "r");
+
+  if (!file)
+    {
+      perror ("Failed to open file");
+      return false;
+    }
+
+  memset (symbols, 0, sizeof (VM_Symbols));
+
+  char line[VM_SYMBOLS_LINE_SIZE];
+
+  while (fgets (line, sizeof line, file))
+    {
+      line[strcspn (line, "\n")] = 0;
+
+      unsigned int start, end;
+      int number, offset;
+      char kind[8];
+
+      if (sscanf (line, "label %x %n", &start, &offset) == 1)
+        {
+          symbols->labels = vm_symbols_grow (symbols->labels, symbols->nlabel,
+                                             sizeof (VM_Label));
+
+          VM_Label *label = &symbols->labels[symbols->nlabel++];
+          label->address = start;
+          label->name = vm_symbols_copy (line + offset);
+        }
+      else if (sscanf (line, "range %x %x %7s %d %n", &start, &end, kind,
+                       &number, &offset) == 4)
+        {
+          symbols->lines = vm_symbols_grow (symbols->lines, symbols->nline,
+                                            sizeof (VM_Line));
+
+          VM_Line *entry = &symbols->lines[symbols->nline++];
+          entry->start = start;
+          entry->end = end;
+          entry->code = strcmp (kind, "code") == 0;
+          entry->line = number;
+          entry->file = vm_symbols_intern (symbols, line + offset);
+        }
+    }
+
+  fclose (file);
+
+  // The assembler already emits sorted labels and ranges, but don't rely on it for lookups.
+  if (symbols->nlabel)
+    qsort (symbols->labels, symbols->nlabel, sizeof (VM_Label),
+           vm_symbols_compare_label);
+
+  if (symbols->nline)
+    qsort (symbols->lines, symbols->nline, sizeof (VM_Line),
+           vm_symbols_compare_line);
+
+  return true;
+}
+
+
+void
+vm_symbols_destroy (VM_Symbols *symbols)
+{
+  for (size_t i = 0; i < symbols->nlabel; ++i)
+    free (symbols->labels[i].name);
+
+  for (size_t i = 0; i < symbols->nfile; ++i)
+    free (symbols->files[i]);
+
+  free (symbols->labels);
+  free (symbols->lines);
+  free (symbols->files);
+
+  memset (symbols, 0, sizeof (VM_Symbols));
+}
+
+
+// Returns the enclosing label, i.e. the last label defined at or before `address`.
+VM_Label *
+vm_symbols_label (VM_Symbols *symbols, word address)
+{
+  size_t lo = 0, hi = symbols->nlabel;
+
+  while (lo < hi)
+    {
+      size_t mid = lo + (hi - lo) / 2;
+      if (symbols->labels[mid].address <= address)
+        lo = mid + 1;
+      else
+        hi = mid;
+    }
+
+  return lo ? &symbols->labels[lo - 1] : NULL;
+}
+
+
+VM_Label *
+vm_symbols_lookup (VM_Symbols *symbols, const char *name)
+{
+  for (size_t i = 0; i < symbols->nlabel; ++i)
+    if (strcmp (symbols->labels[i].name, name) == 0)
+      return &symbols->labels[i];
+
+  return NULL;
+}
+
+
+VM_Line *
+vm_symbols_line (VM_Symbols *symbols, word address)
+{
+  size_t lo = 0, hi = symbols->nline;
+
+  while (lo < hi)
+    {
+      size_t mid = lo + (hi - lo) / 2;
+      if (symbols->lines[mid].start <= address)
+        lo = mid + 1;
+      else
+        hi = mid;
+    }
+
+  if (lo && address < symbols->lines[lo - 1].end)
+    return &symbols->lines[lo - 1];
+
+  return NULL;
+}
+
+
+// Formats `address` as e.g. "factorial+0x4 (examples/dbg_09_factorial.asm:12)".
+int
+vm_symbols_format (VM_Symbols *symbols, word address, char *buffer, size_t n)
+{
+  VM_Label *label = vm_symbols_label (symbols, address);
+  VM_Line *line = vm_symbols_line (symbols, address);
+
+  int length = 0;
+
+  if (label && address != label->address)
+    length = snprintf (buffer, n, "%s+0x%x", label->name,
+                       address - label->address);
+  else if (label)
+    length = snprintf (buffer, n, "%s", label->name);
+  else
+    length = snprintf (buffer, n, VM_FMT_WORD, address);
+
+  if (line && (size_t)length < n)
+    length += snprintf (buffer + length, n - length, " (%s:%d)", line->file,
+                        line->line);
+
+  return length;
+}
+
+
+// Blocks holding code are readable and executable, and only writable when they also hold data.
+// Every other block is readable and writable, so running off the end of the code, or into the
+// stack, faults.
+void
+vm_symbols_protect (VM_Symbols *symbols, VM *vm)
+{
+  byte code[VM_DEVICE_BLOCK_COUNT] = {0};
+  byte data[VM_DEVICE_BLOCK_COUNT] = {0};
+
+  for (size_t i = 0; i < symbols->nline; ++i)
+    {
+      VM_Line *line = &symbols->lines[i];
+
+      for (size_t address = line->start; address < line->end;
+           address += VM_DEVICE_BLOCK_SIZE - address % VM_DEVICE_BLOCK_SIZE)
+        {
+          size_t block = address / VM_DEVICE_BLOCK_SIZE % VM_DEVICE_BLOCK_COUNT;
+          (line->code ? code : data)[block] = 1;
+        }
+    }
+
+  for (size_t i = 0; i < vm->ndevice; ++i)
+    if (code[i])
+      vm->protection[i] = VM_PROTECTION_READ | VM_PROTECTION_EXECUTE
+                          | (data[i] ? VM_PROTECTION_WRITE : 0);
+    else
+      vm->protection[i] = VM_PROTECTION_READ | VM_PROTECTION_WRITE;
+}
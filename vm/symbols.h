@@ -0,0 +1,54 @@
+#ifndef VM_SYMBOLS_H
+#define VM_SYMBOLS_H
+
+
+#include "vm.h"
+
+
+// A label emitted by the assembler, e.g. `factorial: ...` at 0x000a.
+typedef struct VM_Label
+{
+  word address;
+  char *name;
+} VM_Label;
+
+
+// The half-open byte range [start, end) produced by a single source line.
+typedef struct VM_Line
+{
+  word start;
+  size_t end;
+  bool code;
+  int line;
+  const char *file;
+} VM_Line;
+
+
+// Address to source attribution, loaded from the `.map` file written by `asm/assembler.py -m`.
+// Labels and lines are sorted by address.
+typedef struct VM_Symbols
+{
+  VM_Label *labels;
+  VM_Line *lines;
+  char **files;
+
+  size_t nlabel;
+  size_t nline;
+  size_t nfile;
+} VM_Symbols;
+
+
+bool vm_symbols_load (VM_Symbols *symbols, const char *path);
+void vm_symbols_destroy (VM_Symbols *symbols);
+
+VM_Label *vm_symbols_label (VM_Symbols *symbols, word address);
+VM_Label *vm_symbols_lookup (VM_Symbols *symbols, const char *name);
+VM_Line *vm_symbols_line (VM_Symbols *symbols, word address);
+
+int vm_symbols_format (VM_Symbols *symbols, word address, char *buffer, size_t n);
+
+// Sets the protection of every block from what the source map says it holds.
+void vm_symbols_protect (VM_Symbols *symbols, VM *vm);
+
+
+#endif // VM_SYMBOLS_H
@@ -0,0 +1,156 @@
+#include "tap.h"
+#include <string.h>
+
+
+static inline VM_Device *
+vm_tap_inner (VM_Tap *tap, word address)
+{
+  return tap->inner[address / VM_DEVICE_BLOCK_SIZE];
+}
+
+
+static byte
+vm_tap_read_byte (VM *vm, VM_Device *device, word address)
+{
+  VM_Tap *tap = device->state;
+  VM_Device *inner = vm_tap_inner (tap, address);
+
+  tap->depth++;
+  byte value = inner->read_byte (vm, inner, address);
+  tap->depth--;
+
+  if (tap->depth == 0 && tap->on_read)
+    tap->on_read (tap, vm, address, value, false);
+
+  return value;
+}
+
+
+static word
+vm_tap_read_word (VM *vm, VM_Device *device, word address)
+{
+  VM_Tap *tap = device->state;
+  VM_Device *inner = vm_tap_inner (tap, address);
+
+  tap->depth++;
+  word value = inner->read_word (vm, inner, address);
+  tap->depth--;
+
+  if (tap->depth == 0 && tap->on_read)
+    tap->on_read (tap, vm, address, value, true);
+
+  return value;
+}
+
+
+static void
+vm_tap_store_byte (VM *vm, VM_Device *device, word address, byte value)
+{
+  VM_Tap *tap = device->state;
+  VM_Device *inner = vm_tap_inner (tap, address);
+
+  if (tap->depth == 0 && tap->on_store)
+    tap->on_store (tap, vm, address, value, false);
+
+  tap->depth++;
+  inner->store_byte (vm, inner, address, value);
+  tap->depth--;
+}
+
+
+static void
+vm_tap_store_word (VM *vm, VM_Device *device, word address, word value)
+{
+  VM_Tap *tap = device->state;
+  VM_Device *inner = vm_tap_inner (tap, address);
+
+  if (tap->depth == 0 && tap->on_store)
+    tap->on_store (tap, vm, address, value, true);
+
+  tap->depth++;
+  inner->store_word (vm, inner, address, value);
+  tap->depth--;
+}
+
+
+void
+vm_tap_create (VM_Tap *tap)
+{
+  memset (tap, 0, sizeof (VM_Tap));
+
+  tap->device.read_byte = vm_tap_read_byte;
+  tap->device.read_word = vm_tap_read_word;
+  tap->device.store_byte = vm_tap_store_byte;
+  tap->device.store_word = vm_tap_store_word;
+  tap->device.state = tap;
+}
+
+
+// Same block range semantics as `vm_map_device`. Blocks already tapped are left alone.
+void
+vm_tap_attach (VM_Tap *tap, VM *vm, word start, word end)
+{
+  start /= VM_DEVICE_BLOCK_SIZE;
+  end /= VM_DEVICE_BLOCK_SIZE;
+
+  for (size_t i = start; i <= end; ++i)
+    if (vm->devices[i] != &tap->device)
+      {
+        tap->inner[i] = vm->devices[i];
+        vm->devices[i] = &tap->device;
+      }
+}
+
+
+void
+vm_tap_detach (VM_Tap *tap, VM *vm)
+{
+  for (size_t i = 0; i < vm->ndevice; ++i)
+    if (vm->devices[i] == &tap->device)
+      {
+        vm->devices[i] = tap->inner[i];
+        tap->inner[i] = NULL;
+      }
+}
+
+
+// Whether RAM backs the block, looking through the taps attached over it. Devices that move
+// bytes straight through `vm->memory` go by this, and the taps don't see those transfers.
+bool
+vm_block_is_ram (VM *vm, size_t block)
+{
+  VM_Device *device = vm->devices[block];
+
+  while (device->read_byte == vm_tap_read_byte)
+    device = ((VM_Tap *)device->state)->inner[block];
+
+  return device == &vm_device_ram;
+}
+
+
+static VM_Device *
+vm_untapped_device (VM *vm, word address)
+{
+  VM_Device *device = vm->devices[address / VM_DEVICE_BLOCK_SIZE];
+
+  while (device->read_byte == vm_tap_read_byte)
+    device = vm_tap_inner (device->state, address);
+
+  return device;
+}
+
+
+byte
+vm_peek_byte (VM *vm, word address)
+{
+  VM_Device *device = vm_untapped_device (vm, address);
+  return device->read_byte (vm, device, address);
+}
+
+
+void
+vm_poke_byte (VM *vm, word address, byte value)
+{
+  VM_Device *device = vm_untapped_device (vm, address);
+  device->store_byte (vm, device, address, value);
+}
@@ -0,0 +1,40 @@
+#ifndef VM_TAP_H
+#define VM_TAP_H
+
+
+#include "vm.h"
+
+
+typedef struct VM_Tap VM_Tap;
+
+
+// A device that observes every access to the blocks it is attached to, then forwards it to the
+// device that was mapped there before. Word accesses are reported once, even when the inner
+// device splits them into bytes.
+typedef struct VM_Tap
+{
+  VM_Device device;
+  VM_Device *inner[VM_DEVICE_BLOCK_COUNT];
+
+  void (*on_read) (VM_Tap *, VM *, word address, word value, bool wide);
+  void (*on_store) (VM_Tap *, VM *, word address, word value, bool wide);
+  void *state;
+
+  int depth;
+} VM_Tap;
+
+
+void vm_tap_create (VM_Tap *tap);
+
+void vm_tap_attach (VM_Tap *tap, VM *vm, word start, word end);
+void vm_tap_detach (VM_Tap *tap, VM *vm);
+
+bool vm_block_is_ram (VM *vm, size_t block);
+
+// Host accesses for debuggers, through the device map but neither counted, checked against
+// protection, nor seen by taps. The device still sees them, peeking at input consumes it.
+byte vm_peek_byte (VM *vm, word address);
+void vm_poke_byte (VM *vm, word address, byte value);
+
+
+#endif // VM_TAP_H
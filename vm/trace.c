@@ -0,0 +1,285 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include "trace.h"
+#include <stdlib.h>
+#include <string.h>
+
+
+#define VM_TRACE_RING_SIZE (1 << 20)
+
+// The VM thread publishes its records once this many bytes are pending.
+#define VM_TRACE_BATCH_SIZE 4096
+
+// Largest encoded record: header, opcode, count, then 5 bytes per write.
+#define VM_TRACE_MAX_RECORD (3 + 1 + 1 + VM_TRACE_MAX_WRITES * 5)
+
+
+// The writer sleeps while the ring is empty, until the VM publishes more records or finishes.
+static void
+vm_trace_wait_filled (VM_Trace *trace, size_t tail)
+{
+  pthread_mutex_lock (&trace->lock);
+  atomic_store (&trace->sleeping, true);
+
+  while (atomic_load (&trace->head) == tail && !atomic_load (&trace->done))
+    pthread_cond_wait (&trace->filled, &trace->lock);
+
+  atomic_store (&trace->sleeping, false);
+  pthread_mutex_unlock (&trace->lock);
+}
+
+
+static void *
+vm_trace_writer (void *argument)
+{
+  VM_Trace *trace = argument;
+  size_t tail = atomic_load_explicit (&trace->tail, memory_order_relaxed);
+
+  for (;;)
+    {
+      // Read `done` first, so everything published before it was set is seen below.
+      bool done = atomic_load (&trace->done);
+      size_t head = atomic_load (&trace->head);
+
+      if (head == tail)
+        {
+          if (done)
+            break;
+
+          vm_trace_wait_filled (trace, tail);
+          continue;
+        }
+
+      // Drain up to the end of the ring, the wrapped part goes on the next iteration.
+      size_t start = tail & (trace->capacity - 1);
+      size_t n = head - tail;
+
+      if (n > trace->capacity - start)
+        n = trace->capacity - start;
+
+      fwrite (trace->ring + start, 1, n, trace->file);
+
+      tail += n;
+      atomic_store (&trace->tail, tail);
+
+      if (atomic_load (&trace->stalled))
+        {
+          pthread_mutex_lock (&trace->lock);
+          pthread_cond_signal (&trace->drained);
+          pthread_mutex_unlock (&trace->lock);
+        }
+    }
+
+  return NULL;
+}
+
+
+static void
+vm_trace_on_store (VM_Tap *tap, VM *vm, word address, word value, bool wide)
+{
+  (void)vm;
+  VM_Trace *trace = tap->state;
+
+  if (trace->nwrites < VM_TRACE_MAX_WRITES)
+    trace->writes[trace->nwrites++] = (VM_TraceWrite){ address, value, wide };
+}
+
+
+bool
+vm_trace_create (VM_Trace *trace, VM *vm, const char *path)
+{
+  memset (trace, 0, sizeof (VM_Trace));
+
+  trace->file = fopen (path, "wb");
+
+  if (!trace->file)
+    {
+      perror ("Failed to open file");
+      return false;
+    }
+
+  fwrite (VM_TRACE_MAGIC, 1, strlen (VM_TRACE_MAGIC), trace->file);
+
+  trace->capacity = VM_TRACE_RING_SIZE;
+  trace->ring = malloc (trace->capacity);
+
+  atomic_init (&trace->head, 0);
+  atomic_init (&trace->tail, 0);
+  atomic_init (&trace->done, false);
+  atomic_init (&trace->sleeping, false);
+  atomic_init (&trace->stalled, false);
+
+  pthread_mutex_init (&trace->lock, NULL);
+  pthread_cond_init (&trace->filled, NULL);
+  pthread_cond_init (&trace->drained, NULL);
+
+  int error = pthread_create (&trace->writer, NULL, vm_trace_writer, trace);
+
+  if (error != 0)
+    {
+      fprintf (stderr, "Failed to start trace writer: %s\n", strerror (error));
+      free (trace->ring);
+      fclose (trace->file);
+      return false;
+    }
+
+  // Every store goes through the tap, whichever device it ends up in.
+  vm_tap_create (&trace->tap);
+  trace->tap.on_store = vm_trace_on_store;
+  trace->tap.state = trace;
+
+  vm_tap_attach (&trace->tap, vm, 0, vm->nmemory - 1);
+
+  trace->previous = 0;
+
+  return true;
+}
+
+
+static void
+vm_trace_wake (VM_Trace *trace)
+{
+  pthread_mutex_lock (&trace->lock);
+  pthread_cond_signal (&trace->filled);
+  pthread_mutex_unlock (&trace->lock);
+}
+
+
+static inline void
+vm_trace_publish (VM_Trace *trace)
+{
+  atomic_store (&trace->head, trace->local_head);
+
+  if (atomic_load (&trace->sleeping))
+    vm_trace_wake (trace);
+}
+
+
+bool
+vm_trace_destroy (VM_Trace *trace, VM *vm)
+{
+  vm_tap_detach (&trace->tap, vm);
+
+  vm_trace_publish (trace);
+  atomic_store (&trace->done, true);
+  vm_trace_wake (trace);
+
+  pthread_join (trace->writer, NULL);
+
+  pthread_mutex_destroy (&trace->lock);
+  pthread_cond_destroy (&trace->filled);
+  pthread_cond_destroy (&trace->drained);
+
+  bool ok = !ferror (trace->file);
+
+  if (!ok)
+    perror ("Failed to write trace");
+
+  if (fclose (trace->file) != 0)
+    {
+      perror ("Failed to close trace");
+      ok = false;
+    }
+
+  free (trace->ring);
+  trace->ring = NULL;
+  trace->file = NULL;
+
+  return ok;
+}
+
+
+static inline size_t
+vm_trace_varint (byte *buffer, uint32_t value)
+{
+  size_t n = 0;
+
+  while (value >= 0x80)
+    {
+      buffer[n++] = (value & 0x7F) | 0x80;
+      value >>= 7;
+    }
+
+  buffer[n++] = value;
+
+  return n;
+}
+
+
+static void
+vm_trace_emit (VM_Trace *trace, const byte *record, size_t n)
+{
+  // Only reload the writer's position when the cached one says the ring is full.
+  if (trace->capacity - (trace->local_head - trace->cached_tail) < n)
+    {
+      vm_trace_publish (trace);
+      trace->cached_tail = atomic_load (&trace->tail);
+    }
+
+  if (trace->capacity - (trace->local_head - trace->cached_tail) < n)
+    {
+      pthread_mutex_lock (&trace->lock);
+      atomic_store (&trace->stalled, true);
+
+      while (trace->capacity - (trace->local_head - atomic_load (&trace->tail)) < n)
+        pthread_cond_wait (&trace->drained, &trace->lock);
+
+      atomic_store (&trace->stalled, false);
+      pthread_mutex_unlock (&trace->lock);
+
+      trace->cached_tail = atomic_load (&trace->tail);
+    }
+
+  size_t start = trace->local_head & (trace->capacity - 1);
+  size_t first = n < trace->capacity - start ? n : trace->capacity - start;
+
+  memcpy (trace->ring + start, record, first);
+  memcpy (trace->ring, record + first, n - first);
+
+  trace->local_head += n;
+
+  if (trace->local_head - atomic_load_explicit (&trace->head, memory_order_relaxed)
+      >= VM_TRACE_BATCH_SIZE)
+    vm_trace_publish (trace);
+}
+
+
+// Executes one operation and appends its record.
+void
+vm_trace_step (VM_Trace *trace, VM *vm)
+{
+  word ip = *vm->ip;
+  byte opcode = vm_peek_byte (vm, ip);
+
+  trace->nwrites = 0;
+  vm_step (vm);
+
+  byte record[VM_TRACE_MAX_RECORD];
+  size_t n = 0;
+
+  int delta = (int16_t)(word)(ip - trace->previous);
+  uint32_t zigzag = delta < 0 ? ((uint32_t)-delta << 1) - 1 : (uint32_t)delta << 1;
+
+  n += vm_trace_varint (record + n, zigzag << 1 | (trace->nwrites > 0));
+  record[n++] = opcode;
+
+  if (trace->nwrites > 0)
+    n += vm_trace_varint (record + n, trace->nwrites);
+
+  for (size_t i = 0; i < trace->nwrites; ++i)
+    {
+      VM_TraceWrite *write = &trace->writes[i];
+
+      record[n++] = write->wide;
+      record[n++] = VM_WORD_L (write->address);
+      record[n++] = VM_WORD_H (write->address);
+      record[n++] = VM_WORD_L (write->value);
+
+      if (write->wide)
+        record[n++] = VM_WORD_H (write->value);
+    }
+
+  vm_trace_emit (trace, record, n);
+
+  trace->previous = ip;
+}
@@ -0,0 +1,77 @@
+#ifndef VM_TRACE_H
+#define VM_TRACE_H
+
+
+#include "tap.h"
+#include "vm.h"
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdio.h>
+
+
+#define VM_TRACE_MAGIC "VMTRACE1"
+
+// Stores past this many within one operation are dropped from its record, PUSHA makes 8.
+#define VM_TRACE_MAX_WRITES 16
+
+
+// One store captured while the current operation executes.
+typedef struct VM_TraceWrite
+{
+  word address;
+  word value;
+  bool wide;
+} VM_TraceWrite;
+
+
+// Streams one record per operation to a file. The VM thread encodes records into a
+// single-producer single-consumer ring buffer, and a writer thread drains it to the file, so
+// the VM only ever blocks when the writer falls a full ring behind. Neither side takes the lock
+// unless the other one is asleep.
+//
+// After the magic, each record is:
+//   varint  zigzag (ip - previous ip) << 1 | has writes, one byte for straight-line code
+//   byte    opcode
+//   varint  number of writes, when present
+//   writes  byte 0 (byte store) or 1 (word store), 16-bit address, 8 or 16-bit value
+//
+// Multi-byte values are little endian and varints hold 7 bits per byte, low bits first.
+typedef struct VM_Trace
+{
+  FILE *file;
+  pthread_t writer;
+
+  byte *ring;
+  size_t capacity;
+
+  // `head` only moves on the VM thread and `tail` only on the writer thread.
+  _Atomic size_t head;
+  _Atomic size_t tail;
+  _Atomic bool done;
+
+  pthread_mutex_t lock;
+  pthread_cond_t filled;
+  pthread_cond_t drained;
+  _Atomic bool sleeping;
+  _Atomic bool stalled;
+
+  // The VM thread's private view, published to `head` in batches.
+  size_t local_head;
+  size_t cached_tail;
+
+  VM_Tap tap;
+  VM_TraceWrite writes[VM_TRACE_MAX_WRITES];
+  size_t nwrites;
+
+  word previous;
+} VM_Trace;
+
+
+bool vm_trace_create (VM_Trace *trace, VM *vm, const char *path);
+bool vm_trace_destroy (VM_Trace *trace, VM *vm);
+
+void vm_trace_step (VM_Trace *trace, VM *vm);
+
+
+#endif // VM_TRACE_H
@@ -1,4 +1,6 @@
 #include "vm.h"
+#include "simd.h"
+#include "tap.h"
 #include <ctype.h>
 #include <stdarg.h>
 #include <stdio.h>
@@ -19,8 +21,23 @@ VM_Device vm_device_ram = {
 };
 
 
+static byte vm_counter_read_byte (VM *vm, VM_Device *device, word address);
+static void vm_counter_store_byte (VM *vm, VM_Device *device, word address, byte value);
+
+
+// Guest view of the counters, mapped at the start of a block. Reads return the snapshot taken
+// by the last store, which leaves the counters themselves untouched.
+VM_Device vm_device_counter = {
+  .read_byte = vm_counter_read_byte,
+  .read_word = vm_default_read_word,
+  .store_byte = vm_counter_store_byte,
+  .store_word = vm_default_store_word,
+  .state = NULL,
+};
+
+
 static const char *const VM_REGISTER_NAME[] = {
-  "ip", "sp", "bp", "ac", "r1", "r2", "r3", "r4", "r5", "r6", "r7", "r8",
+  "ip", "sp", "bp", "ac", "r1", "r2", "r3", "r4", "r5", "r6", "r7", "r8", "id",
 };
 
 
@@ -96,12 +113,224 @@ static const char *const VM_OPERATION_NAME[] = {
   "HALT",
   "PRINT_I",
   "PRINT_R",
+  "CAS",
+  "FADD",
+  "FENCE",
+  "VERSION",
+  "MOV_P",
+  "CMP_P",
+  "CMP_B",
+  "ADD_P",
+  "SUB_P",
+  "MUL_P",
+  "AND_P",
+  "OR_P",
+  "XOR_P",
+  "SHL_P",
+  "SHR_P",
+  "ADD_B",
+  "SUB_B",
+  "SHL_B",
+  "JMP_S",
+  "JEQ_S",
+  "JNE_S",
+  "JLT_S",
+  "JGT_S",
+  "JLE_S",
+  "JGE_S",
+  "CALL_S",
+  "MOV_R_RD",
+  "MOV_R_RX",
+  "MOV_RD_R",
+  "MOV_RX_R",
+  "MOVB_R_RD",
+  "MOVB_R_RX",
+  "MOVB_RD_R",
+  "MOVB_RX_R",
+  "FMUL_I",
+  "FMUL_R",
+  "FDIV_I",
+  "FDIV_R",
+  "MULW_I",
+  "MULW_R",
+  "PADD",
+  "PSUB",
+  "PCMPEQ",
+  "PCMPGT",
+  "PMIN",
+  "PMAX",
+  "PSHUF",
+  "VLD",
+  "VST",
+  "VSPLAT",
+  "VADD",
+  "VSUB",
+  "VCMPEQ",
+  "VCMPGT",
+  "VMIN",
+  "VMAX",
+  "VSHUF",
+  "VAND",
+  "VOR",
+  "VXOR",
+};
+
+
+// Operand layout of each operation, used for decoding without executing:
+//   r  register          i  16-bit immediate    b  8-bit immediate
+//   m  [16-bit address]  M  [register]          p  two registers, one per nibble
+//   o  signed 8-bit offset from the end of the operation
+//   D  [register + 16-bit displacement]          X  [register + register], one per nibble
+//   v  vector register
+static const char *const VM_OPERATION_OPERANDS[] = {
+  "",      // NOP
+  "ri",    // MOV_R_I
+  "rr",    // MOV_R_R
+  "rm",    // MOV_R_IM
+  "rM",    // MOV_R_RM
+  "mi",    // MOV_IM_I
+  "mr",    // MOV_IM_R
+  "mm",    // MOV_IM_IM
+  "mM",    // MOV_IM_RM
+  "Mi",    // MOV_RM_I
+  "Mr",    // MOV_RM_R
+  "Mm",    // MOV_RM_IM
+  "MM",    // MOV_RM_RM
+  "rb",    // MOVB_R_I
+  "rr",    // MOVB_R_R
+  "rm",    // MOVB_R_IM
+  "rM",    // MOVB_R_RM
+  "mb",    // MOVB_IM_I
+  "mr",    // MOVB_IM_R
+  "mm",    // MOVB_IM_IM
+  "mM",    // MOVB_IM_RM
+  "Mb",    // MOVB_RM_I
+  "Mr",    // MOVB_RM_R
+  "Mm",    // MOVB_RM_IM
+  "MM",    // MOVB_RM_RM
+  "i",     // PUSH_I
+  "r",     // PUSH_R
+  "r",     // POP
+  "",      // PUSHA
+  "",      // POPA
+  "rri",   // ADD_I
+  "rrr",   // ADD_R
+  "rri",   // SUB_I
+  "rrr",   // SUB_R
+  "rri",   // MUL_I
+  "rrr",   // MUL_R
+  "rri",   // DIV_I
+  "rrr",   // DIV_R
+  "rri",   // AND_I
+  "rrr",   // AND_R
+  "rri",   // OR_I
+  "rrr",   // OR_R
+  "rri",   // XOR_I
+  "rrr",   // XOR_R
+  "rr",    // NOT
+  "rri",   // SHL_I
+  "rrr",   // SHL_R
+  "rri",   // SHR_I
+  "rrr",   // SHR_R
+  "ri",    // CMP_I
+  "rr",    // CMP_R
+  "i",     // JMP_I
+  "r",     // JMP_R
+  "i",     // JEQ_I
+  "r",     // JEQ_R
+  "i",     // JNE_I
+  "r",     // JNE_R
+  "i",     // JLT_I
+  "r",     // JLT_R
+  "i",     // JGT_I
+  "r",     // JGT_R
+  "i",     // JLE_I
+  "r",     // JLE_R
+  "i",     // JGE_I
+  "r",     // JGE_R
+  "i",     // CALL_I
+  "r",     // CALL_R
+  "",      // RET
+  "",      // HALT
+  "i",     // PRINT_I
+  "r",     // PRINT_R
+  "rMr",   // CAS
+  "rMr",   // FADD
+  "",      // FENCE
+  "b",     // VERSION
+  "p",     // MOV_P
+  "p",     // CMP_P
+  "rb",    // CMP_B
+  "pr",    // ADD_P
+  "pr",    // SUB_P
+  "pr",    // MUL_P
+  "pr",    // AND_P
+  "pr",    // OR_P
+  "pr",    // XOR_P
+  "pr",    // SHL_P
+  "pr",    // SHR_P
+  "pb",    // ADD_B
+  "pb",    // SUB_B
+  "pb",    // SHL_B
+  "o",     // JMP_S
+  "o",     // JEQ_S
+  "o",     // JNE_S
+  "o",     // JLT_S
+  "o",     // JGT_S
+  "o",     // JLE_S
+  "o",     // JGE_S
+  "o",     // CALL_S
+  "rD",    // MOV_R_RD
+  "rX",    // MOV_R_RX
+  "Dr",    // MOV_RD_R
+  "Xr",    // MOV_RX_R
+  "rD",    // MOVB_R_RD
+  "rX",    // MOVB_R_RX
+  "Dr",    // MOVB_RD_R
+  "Xr",    // MOVB_RX_R
+  "rri",   // FMUL_I
+  "rrr",   // FMUL_R
+  "rri",   // FDIV_I
+  "rrr",   // FDIV_R
+  "rri",   // MULW_I
+  "rrr",   // MULW_R
+  "rrr",   // PADD
+  "rrr",   // PSUB
+  "rrr",   // PCMPEQ
+  "rrr",   // PCMPGT
+  "rrr",   // PMIN
+  "rrr",   // PMAX
+  "rrr",   // PSHUF
+  "vM",    // VLD
+  "Mv",    // VST
+  "vr",    // VSPLAT
+  "vvv",   // VADD
+  "vvv",   // VSUB
+  "vvv",   // VCMPEQ
+  "vvv",   // VCMPGT
+  "vvv",   // VMIN
+  "vvv",   // VMAX
+  "vvv",   // VSHUF
+  "vvv",   // VAND
+  "vvv",   // VOR
+  "vvv",   // VXOR
 };
 
 
 static const char *const VM_ERROR_NAME[] = {
   "none",
   "illegal operation",
+  "protection fault",
+  "division by zero",
+};
+
+
+static const char *const VM_COUNTER_NAME[] = {
+  "instructions",
+  "branches_taken",
+  "branches_not_taken",
+  "calls",
+  "stack_high_water",
 };
 
 
@@ -111,9 +340,15 @@ static_assert (VM_ARRAY_SIZE (VM_REGISTER_NAME) == VM_REGISTER_COUNT,
 static_assert (VM_ARRAY_SIZE (VM_OPERATION_NAME) == VM_OPERATION_COUNT,
                "items not aligned in VM_OPERATION_NAME");
 
+static_assert (VM_ARRAY_SIZE (VM_OPERATION_OPERANDS) == VM_OPERATION_COUNT,
+               "items not aligned in VM_OPERATION_OPERANDS");
+
 static_assert (VM_ARRAY_SIZE (VM_ERROR_NAME) == VM_ERROR_COUNT,
                "items not aligned in VM_ERROR_NAME");
 
+static_assert (VM_ARRAY_SIZE (VM_COUNTER_NAME) == VM_COUNTER_COUNT,
+               "items not aligned in VM_COUNTER_NAME");
+
 
 static inline char *
 vm_module_name (size_t index, size_t n, const char *const xs[n])
@@ -143,6 +378,13 @@ vm_error_name (VM_Error index)
 }
 
 
+char *
+vm_counter_name (VM_Counter index)
+{
+  return vm_module_name (index, VM_COUNTER_COUNT, VM_COUNTER_NAME);
+}
+
+
 void
 vm_create (VM *vm)
 {
@@ -155,24 +397,65 @@ vm_create (VM *vm)
   vm->ip = &vm->registers[VM_REGISTER_IP];
   vm->sp = &vm->registers[VM_REGISTER_SP];
   vm->bp = &vm->registers[VM_REGISTER_BP];
+  vm->stack = *vm->sp;
 
+  vm->primary = NULL;
   vm->memory = calloc (vm->nmemory, sizeof (byte));
   vm->devices = calloc (vm->ndevice, sizeof (VM_Device *));
+  vm->protection = malloc (vm->ndevice);
 
   vm->halt = false;
+  vm->trap = (VM_Trap){ VM_ERROR_NONE, 0, 0 };
+  vm->on_trap = NULL;
+  vm->trap_state = NULL;
+
+  memset (&vm->stats, 0, sizeof (VM_Stats));
+  memset (vm->counters, 0, sizeof vm->counters);
 
   vm_map_device (vm, &vm_device_ram, 0, vm->nmemory - 1);
+  vm_protect (vm, 0, vm->nmemory - 1, VM_PROTECTION_ALL);
+}
+
+
+// Another core of `vm`, with its own registers, flags, counters and trap, and `id` in its ID
+// register. Memory, devices and protection stay shared, so `vm` must outlive it.
+void
+vm_create_core (VM *core, VM *vm, word id)
+{
+  memset (core, 0, sizeof (VM));
+
+  core->nmemory = vm->nmemory;
+  core->ndevice = vm->ndevice;
+  core->memory = vm->memory;
+  core->devices = vm->devices;
+  core->protection = vm->protection;
+  core->primary = vm;
+
+  core->ip = &core->registers[VM_REGISTER_IP];
+  core->sp = &core->registers[VM_REGISTER_SP];
+  core->bp = &core->registers[VM_REGISTER_BP];
+
+  *core->ip = *vm->ip;
+  *core->sp = vm->stack - id * VM_CORE_STACK_SIZE;
+  *core->bp = *core->sp;
+  core->registers[VM_REGISTER_ID] = id;
+  core->stack = *core->sp;
 }
 
 
 void
 vm_destroy (VM *vm)
 {
-  free (vm->memory);
-  free (vm->devices);
+  if (!vm->primary)
+    {
+      free (vm->memory);
+      free (vm->devices);
+      free (vm->protection);
+    }
 
   vm->memory = NULL;
   vm->devices = NULL;
+  vm->protection = NULL;
 
   vm->nmemory = 0;
   vm->ndevice = 0;
@@ -250,6 +533,84 @@ vm_map_device (VM *vm, VM_Device *device, word start, word end)
 }
 
 
+// Same block range semantics as `vm_map_device`.
+void
+vm_protect (VM *vm, word start, word end, byte protection)
+{
+  start /= VM_DEVICE_BLOCK_SIZE;
+  end /= VM_DEVICE_BLOCK_SIZE;
+
+  for (size_t i = start; i <= end; ++i)
+    vm->protection[i] = protection;
+}
+
+
+// Only the first fault is kept, the rest of the faulting operation may fault again. The engine
+// completes the trap with the operation's address once it's done.
+void
+vm_fault (VM *vm, VM_Error error, word address)
+{
+  if (vm->trap.error == VM_ERROR_NONE)
+    {
+      vm->trap.error = error;
+      vm->trap.address = address;
+    }
+
+  vm->halt = true;
+}
+
+
+// Called by the engines when the operation at `ip` halted the VM, which is a trap when it
+// faulted. A handled trap is cleared and the VM resumes.
+void
+vm_trap (VM *vm, word ip)
+{
+  if (vm->trap.error == VM_ERROR_NONE)
+    return;
+
+  vm->trap.ip = ip;
+
+  if (vm->trap.error != VM_ERROR_PROTECTION)
+    vm->trap.address = ip;
+
+  if (vm->on_trap && vm->on_trap (vm, &vm->trap))
+    {
+      vm->trap = (VM_Trap){ VM_ERROR_NONE, 0, 0 };
+      vm->halt = false;
+    }
+}
+
+
+// Called by the engines instead of fetching from the block at `ip` without the execute right.
+// Resuming on the same fetch would fault forever, so a handled trap only resumes the VM when
+// the handler moved IP or made the block executable.
+void
+vm_fetch_fault (VM *vm, word ip)
+{
+  vm_fault (vm, VM_ERROR_PROTECTION, ip);
+  vm_trap (vm, ip);
+
+  if (!vm->halt && *vm->ip == ip
+      && !(vm->protection[ip / VM_DEVICE_BLOCK_SIZE] & VM_PROTECTION_EXECUTE))
+    {
+      vm_fault (vm, VM_ERROR_PROTECTION, ip);
+      vm->trap.ip = ip;
+    }
+}
+
+
+static inline bool
+vm_allows (VM *vm, word address, bool wide, byte protection)
+{
+  if ((vm->protection[address / VM_DEVICE_BLOCK_SIZE] & protection)
+      && (!wide || (vm->protection[(word)(address + 1) / VM_DEVICE_BLOCK_SIZE] & protection)))
+    return true;
+
+  vm_fault (vm, VM_ERROR_PROTECTION, address);
+  return false;
+}
+
+
 static inline VM_Device *
 vm_find_device (VM *vm, word address)
 {
@@ -257,6 +618,24 @@ vm_find_device (VM *vm, word address)
 }
 
 
+// Device accesses that don't count towards the stats, used for instruction fetches and for
+// the bytes of a word that a device splits up.
+static inline byte
+vm_device_read_byte (VM *vm, word address)
+{
+  VM_Device *device = vm_find_device (vm, address);
+  return device->read_byte (vm, device, address);
+}
+
+
+static inline void
+vm_device_store_byte (VM *vm, word address, byte value)
+{
+  VM_Device *device = vm_find_device (vm, address);
+  device->store_byte (vm, device, address, value);
+}
+
+
 byte
 vm_default_read_byte (VM *vm, VM_Device *device, word address)
 {
@@ -269,8 +648,8 @@ word
 vm_default_read_word (VM *vm, VM_Device *device, word address)
 {
   (void)device;
-  const byte L = vm_read_byte (vm, address + 0);
-  const byte H = vm_read_byte (vm, address + 1);
+  const byte L = vm_device_read_byte (vm, address + 0);
+  const byte H = vm_device_read_byte (vm, address + 1);
   return VM_WORD_PACK (H, L);
 }
 
@@ -289,47 +668,61 @@ vm_default_store_word (VM *vm, VM_Device *device, word address, word value)
   (void)device;
   const byte L = VM_WORD_L (value);
   const byte H = VM_WORD_H (value);
-  vm_store_byte (vm, address + 0, L);
-  vm_store_byte (vm, address + 1, H);
+  vm_device_store_byte (vm, address + 0, L);
+  vm_device_store_byte (vm, address + 1, H);
 }
 
 
 byte
 vm_read_byte (VM *vm, word address)
 {
-  VM_Device *device = vm_find_device (vm, address);
-  return device->read_byte (vm, device, address);
+  if (!vm_allows (vm, address, false, VM_PROTECTION_READ))
+    return 0;
+
+  vm->stats.reads[address / VM_DEVICE_BLOCK_SIZE]++;
+  return vm_device_read_byte (vm, address);
 }
 
 
 word
 vm_read_word (VM *vm, word address)
 {
+  if (!vm_allows (vm, address, true, VM_PROTECTION_READ))
+    return 0;
+
+  vm->stats.reads[address / VM_DEVICE_BLOCK_SIZE]++;
   VM_Device *device = vm_find_device (vm, address);
   return device->read_word (vm, device, address);
 }
 
 
+// A register byte past the last register is illegal, the operation goes on with the scratch
+// register in its place.
 word
 vm_read_register_value (VM *vm, word address)
 {
-  byte index = vm_read_byte (vm, address);
-  return vm->registers[index];
+  return *vm_read_register_address (vm, address);
 }
 
 
 word *
 vm_read_register_address (VM *vm, word address)
 {
-  byte index = vm_read_byte (vm, address);
-  return &vm->registers[index];
+  byte index = vm_device_read_byte (vm, address);
+
+  if (index < VM_REGISTER_COUNT)
+    return &vm->registers[index];
+
+  vm_fault (vm, VM_ERROR_ILLEGAL_OPERATION, 0);
+  vm->scratch = 0;
+  return &vm->scratch;
 }
 
 
 byte
 vm_next_byte (VM *vm)
 {
-  return vm_read_byte (vm, (*vm->ip)++);
+  return vm_device_read_byte (vm, (*vm->ip)++);
 }
 
 
@@ -356,27 +749,118 @@ vm_next_register_address (VM *vm)
 }
 
 
+// Register pairs are checked like the whole register bytes, an index past the last one is
+// illegal.
+static inline bool
+vm_check_register (VM *vm, byte index)
+{
+  if (index < VM_REGISTER_COUNT)
+    return true;
+
+  vm_fault (vm, VM_ERROR_ILLEGAL_OPERATION, 0);
+  return false;
+}
+
+
+// Splits the next byte into the two registers it packs, high nibble first.
+bool
+vm_next_register_pair (VM *vm, byte *high, byte *low)
+{
+  byte pair = vm_next_byte (vm);
+
+  *high = pair >> 4;
+  *low = pair & 0xF;
+
+  return vm_check_register (vm, *high) && vm_check_register (vm, *low);
+}
+
+
+// Vector registers are checked like the v2 ones, an index past the last one is illegal.
+static bool
+vm_next_vector (VM *vm, uint64_t **vector)
+{
+  byte index = vm_next_byte (vm);
+
+  if (index < VM_VECTOR_COUNT)
+    {
+      *vector = &vm->vectors[index];
+      return true;
+    }
+
+  vm_fault (vm, VM_ERROR_ILLEGAL_OPERATION, 0);
+  return false;
+}
+
+
+// Target of a short branch, relative to the end of the operation.
+word
+vm_next_target (VM *vm)
+{
+  int8_t offset = vm_next_byte (vm);
+  return *vm->ip + offset;
+}
+
+
+// The register is read right past its byte, like any other.
+word
+vm_next_displacement_address (VM *vm)
+{
+  word base = vm_next_register_value (vm);
+  return base + vm_next_word (vm);
+}
+
+
+// Both registers are packed in one byte, like a register pair.
+bool
+vm_next_indexed_address (VM *vm, word *address)
+{
+  byte base, index;
+
+  if (!vm_next_register_pair (vm, &base, &index))
+    return false;
+
+  *address = vm->registers[base] + vm->registers[index];
+  return true;
+}
+
+
 void
 vm_store_byte (VM *vm, word address, byte value)
 {
-  VM_Device *device = vm_find_device (vm, address);
-  device->store_byte (vm, device, address, value);
+  if (!vm_allows (vm, address, false, VM_PROTECTION_WRITE))
+    return;
+
+  vm->stats.stores[address / VM_DEVICE_BLOCK_SIZE]++;
+  vm_device_store_byte (vm, address, value);
 }
 
 
 void
 vm_store_word (VM *vm, word address, word value)
 {
+  if (!vm_allows (vm, address, true, VM_PROTECTION_WRITE))
+    return;
+
+  vm->stats.stores[address / VM_DEVICE_BLOCK_SIZE]++;
   VM_Device *device = vm_find_device (vm, address);
   device->store_word (vm, device, address, value);
 }
 
 
+static inline void
+vm_track_stack (VM *vm)
+{
+  if (*vm->sp < vm->stack && vm->stack - *vm->sp > vm->stats.stack_high_water)
+    vm->stats.stack_high_water = vm->stack - *vm->sp;
+}
+
+
 void
 vm_push_byte (VM *vm, byte value)
 {
   vm_store_byte (vm, *vm->sp, value);
   *vm->sp -= VM_STACK_POINTER_DELTA;
+  vm_track_stack (vm);
 }
 
 
@@ -385,6 +869,7 @@ vm_push_word (VM *vm, word value)
 {
   vm_store_word (vm, *vm->sp, value);
   *vm->sp -= VM_STACK_POINTER_DELTA;
+  vm_track_stack (vm);
 }
 
 
@@ -412,11 +897,147 @@ vm_compare (VM *vm, word a, word b)
 }
 
 
+word
+vm_fixed_multiply (word a, word b)
+{
+  return ((int32_t)(int16_t)a * (int16_t)b) >> VM_FIXED_BITS;
+}
+
+
+word
+vm_fixed_divide (word a, word b)
+{
+  return (int32_t)(int16_t)a * (1 << VM_FIXED_BITS) / (int16_t)b;
+}
+
+
 void
 vm_jump (VM *vm, word address, bool condition)
 {
   if (condition)
-    *vm->ip = address;
+    {
+      *vm->ip = address;
+      vm->stats.branches_taken++;
+    }
+  else
+    vm->stats.branches_not_taken++;
+}
+
+
+// Word accesses to RAM at even addresses are lock-free. Anything else goes through the devices
+// under a global lock, which only makes it atomic with respect to other atomic operations.
+static bool vm_atomic_lock;
+
+
+static inline bool
+vm_atomic_native (VM *vm, word address)
+{
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+  byte protection = vm->protection[address / VM_DEVICE_BLOCK_SIZE];
+
+  return address % 2 == 0 && vm->devices[address / VM_DEVICE_BLOCK_SIZE] == &vm_device_ram
+         && (protection & VM_PROTECTION_READ) && (protection & VM_PROTECTION_WRITE);
+#else
+  (void)vm, (void)address;
+  return false;
+#endif
+}
+
+
+static inline void
+vm_atomic_acquire (void)
+{
+  while (__atomic_test_and_set (&vm_atomic_lock, __ATOMIC_ACQUIRE))
+    ;
+}
+
+
+static inline void
+vm_atomic_release (void)
+{
+  __atomic_clear (&vm_atomic_lock, __ATOMIC_RELEASE);
+}
+
+
+// Returns the value found at `address`, `desired` was stored when it equals `expected`.
+static word
+vm_atomic_cas (VM *vm, word address, word expected, word desired)
+{
+  if (vm_atomic_native (vm, address))
+    {
+      word *target = (word *)&vm->memory[address];
+      word found = expected;
+
+      vm->stats.reads[address / VM_DEVICE_BLOCK_SIZE]++;
+
+      if (__atomic_compare_exchange_n (target, &found, desired, false, __ATOMIC_SEQ_CST,
+                                       __ATOMIC_SEQ_CST))
+        vm->stats.stores[address / VM_DEVICE_BLOCK_SIZE]++;
+
+      return found;
+    }
+
+  vm_atomic_acquire ();
+
+  word found = vm_read_word (vm, address);
+
+  if (found == expected)
+    vm_store_word (vm, address, desired);
+
+  vm_atomic_release ();
+
+  return found;
+}
+
+
+// Returns the value found at `address` before adding `value` to it.
+static word
+vm_atomic_fadd (VM *vm, word address, word value)
+{
+  if (vm_atomic_native (vm, address))
+    {
+      vm->stats.reads[address / VM_DEVICE_BLOCK_SIZE]++;
+      vm->stats.stores[address / VM_DEVICE_BLOCK_SIZE]++;
+      return __atomic_fetch_add ((word *)&vm->memory[address], value, __ATOMIC_SEQ_CST);
+    }
+
+  vm_atomic_acquire ();
+
+  word found = vm_read_word (vm, address);
+  vm_store_word (vm, address, found + value);
+
+  vm_atomic_release ();
+
+  return found;
+}
+
+
+// Arithmetic shared by the packed and short forms of an operation.
+static word
+vm_arithmetic (VM_Operation operation, word a, word b)
+{
+  switch (operation)
+    {
+    case VM_OPERATION_ADD_P:
+    case VM_OPERATION_ADD_B:
+      return a + b;
+    case VM_OPERATION_SUB_P:
+    case VM_OPERATION_SUB_B:
+      return a - b;
+    case VM_OPERATION_MUL_P:
+      return a * b;
+    case VM_OPERATION_AND_P:
+      return a & b;
+    case VM_OPERATION_OR_P:
+      return a | b;
+    case VM_OPERATION_XOR_P:
+      return a ^ b;
+    case VM_OPERATION_SHL_P:
+    case VM_OPERATION_SHL_B:
+      return a << b;
+    default:
+      return a >> b;
+    }
 }
 
 
@@ -686,6 +1307,11 @@ vm_execute (VM *vm, VM_Operation operation)
         word *dest = vm_next_register_address (vm);
         word src1 = vm_next_register_value (vm);
         word src2 = vm_next_word (vm);
+        if (src2 == 0)
+          {
+            vm_fault (vm, VM_ERROR_DIVISION_BY_ZERO, 0);
+            break;
+          }
         vm->registers[VM_REGISTER_AC] = src1 % src2;
         *dest = src1 / src2;
       }
@@ -695,6 +1321,11 @@ vm_execute (VM *vm, VM_Operation operation)
         word *dest = vm_next_register_address (vm);
         word src1 = vm_next_register_value (vm);
         word src2 = vm_next_register_value (vm);
+        if (src2 == 0)
+          {
+            vm_fault (vm, VM_ERROR_DIVISION_BY_ZERO, 0);
+            break;
+          }
         vm->registers[VM_REGISTER_AC] = src1 % src2;
         *dest = src1 / src2;
       }
@@ -889,6 +1520,7 @@ vm_execute (VM *vm, VM_Operation operation)
         word address = vm_next_word (vm);
         vm_push_word (vm, *vm->ip);
         *vm->ip = address;
+        vm->stats.calls++;
       }
       break;
     case VM_OPERATION_CALL_R:
@@ -896,6 +1528,7 @@ vm_execute (VM *vm, VM_Operation operation)
         word address = vm_next_register_value (vm);
         vm_push_word (vm, *vm->ip);
         *vm->ip = address;
+        vm->stats.calls++;
       }
       break;
     case VM_OPERATION_RET:
@@ -916,8 +1549,283 @@ vm_execute (VM *vm, VM_Operation operation)
         printf ("%d\n", value);
       }
       break;
+    case VM_OPERATION_CAS:
+      {
+        word *expected = vm_next_register_address (vm);
+        word address = vm_next_register_value (vm);
+        word desired = vm_next_register_value (vm);
+        word found = vm_atomic_cas (vm, address, *expected, desired);
+        vm->flags.z = found == *expected;
+        *expected = found;
+      }
+      break;
+    case VM_OPERATION_FADD:
+      {
+        word *dest = vm_next_register_address (vm);
+        word address = vm_next_register_value (vm);
+        word value = vm_next_register_value (vm);
+        *dest = vm_atomic_fadd (vm, address, value);
+      }
+      break;
+    case VM_OPERATION_FENCE:
+      __atomic_thread_fence (__ATOMIC_SEQ_CST);
+      break;
+    case VM_OPERATION_VERSION:
+      {
+        byte version = vm_next_byte (vm);
+        if (version > VM_VERSION)
+          vm_fault (vm, VM_ERROR_ILLEGAL_OPERATION, 0);
+      }
+      break;
+    case VM_OPERATION_MOV_P:
+      {
+        byte dest, src;
+        if (vm_next_register_pair (vm, &dest, &src))
+          vm->registers[dest] = vm->registers[src];
+      }
+      break;
+    case VM_OPERATION_CMP_P:
+      {
+        byte a, b;
+        if (vm_next_register_pair (vm, &a, &b))
+          vm_compare (vm, vm->registers[a], vm->registers[b]);
+      }
+      break;
+    case VM_OPERATION_CMP_B:
+      {
+        word a = vm_next_register_value (vm);
+        byte b = vm_next_byte (vm);
+        vm_compare (vm, a, b);
+      }
+      break;
+    case VM_OPERATION_ADD_P:
+    case VM_OPERATION_SUB_P:
+    case VM_OPERATION_MUL_P:
+    case VM_OPERATION_AND_P:
+    case VM_OPERATION_OR_P:
+    case VM_OPERATION_XOR_P:
+    case VM_OPERATION_SHL_P:
+    case VM_OPERATION_SHR_P:
+      {
+        byte dest, src1;
+        bool valid = vm_next_register_pair (vm, &dest, &src1);
+        byte src2 = vm_next_byte (vm);
+        if (!valid || !vm_check_register (vm, src2))
+          break;
+        vm->registers[dest] = vm_arithmetic (operation, vm->registers[src1],
+                                             vm->registers[src2]);
+      }
+      break;
+    case VM_OPERATION_ADD_B:
+    case VM_OPERATION_SUB_B:
+    case VM_OPERATION_SHL_B:
+      {
+        byte dest, src1;
+        bool valid = vm_next_register_pair (vm, &dest, &src1);
+        byte b = vm_next_byte (vm);
+        if (!valid)
+          break;
+        vm->registers[dest] = vm_arithmetic (operation, vm->registers[src1], b);
+      }
+      break;
+    case VM_OPERATION_JMP_S:
+      *vm->ip = vm_next_target (vm);
+      break;
+    case VM_OPERATION_JEQ_S:
+      vm_jump (vm, vm_next_target (vm), vm->flags.z == 1);
+      break;
+    case VM_OPERATION_JNE_S:
+      vm_jump (vm, vm_next_target (vm), vm->flags.z == 0);
+      break;
+    case VM_OPERATION_JLT_S:
+      vm_jump (vm, vm_next_target (vm), vm->flags.c == 1);
+      break;
+    case VM_OPERATION_JGT_S:
+      vm_jump (vm, vm_next_target (vm), vm->flags.z == 0 && vm->flags.c == 0);
+      break;
+    case VM_OPERATION_JLE_S:
+      vm_jump (vm, vm_next_target (vm), vm->flags.z == 1 || vm->flags.c == 1);
+      break;
+    case VM_OPERATION_JGE_S:
+      vm_jump (vm, vm_next_target (vm), vm->flags.c == 0);
+      break;
+    case VM_OPERATION_CALL_S:
+      {
+        word address = vm_next_target (vm);
+        vm_push_word (vm, *vm->ip);
+        *vm->ip = address;
+        vm->stats.calls++;
+      }
+      break;
+    case VM_OPERATION_MOV_R_RD:
+      {
+        word *dest = vm_next_register_address (vm);
+        word address = vm_next_displacement_address (vm);
+        *dest = vm_read_word (vm, address);
+      }
+      break;
+    case VM_OPERATION_MOV_R_RX:
+      {
+        word *dest = vm_next_register_address (vm);
+        word address;
+        if (vm_next_indexed_address (vm, &address))
+          *dest = vm_read_word (vm, address);
+      }
+      break;
+    case VM_OPERATION_MOV_RD_R:
+      {
+        word dest = vm_next_displacement_address (vm);
+        word value = vm_next_register_value (vm);
+        vm_store_word (vm, dest, value);
+      }
+      break;
+    case VM_OPERATION_MOV_RX_R:
+      {
+        word dest;
+        bool valid = vm_next_indexed_address (vm, &dest);
+        word value = vm_next_register_value (vm);
+        if (valid)
+          vm_store_word (vm, dest, value);
+      }
+      break;
+    case VM_OPERATION_MOVB_R_RD:
+      {
+        word *dest = vm_next_register_address (vm);
+        word address = vm_next_displacement_address (vm);
+        *dest = vm_read_byte (vm, address);
+      }
+      break;
+    case VM_OPERATION_MOVB_R_RX:
+      {
+        word *dest = vm_next_register_address (vm);
+        word address;
+        if (vm_next_indexed_address (vm, &address))
+          *dest = vm_read_byte (vm, address);
+      }
+      break;
+    case VM_OPERATION_MOVB_RD_R:
+      {
+        word dest = vm_next_displacement_address (vm);
+        byte value = vm_next_register_value (vm);
+        vm_store_byte (vm, dest, value);
+      }
+      break;
+    case VM_OPERATION_MOVB_RX_R:
+      {
+        word dest;
+        bool valid = vm_next_indexed_address (vm, &dest);
+        byte value = vm_next_register_value (vm);
+        if (valid)
+          vm_store_byte (vm, dest, value);
+      }
+      break;
+    case VM_OPERATION_FMUL_I:
+    case VM_OPERATION_FMUL_R:
+      {
+        word *dest = vm_next_register_address (vm);
+        word src1 = vm_next_register_value (vm);
+        word src2 = operation == VM_OPERATION_FMUL_I ? vm_next_word (vm)
+                                                     : vm_next_register_value (vm);
+        *dest = vm_fixed_multiply (src1, src2);
+      }
+      break;
+    case VM_OPERATION_FDIV_I:
+    case VM_OPERATION_FDIV_R:
+      {
+        word *dest = vm_next_register_address (vm);
+        word src1 = vm_next_register_value (vm);
+        word src2 = operation == VM_OPERATION_FDIV_I ? vm_next_word (vm)
+                                                     : vm_next_register_value (vm);
+        if (src2 == 0)
+          {
+            vm_fault (vm, VM_ERROR_DIVISION_BY_ZERO, 0);
+            break;
+          }
+        *dest = vm_fixed_divide (src1, src2);
+      }
+      break;
+    case VM_OPERATION_MULW_I:
+    case VM_OPERATION_MULW_R:
+      {
+        word *dest = vm_next_register_address (vm);
+        word src1 = vm_next_register_value (vm);
+        word src2 = operation == VM_OPERATION_MULW_I ? vm_next_word (vm)
+                                                     : vm_next_register_value (vm);
+        uint32_t product = (uint32_t)src1 * src2;
+        vm->registers[VM_REGISTER_AC] = product >> 16;
+        *dest = product;
+      }
+      break;
+    case VM_OPERATION_PADD:
+    case VM_OPERATION_PSUB:
+    case VM_OPERATION_PCMPEQ:
+    case VM_OPERATION_PCMPGT:
+    case VM_OPERATION_PMIN:
+    case VM_OPERATION_PMAX:
+    case VM_OPERATION_PSHUF:
+      {
+        word *dest = vm_next_register_address (vm);
+        word src1 = vm_next_register_value (vm);
+        word src2 = vm_next_register_value (vm);
+        *dest = vm_simd (operation, src1, src2, VM_SIMD_PACKED_LANES);
+      }
+      break;
+    case VM_OPERATION_VLD:
+      {
+        uint64_t *dest;
+        bool valid = vm_next_vector (vm, &dest);
+        word address = vm_next_register_value (vm);
+        if (!valid)
+          break;
+        uint64_t value = 0;
+        for (int i = 0; i < VM_VECTOR_LANES; ++i)
+          value |= (uint64_t)vm_read_byte (vm, address + i) << i * 8;
+        *dest = value;
+      }
+      break;
+    case VM_OPERATION_VST:
+      {
+        word address = vm_next_register_value (vm);
+        uint64_t *src;
+        if (!vm_next_vector (vm, &src))
+          break;
+        for (int i = 0; i < VM_VECTOR_LANES; ++i)
+          vm_store_byte (vm, address + i, *src >> i * 8);
+      }
+      break;
+    case VM_OPERATION_VSPLAT:
+      {
+        uint64_t *dest;
+        bool valid = vm_next_vector (vm, &dest);
+        byte value = vm_next_register_value (vm);
+        if (!valid)
+          break;
+        *dest = (uint64_t)value * 0x0101010101010101;
+      }
+      break;
+    case VM_OPERATION_VADD:
+    case VM_OPERATION_VSUB:
+    case VM_OPERATION_VCMPEQ:
+    case VM_OPERATION_VCMPGT:
+    case VM_OPERATION_VMIN:
+    case VM_OPERATION_VMAX:
+    case VM_OPERATION_VSHUF:
+    case VM_OPERATION_VAND:
+    case VM_OPERATION_VOR:
+    case VM_OPERATION_VXOR:
+      {
+        uint64_t *dest, *src1, *src2;
+        bool valid = vm_next_vector (vm, &dest);
+        valid &= vm_next_vector (vm, &src1);
+        valid &= vm_next_vector (vm, &src2);
+        if (!valid)
+          break;
+        *dest = vm_simd (operation, *src1, *src2, VM_VECTOR_LANES);
+      }
+      break;
     default:
-      exit (VM_ERROR_ILLEGAL_OPERATION);
+      vm_fault (vm, VM_ERROR_ILLEGAL_OPERATION, 0);
+      break;
     }
 }
 
@@ -925,7 +1833,251 @@ vm_execute (VM *vm, VM_Operation operation)
 void
 vm_step (VM *vm)
 {
+  word ip = *vm->ip;
+
+  if (!(vm->protection[ip / VM_DEVICE_BLOCK_SIZE] & VM_PROTECTION_EXECUTE))
+    {
+      vm_fetch_fault (vm, ip);
+      return;
+    }
+
+  vm->stats.instructions++;
+  vm->stats.executes[ip / VM_DEVICE_BLOCK_SIZE]++;
   vm_execute (vm, vm_next_byte (vm));
+
+  if (vm->halt)
+    vm_trap (vm, ip);
+}
+
+
+// Control transfers terminate a basic block; execution continues at a possibly new address.
+bool
+vm_operation_ends_block (VM_Operation operation)
+{
+  return (operation >= VM_OPERATION_JMP_I && operation <= VM_OPERATION_RET)
+         || (operation >= VM_OPERATION_JMP_S && operation <= VM_OPERATION_CALL_S)
+         || operation == VM_OPERATION_HALT;
+}
+
+
+// Encoded size in bytes, opcode included.
+word
+vm_operation_size (VM_Operation operation)
+{
+  if (operation >= VM_OPERATION_COUNT)
+    return 1;
+
+  word size = 1;
+
+  for (const char *s = VM_OPERATION_OPERANDS[operation]; *s; ++s)
+    size += *s == 'D' ? 3 : *s == 'i' || *s == 'm' ? 2 : 1;
+
+  return size;
+}
+
+
+// The reference engine, stepping through the block one `vm_execute` at a time.
+size_t
+vm_run_block (VM *vm)
+{
+  size_t n = 0;
+
+  while (!vm->halt)
+    {
+      word ip = *vm->ip;
+
+      if (!(vm->protection[ip / VM_DEVICE_BLOCK_SIZE] & VM_PROTECTION_EXECUTE))
+        {
+          vm_fetch_fault (vm, ip);
+          continue;
+        }
+
+      vm->stats.instructions++;
+      vm->stats.executes[ip / VM_DEVICE_BLOCK_SIZE]++;
+
+      VM_Operation operation = vm_next_byte (vm);
+      vm_execute (vm, operation);
+      n++;
+
+      if (vm->halt)
+        vm_trap (vm, ip);
+
+      if (vm_operation_ends_block (operation))
+        break;
+    }
+
+  return n;
+}
+
+
+const VM_Engine vm_engines[] = {
+  { .name = "reference", .run_block = vm_run_block },
+  { .name = "fast", .run_block = vm_fast_run_block },
+};
+
+const size_t vm_nengine = VM_ARRAY_SIZE (vm_engines);
+
+
+// Runs until the VM halts, returning the trap that halted it, if any.
+VM_Trap
+vm_run (VM *vm, const VM_Engine *engine)
+{
+  while (!vm->halt)
+    engine->run_block (vm);
+
+  return vm->trap;
+}
+
+
+const VM_Engine *
+vm_find_engine (const char *name)
+{
+  for (size_t i = 0; i < vm_nengine; ++i)
+    if (strcmp (vm_engines[i].name, name) == 0)
+      return &vm_engines[i];
+
+  return NULL;
+}
+
+
+// Decodes the operation at `address` without executing it, e.g. "mov_r_im r1 [0x0100]".
+// Returns the size of the operation in bytes.
+word
+vm_disassemble (VM *vm, word address, char *buffer, size_t n)
+{
+  VM_Operation operation = vm_peek_byte (vm, address);
+  word size = 1;
+
+  if (operation >= VM_OPERATION_COUNT)
+    {
+      snprintf (buffer, n, "invalid " VM_FMT_BYTE, operation);
+      return size;
+    }
+
+  int length = 0;
+  for (const char *s = vm_operation_name (operation); *s && (size_t)length < n; ++s)
+    buffer[length++] = tolower (*s);
+
+  for (const char *s = VM_OPERATION_OPERANDS[operation]; *s; ++s)
+    {
+      if ((size_t)length >= n)
+        break;
+
+      byte index = vm_peek_byte (vm, address + size);
+      word value = VM_WORD_PACK (vm_peek_byte (vm, address + size + 1), index);
+
+      switch (*s)
+        {
+        case 'r':
+          length += snprintf (buffer + length, n - length, " %s",
+                              vm_register_name (index));
+          size += 1;
+          break;
+        case 'M':
+          length += snprintf (buffer + length, n - length, " [%s]",
+                              vm_register_name (index));
+          size += 1;
+          break;
+        case 'D':
+          length += snprintf (buffer + length, n - length, " [%s + 0x" VM_FMT_WORD "]",
+                              vm_register_name (index),
+                              VM_WORD_PACK (vm_peek_byte (vm, address + size + 2),
+                                            vm_peek_byte (vm, address + size + 1)));
+          size += 3;
+          break;
+        case 'X':
+          length += snprintf (buffer + length, n - length, " [%s + %s]",
+                              vm_register_name (index >> 4),
+                              vm_register_name (index & 0xF));
+          size += 1;
+          break;
+        case 'o':
+          length += snprintf (buffer + length, n - length, " 0x" VM_FMT_WORD,
+                              (word)(address + size + 1 + (int8_t)index));
+          size += 1;
+          break;
+        case 'v':
+          length += snprintf (buffer + length, n - length, " v%d", index);
+          size += 1;
+          break;
+        case 'p':
+          length += snprintf (buffer + length, n - length, " %s %s",
+                              vm_register_name (index >> 4),
+                              vm_register_name (index & 0xF));
+          size += 1;
+          break;
+        case 'b':
+          length += snprintf (buffer + length, n - length, " 0x" VM_FMT_BYTE,
+                              index);
+          size += 1;
+          break;
+        case 'i':
+          length += snprintf (buffer + length, n - length, " 0x" VM_FMT_WORD,
+                              value);
+          size += 2;
+          break;
+        case 'm':
+          length += snprintf (buffer + length, n - length, " [0x" VM_FMT_WORD "]",
+                              value);
+          size += 2;
+          break;
+        }
+    }
+
+  if ((size_t)length >= n)
+    length = n - 1;
+  buffer[length] = 0;
+
+  return size;
+}
+
+
+void
+vm_get_stats (VM *vm, VM_Stats *stats)
+{
+  memcpy (stats, &vm->stats, sizeof (VM_Stats));
+}
+
+
+// Sums the accesses of every block `device` is mapped to.
+void
+vm_get_device_stats (VM *vm, VM_Device *device, uint64_t *reads, uint64_t *stores)
+{
+  *reads = 0;
+  *stores = 0;
+
+  for (size_t i = 0; i < vm->ndevice; ++i)
+    if (vm->devices[i] == device)
+      {
+        *reads += vm->stats.reads[i];
+        *stores += vm->stats.stores[i];
+      }
+}
+
+
+static byte
+vm_counter_read_byte (VM *vm, VM_Device *device, word address)
+{
+  (void)device;
+  size_t offset = address % VM_DEVICE_BLOCK_SIZE;
+
+  if (offset >= sizeof vm->counters)
+    return 0;
+
+  return vm->counters[offset / sizeof (uint64_t)] >> (offset % sizeof (uint64_t) * 8);
+}
+
+
+static void
+vm_counter_store_byte (VM *vm, VM_Device *device, word address, byte value)
+{
+  (void)device, (void)address, (void)value;
+
+  vm->counters[VM_COUNTER_INSTRUCTIONS] = vm->stats.instructions;
+  vm->counters[VM_COUNTER_BRANCHES_TAKEN] = vm->stats.branches_taken;
+  vm->counters[VM_COUNTER_BRANCHES_NOT_TAKEN] = vm->stats.branches_not_taken;
+  vm->counters[VM_COUNTER_CALLS] = vm->stats.calls;
+  vm->counters[VM_COUNTER_STACK_HIGH_WATER] = vm->stats.stack_high_water;
 }
 
 
@@ -946,7 +2098,7 @@ vm_view_register (VM *vm, VM_Register index)
         printf (" '%c'", value);
       else
         printf ("    ");
-      printf (" %.8f", (value / (float)(1 << 8)));
+      printf (" %.8f", (value / (float)(1 << VM_FIXED_BITS)));
     }
 
   printf ("\n");
@@ -965,7 +2117,7 @@ vm_view_memory (VM *vm, word address, word b, word a, int decode)
     printf (".. ");
 
   for (size_t i = address - below; i <= address + above; ++i)
-    printf (VM_FMT_BYTE " ", vm->memory[i]);
+    printf (VM_FMT_BYTE " ", vm_peek_byte (vm, i));
 
   for (size_t i = 0; i < a - above; ++i)
     printf (".. ");
@@ -978,7 +2130,7 @@ vm_view_memory (VM *vm, word address, word b, word a, int decode)
     case 1: // Decode operation
       {
         printf ("^");
-        VM_Operation operation = vm->memory[address];
+        VM_Operation operation = vm_peek_byte (vm, address);
         printf ("~ %s", vm_operation_name (operation));
       }
       break;
@@ -986,7 +2138,7 @@ vm_view_memory (VM *vm, word address, word b, word a, int decode)
       {
         for (size_t i = address; i <= address + above; ++i)
           {
-            char c = vm->memory[i];
+            char c = vm_peek_byte (vm, i);
             if (isprint (c))
               printf ("%c  ", c);
             else
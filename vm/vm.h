@@ -8,6 +8,11 @@
 #include <stdint.h>
 
 
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+
 #define VM_FMT_BYTE "%02x"
 #define VM_FMT_WORD "%04x"
 
@@ -17,8 +22,23 @@
 
 #define VM_ARRAY_SIZE(xs) (sizeof (xs) / sizeof ((xs)[0]))
 
+// Cores created by `vm_create_core` start their stacks this far apart.
+#define VM_CORE_STACK_SIZE 0x400
+
+// Newest encoding the decoder understands. ROMs using a later one start with a VERSION
+// operation naming it, which older decoders reject as illegal.
+#define VM_VERSION 2
+
+// Fraction bits of the signed fixed-point format of FMUL and FDIV, 8.8 like asm/stdx.asm.
+#define VM_FIXED_BITS 8
+
+// Vector registers, each VM_VECTOR_LANES byte lanes wide with lane 0 in the low byte.
+#define VM_VECTOR_COUNT 8
+#define VM_VECTOR_LANES 8
+
 // Each device can be mapped to blocks of size VM_DEVICE_BLOCK_SIZE bytes.
 #define VM_DEVICE_BLOCK_SIZE 0x100
+#define VM_DEVICE_BLOCK_COUNT (0x10000 / VM_DEVICE_BLOCK_SIZE)
 
 
 typedef uint8_t byte;
@@ -42,6 +62,7 @@ typedef enum
   VM_REGISTER_R6,
   VM_REGISTER_R7,
   VM_REGISTER_R8,
+  VM_REGISTER_ID,
   VM_REGISTER_COUNT,
 } VM_Register;
 
@@ -119,19 +140,114 @@ typedef enum
   VM_OPERATION_HALT,
   VM_OPERATION_PRINT_I,
   VM_OPERATION_PRINT_R,
+  VM_OPERATION_CAS,
+  VM_OPERATION_FADD,
+  VM_OPERATION_FENCE,
+  VM_OPERATION_VERSION,
+  VM_OPERATION_MOV_P,
+  VM_OPERATION_CMP_P,
+  VM_OPERATION_CMP_B,
+  VM_OPERATION_ADD_P,
+  VM_OPERATION_SUB_P,
+  VM_OPERATION_MUL_P,
+  VM_OPERATION_AND_P,
+  VM_OPERATION_OR_P,
+  VM_OPERATION_XOR_P,
+  VM_OPERATION_SHL_P,
+  VM_OPERATION_SHR_P,
+  VM_OPERATION_ADD_B,
+  VM_OPERATION_SUB_B,
+  VM_OPERATION_SHL_B,
+  VM_OPERATION_JMP_S,
+  VM_OPERATION_JEQ_S,
+  VM_OPERATION_JNE_S,
+  VM_OPERATION_JLT_S,
+  VM_OPERATION_JGT_S,
+  VM_OPERATION_JLE_S,
+  VM_OPERATION_JGE_S,
+  VM_OPERATION_CALL_S,
+  VM_OPERATION_MOV_R_RD,
+  VM_OPERATION_MOV_R_RX,
+  VM_OPERATION_MOV_RD_R,
+  VM_OPERATION_MOV_RX_R,
+  VM_OPERATION_MOVB_R_RD,
+  VM_OPERATION_MOVB_R_RX,
+  VM_OPERATION_MOVB_RD_R,
+  VM_OPERATION_MOVB_RX_R,
+  VM_OPERATION_FMUL_I,
+  VM_OPERATION_FMUL_R,
+  VM_OPERATION_FDIV_I,
+  VM_OPERATION_FDIV_R,
+  VM_OPERATION_MULW_I,
+  VM_OPERATION_MULW_R,
+  VM_OPERATION_PADD,
+  VM_OPERATION_PSUB,
+  VM_OPERATION_PCMPEQ,
+  VM_OPERATION_PCMPGT,
+  VM_OPERATION_PMIN,
+  VM_OPERATION_PMAX,
+  VM_OPERATION_PSHUF,
+  VM_OPERATION_VLD,
+  VM_OPERATION_VST,
+  VM_OPERATION_VSPLAT,
+  VM_OPERATION_VADD,
+  VM_OPERATION_VSUB,
+  VM_OPERATION_VCMPEQ,
+  VM_OPERATION_VCMPGT,
+  VM_OPERATION_VMIN,
+  VM_OPERATION_VMAX,
+  VM_OPERATION_VSHUF,
+  VM_OPERATION_VAND,
+  VM_OPERATION_VOR,
+  VM_OPERATION_VXOR,
 
   VM_OPERATION_COUNT,
 } VM_Operation;
 
 
+// Counters exposed to the guest through `vm_device_counter`, each one 64 bits wide.
+typedef enum
+{
+  VM_COUNTER_INSTRUCTIONS,
+  VM_COUNTER_BRANCHES_TAKEN,
+  VM_COUNTER_BRANCHES_NOT_TAKEN,
+  VM_COUNTER_CALLS,
+  VM_COUNTER_STACK_HIGH_WATER,
+  VM_COUNTER_COUNT,
+} VM_Counter;
+
+
 typedef enum
 {
   VM_ERROR_NONE,
   VM_ERROR_ILLEGAL_OPERATION,
+  VM_ERROR_PROTECTION,
+  VM_ERROR_DIVISION_BY_ZERO,
   VM_ERROR_COUNT,
 } VM_Error;
 
 
+// A fault raised by the operation at `ip`. `address` is the access that faulted for protection
+// faults, and `ip` otherwise.
+typedef struct VM_Trap
+{
+  VM_Error error;
+  word ip;
+  word address;
+} VM_Trap;
+
+
+// Access rights of a device block. Data reads and stores are checked against the blocks they
+// touch, fetches only against the block holding the opcode.
+typedef enum
+{
+  VM_PROTECTION_READ = 1 << 0,
+  VM_PROTECTION_WRITE = 1 << 1,
+  VM_PROTECTION_EXECUTE = 1 << 2,
+  VM_PROTECTION_ALL = VM_PROTECTION_READ | VM_PROTECTION_WRITE | VM_PROTECTION_EXECUTE,
+} VM_Protection;
+
+
 // Devices have their own read / store operations, this allows for custom behavior on that
 // operation. State is a pointer to a utility value that the read / store function can work with!
 typedef struct VM_Device
@@ -145,18 +261,64 @@ typedef struct VM_Device
 
 
 extern VM_Device vm_device_ram;
+extern VM_Device vm_device_counter;
+
+
+// Always-on performance counters. Instruction fetches are not counted as reads, and word
+// accesses count once, even when the device splits them into bytes.
+typedef struct VM_Stats
+{
+  uint64_t instructions;
+  uint64_t branches_taken;
+  uint64_t branches_not_taken;
+  uint64_t calls;
+
+  // Deepest the stack has been, in bytes below its initial address.
+  word stack_high_water;
+
+  // Indexed by device block, i.e. address / VM_DEVICE_BLOCK_SIZE.
+  uint64_t reads[VM_DEVICE_BLOCK_COUNT];
+  uint64_t stores[VM_DEVICE_BLOCK_COUNT];
+  uint64_t executes[VM_DEVICE_BLOCK_COUNT];
+} VM_Stats;
+
+
+// An engine executes one basic block: every operation up to and including the next control
+// transfer, or until the VM halts. Returns the number of operations retired.
+typedef struct VM_Engine
+{
+  const char *name;
+  size_t (*run_block) (VM *);
+} VM_Engine;
+
+
+extern const VM_Engine vm_engines[];
+extern const size_t vm_nengine;
 
 
 typedef struct VM
 {
   word registers[VM_REGISTER_COUNT];
+  uint64_t vectors[VM_VECTOR_COUNT];
   word *ip;
   word *sp;
   word *bp;
 
+  // Stands in for an illegal register operand of a v1 operation once it has faulted.
+  word scratch;
+
   byte *memory;
   VM_Device **devices;
 
+  // `VM_Protection` bits, indexed by device block.
+  byte *protection;
+
+  // The VM owning the memory, devices and protection when this is another core of it.
+  VM *primary;
+
+  // Initial stack pointer, for the stack high-water mark.
+  word stack;
+
   size_t nmemory;
   size_t ndevice;
 
@@ -167,20 +329,40 @@ typedef struct VM
   } flags;
 
   bool halt;
+
+  // The first fault, which halts the VM unless `on_trap` handles it by returning true. The
+  // faulting access is dropped, reads return 0, and IP is past the operation. Fetching from a
+  // block that isn't executable leaves IP at the operation instead, `trap.ip == trap.address`,
+  // and the VM stays halted unless the handler moves IP or makes the block executable. The host
+  // clears `trap` before resuming a VM the handler didn't.
+  VM_Trap trap;
+  bool (*on_trap) (VM *, const VM_Trap *);
+  void *trap_state;
+
+  VM_Stats stats;
+
+  // Snapshot read by the guest through `vm_device_counter`, taken on every store to it.
+  uint64_t counters[VM_COUNTER_COUNT];
 } VM;
 
 
 char *vm_register_name (VM_Register index);
 char *vm_operation_name (VM_Operation index);
 char *vm_error_name (VM_Error index);
+char *vm_counter_name (VM_Counter index);
 
 void vm_create (VM *vm);
+void vm_create_core (VM *core, VM *vm, word id);
 void vm_destroy (VM *vm);
 
 void vm_load (VM *vm, byte *memory, size_t nmemory);
 bool vm_load_file (VM *vm, const char *path);
 
 void vm_map_device (VM *vm, VM_Device *device, word start, word end);
+void vm_protect (VM *vm, word start, word end, byte protection);
+void vm_fault (VM *vm, VM_Error error, word address);
+void vm_trap (VM *vm, word ip);
+void vm_fetch_fault (VM *vm, word ip);
 
 byte vm_default_read_byte (VM *vm, VM_Device *device, word address);
 word vm_default_read_word (VM *vm, VM_Device *device, word address);
@@ -198,6 +380,10 @@ word vm_next_word (VM *vm);
 
 word vm_next_register_value (VM *vm);
 word *vm_next_register_address (VM *vm);
+bool vm_next_register_pair (VM *vm, byte *high, byte *low);
+word vm_next_target (VM *vm);
+word vm_next_displacement_address (VM *vm);
+bool vm_next_indexed_address (VM *vm, word *address);
 
 void vm_store_byte (VM *vm, word address, byte value);
 void vm_store_word (VM *vm, word address, word value);
@@ -209,14 +395,39 @@ byte vm_pop_byte (VM *vm);
 word vm_pop_word (VM *vm);
 
 void vm_compare (VM *vm, word a, word b);
+
+// Signed VM_FIXED_BITS fixed point. The product is rounded down, the quotient toward zero, and
+// both keep the low word of a result that overflows. `b` can't be 0.
+word vm_fixed_multiply (word a, word b);
+word vm_fixed_divide (word a, word b);
 void vm_jump (VM *vm, word address, bool condition);
 
 void vm_execute (VM *vm, VM_Operation operation);
 void vm_step (VM *vm);
 
+VM_Trap vm_run (VM *vm, const VM_Engine *engine);
+
+bool vm_operation_ends_block (VM_Operation operation);
+word vm_operation_size (VM_Operation operation);
+
+size_t vm_run_block (VM *vm);
+size_t vm_fast_run_block (VM *vm);
+
+const VM_Engine *vm_find_engine (const char *name);
+
+word vm_disassemble (VM *vm, word address, char *buffer, size_t n);
+
+void vm_get_stats (VM *vm, VM_Stats *stats);
+void vm_get_device_stats (VM *vm, VM_Device *device, uint64_t *reads, uint64_t *stores);
+
 void vm_view_register (VM *vm, VM_Register index);
 void vm_view_memory (VM *vm, word address, word b, word a, int decode);
 
 
+#ifdef __cplusplus
+}
+#endif
+
+
 #endif // VM_H
 
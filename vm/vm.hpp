@@ -0,0 +1,343 @@
+#ifndef VM_HPP
+#define VM_HPP
+
+
+#include "simd.h"
+#include "vm.h"
+
+#include <array>
+#include <cstddef>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+
+
+namespace vm
+{
+
+
+// Whether a device type has a member like `byte read_byte (VM &, word)`, and so on.
+#define VM_HPP_DETECT(NAME, ...)                                                               \
+  template <typename T, typename = void> struct has_##NAME : std::false_type                   \
+  {                                                                                            \
+  };                                                                                           \
+  template <typename T>                                                                        \
+  struct has_##NAME<T, std::void_t<decltype (std::declval<T &> ().NAME (__VA_ARGS__))>>       \
+    : std::true_type                                                                           \
+  {                                                                                            \
+  };
+
+VM_HPP_DETECT (read_byte, std::declval<VM &> (), word ())
+VM_HPP_DETECT (read_word, std::declval<VM &> (), word ())
+VM_HPP_DETECT (store_byte, std::declval<VM &> (), word (), byte ())
+VM_HPP_DETECT (store_word, std::declval<VM &> (), word (), word ())
+
+#undef VM_HPP_DETECT
+
+
+// The `VM_Device` callbacks of a device type, each a direct call to its member. Accesses it
+// has no member for behave like RAM, word accesses being split into byte accesses.
+template <typename T> struct Thunks
+{
+  static byte
+  read_byte (VM *vm, VM_Device *device, word address)
+  {
+    if constexpr (has_read_byte<T>::value)
+      return static_cast<T *> (device->state)->read_byte (*vm, address);
+    else
+      return vm_default_read_byte (vm, device, address);
+  }
+
+  static word
+  read_word (VM *vm, VM_Device *device, word address)
+  {
+    if constexpr (has_read_word<T>::value)
+      return static_cast<T *> (device->state)->read_word (*vm, address);
+    else
+      return vm_default_read_word (vm, device, address);
+  }
+
+  static void
+  store_byte (VM *vm, VM_Device *device, word address, byte value)
+  {
+    if constexpr (has_store_byte<T>::value)
+      static_cast<T *> (device->state)->store_byte (*vm, address, value);
+    else
+      vm_default_store_byte (vm, device, address, value);
+  }
+
+  static void
+  store_word (VM *vm, VM_Device *device, word address, word value)
+  {
+    if constexpr (has_store_word<T>::value)
+      static_cast<T *> (device->state)->store_word (*vm, address, value);
+    else
+      vm_default_store_word (vm, device, address, value);
+  }
+
+  static VM_Device
+  make (T &device)
+  {
+    return VM_Device{ read_byte, read_word, store_byte, store_word, &device };
+  }
+};
+
+
+// A device of type T mapped to the blocks from `Start` to `End`, with the same inclusive
+// block range semantics as `vm_map_device`.
+template <word Start, word End, typename T> struct Map
+{
+  static_assert (Start <= End, "a map ends before it starts");
+
+  using Device = T;
+
+  static constexpr word start = Start;
+  static constexpr word end = End;
+
+  static constexpr bool
+  contains (word address)
+  {
+    return address / VM_DEVICE_BLOCK_SIZE >= Start / VM_DEVICE_BLOCK_SIZE
+           && address / VM_DEVICE_BLOCK_SIZE <= End / VM_DEVICE_BLOCK_SIZE;
+  }
+};
+
+
+// The fast engine instantiated for a device map. Data accesses that miss RAM are resolved by a
+// chain of inlined range checks and call the device's member directly. They go through
+// `vm_read_byte` and friends instead when they fault, or when the block no longer holds the
+// mapped device, e.g. under a tap. Operations the engine defers still use `VM_Device`.
+template <typename... Maps> struct Engine
+{
+#define VM_FAST_FUNCTION static
+#define VM_FAST_DEVICE_READ_BYTE device_read_byte
+#define VM_FAST_DEVICE_READ_WORD device_read_word
+#define VM_FAST_DEVICE_STORE_BYTE device_store_byte
+#define VM_FAST_DEVICE_STORE_WORD device_store_word
+
+#include "fast.h"
+
+  static byte
+  device_read_byte (VM *vm, word address)
+  {
+    return resolve<sizeof...(Maps)> (
+      vm, address, false, VM_PROTECTION_READ, vm->stats.reads,
+      [&] (auto thunks, VM_Device *device) { return thunks.read_byte (vm, device, address); },
+      [&] { return vm_read_byte (vm, address); });
+  }
+
+  static word
+  device_read_word (VM *vm, word address)
+  {
+    return resolve<sizeof...(Maps)> (
+      vm, address, true, VM_PROTECTION_READ, vm->stats.reads,
+      [&] (auto thunks, VM_Device *device) { return thunks.read_word (vm, device, address); },
+      [&] { return vm_read_word (vm, address); });
+  }
+
+  static void
+  device_store_byte (VM *vm, word address, byte value)
+  {
+    resolve<sizeof...(Maps)> (
+      vm, address, false, VM_PROTECTION_WRITE, vm->stats.stores,
+      [&] (auto thunks, VM_Device *device) { thunks.store_byte (vm, device, address, value); },
+      [&] { vm_store_byte (vm, address, value); });
+  }
+
+  static void
+  device_store_word (VM *vm, word address, word value)
+  {
+    resolve<sizeof...(Maps)> (
+      vm, address, true, VM_PROTECTION_WRITE, vm->stats.stores,
+      [&] (auto thunks, VM_Device *device) { thunks.store_word (vm, device, address, value); },
+      [&] { vm_store_word (vm, address, value); });
+  }
+
+  // Checks the maps from the last one down. The first containing `address` gets `device` called
+  // with its thunks and counted in `counts`, when its device is still mapped there and the
+  // access is allowed. Anything else gets `fallback`.
+  template <std::size_t I, typename Device, typename Fallback>
+  static auto
+  resolve (VM *vm, word address, bool wide, byte protection, uint64_t *counts, Device device,
+           Fallback fallback)
+  {
+    if constexpr (I == 0)
+      return fallback ();
+    else
+      {
+        using M = std::tuple_element_t<I - 1, std::tuple<Maps...>>;
+        using T = Thunks<typename M::Device>;
+
+        if (!M::contains (address))
+          return resolve<I - 1> (vm, address, wide, protection, counts, device, fallback);
+
+        std::size_t block = address / VM_DEVICE_BLOCK_SIZE;
+        VM_Device *mapped = vm->devices[block];
+
+        if (mapped->read_byte != T::read_byte || !(vm->protection[block] & protection)
+            || (wide
+                && !(vm->protection[word (address + 1) / VM_DEVICE_BLOCK_SIZE] & protection)))
+          return fallback ();
+
+        counts[block]++;
+        return device (T (), mapped);
+      }
+  }
+};
+
+
+// A VM owning its memory, with a device map fixed at compile time. Later maps win where they
+// overlap, like successive `vm_map_device` calls.
+//
+// `run` uses the `Engine` of the map, so guest accesses to the devices are resolved at compile
+// time. The `VM_Device` callbacks, for the C engines and the host's other modules, call the
+// device members directly too. The host's own accesses through `read_byte` and friends are
+// resolved the same way, but aren't counted in the stats nor checked against the protection,
+// like a debugger's.
+template <typename... Maps> class Machine
+{
+public:
+  explicit Machine (typename Maps::Device &...devices)
+    : tables_{ { Thunks<typename Maps::Device>::make (devices)... } }
+  {
+    vm_create (&vm_);
+
+    std::size_t i = 0;
+    (vm_map_device (&vm_, &tables_[i++], Maps::start, Maps::end), ...);
+  }
+
+  ~Machine () { vm_destroy (&vm_); }
+
+  // The VM points into `tables_`, it can't move.
+  Machine (const Machine &) = delete;
+  Machine &operator= (const Machine &) = delete;
+
+  VM *
+  get ()
+  {
+    return &vm_;
+  }
+
+  bool
+  load (const char *path)
+  {
+    return vm_load_file (&vm_, path);
+  }
+
+  void
+  load (const byte *memory, std::size_t n)
+  {
+    vm_load (&vm_, const_cast<byte *> (memory), n);
+  }
+
+  word &
+  operator[] (VM_Register index)
+  {
+    return vm_.registers[index];
+  }
+
+  bool
+  halted () const
+  {
+    return vm_.halt;
+  }
+
+  const VM_Trap &
+  trap () const
+  {
+    return vm_.trap;
+  }
+
+  const VM_Stats &
+  stats () const
+  {
+    return vm_.stats;
+  }
+
+  void
+  step ()
+  {
+    vm_step (&vm_);
+  }
+
+  VM_Trap
+  run ()
+  {
+    while (!vm_.halt)
+      Engine<Maps...>::vm_fast_engine (&vm_);
+
+    return vm_.trap;
+  }
+
+  VM_Trap
+  run (const VM_Engine *engine)
+  {
+    return vm_run (&vm_, engine);
+  }
+
+  byte
+  read_byte (word address)
+  {
+    return dispatch<sizeof...(Maps)> (
+      address, [&] { return vm_.memory[address]; },
+      [&] (auto thunks, VM_Device *device) { return thunks.read_byte (&vm_, device, address); });
+  }
+
+  word
+  read_word (word address)
+  {
+    return dispatch<sizeof...(Maps)> (
+      address,
+      [&] { return word (VM_WORD_PACK (vm_.memory[word (address + 1)], vm_.memory[address])); },
+      [&] (auto thunks, VM_Device *device) { return thunks.read_word (&vm_, device, address); });
+  }
+
+  void
+  store_byte (word address, byte value)
+  {
+    dispatch<sizeof...(Maps)> (
+      address, [&] { vm_.memory[address] = value; },
+      [&] (auto thunks, VM_Device *device) { thunks.store_byte (&vm_, device, address, value); });
+  }
+
+  void
+  store_word (word address, word value)
+  {
+    dispatch<sizeof...(Maps)> (
+      address,
+      [&] {
+        vm_.memory[address] = VM_WORD_L (value);
+        vm_.memory[word (address + 1)] = VM_WORD_H (value);
+      },
+      [&] (auto thunks, VM_Device *device) { thunks.store_word (&vm_, device, address, value); });
+  }
+
+private:
+  // Checks the maps from the last one down, calling `device` with the thunks of the first
+  // that contains `address`, or `ram` when none does.
+  template <std::size_t I, typename Ram, typename Device>
+  auto
+  dispatch (word address, Ram ram, Device device)
+  {
+    if constexpr (I == 0)
+      return ram ();
+    else
+      {
+        using M = std::tuple_element_t<I - 1, std::tuple<Maps...>>;
+
+        if (M::contains (address))
+          return device (Thunks<typename M::Device> (), &tables_[I - 1]);
+
+        return dispatch<I - 1> (address, ram, device);
+      }
+  }
+
+  VM vm_{};
+  std::array<VM_Device, sizeof...(Maps)> tables_;
+};
+
+
+} // namespace vm
+
+
+#endif // VM_HPP